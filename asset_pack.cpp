@@ -0,0 +1,350 @@
+/*
+	Asset pack.
+
+	A pack is one file built offline by pack_tool from loose assets:
+
+		ASSET_PACK_HEADER
+		ASSET_PACK_ENTRY[entry_count]  sorted by hash
+		names                          NUL terminated paths
+		blobs                          each at a multiple of ASSET_PACK_ALIGNMENT
+
+	Entries are looked up by the 64 bit FNV-1a hash of their path with a
+	binary search, and names are compared to settle collisions. Each blob
+	is followed by a NUL byte that is not counted in its size, so text
+	assets can be used in place as C strings.
+
+	The pack is mmapped once. Stored entries are handed out as views into
+	the mapping and nothing is copied. Compressed entries (zlib, for text
+	and other data that shrinks) are inflated into a malloc'd buffer.
+	asset_prefetch() sorts a batch of entries by offset, merges the ones
+	that sit next to each other and issues one madvise(MADV_WILLNEED) per
+	run. The kernel reads those pages ahead in the background while
+	startup continues, instead of faulting them in one at a time.
+
+	Names that are not in the pack, or were shadowed after the pack was
+	built (see asset_shadow()), are read from loose files, so a missing
+	pack only costs speed.
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include "stb_image.h"
+
+#define ASSET_PACK_MAGIC 0x4B415043 // "CPAK"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 64
+#define ASSET_COMPRESSED 0x1
+
+struct ASSET_PACK_HEADER
+{
+	u4 magic;
+	u4 version;
+	u4 entry_count;
+	u4 names_size;
+	u8 toc_offset;
+	u8 names_offset;
+};
+
+struct ASSET_PACK_ENTRY
+{
+	u8 hash;
+	u8 offset;
+	u8 size;     // bytes stored in the pack
+	u8 raw_size; // bytes after inflating, equals size when stored
+	u4 name_offset;
+	u4 flags;
+};
+
+struct ASSET_DATA
+{
+	const u1* data; // NUL terminated, data[size] == 0
+	u8 size;
+	b4 owned;       // free with asset_release()
+};
+
+struct ASSET_PACK
+{
+	s4 fd;
+	u1* base;
+	u8 size;
+	const ASSET_PACK_HEADER* header;
+	const ASSET_PACK_ENTRY* entries;
+	const char* names;
+	u1* shadowed; // per entry, 1 when a loose file replaces it
+	f4 resident;  // fraction of the pack in the page cache when opened
+
+	// startup statistics
+	u4 pack_loads;
+	u4 loose_loads;
+	u8 bytes_loaded;
+} asset_pack;
+
+u8 asset_hash(const char* name)
+{
+	u8 hash = 14695981039346656037ULL;
+	for (const u1* c = (const u1*)name; *c; c++)
+	{
+		hash ^= *c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+	Every entry's blob, with its trailing NUL, and its name lie inside the
+	mapping, so nothing read through the table can run past the file.
+*/
+b4 validate_asset_pack_entries()
+{
+	const ASSET_PACK_HEADER* h = asset_pack.header;
+	for (u4 i = 0; i < h->entry_count; i++)
+	{
+		const ASSET_PACK_ENTRY &e = asset_pack.entries[i];
+		if (e.offset > asset_pack.size || e.size >= asset_pack.size - e.offset ||
+			asset_pack.base[e.offset + e.size] != 0 ||
+			(!(e.flags & ASSET_COMPRESSED) && e.raw_size != e.size) ||
+			e.name_offset >= h->names_size ||
+			!memchr(asset_pack.names + e.name_offset, 0, h->names_size - e.name_offset))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	Map a pack built by pack_tool. Returns false, leaving loose file loading
+	in place, if the file is missing or is not a valid pack.
+*/
+b4 open_asset_pack(const char* path)
+{
+	memset(&asset_pack, 0, sizeof(asset_pack));
+	asset_pack.fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (asset_pack.fd < 0) return false;
+
+	struct stat st;
+	if (fstat(asset_pack.fd, &st) != 0 || (u8)st.st_size < sizeof(ASSET_PACK_HEADER))
+	{
+		close(asset_pack.fd);
+		return false;
+	}
+	asset_pack.size = st.st_size;
+	void* base = mmap(0, asset_pack.size, PROT_READ, MAP_SHARED, asset_pack.fd, 0);
+	if (base == MAP_FAILED)
+	{
+		cerr << "ERROR: could not map " << path << endl;
+		close(asset_pack.fd);
+		return false;
+	}
+	asset_pack.base = (u1*)base;
+
+	const ASSET_PACK_HEADER* h = (const ASSET_PACK_HEADER*)asset_pack.base;
+	if (h->magic != ASSET_PACK_MAGIC || h->version != ASSET_PACK_VERSION ||
+		h->toc_offset > asset_pack.size || (u8)h->entry_count * sizeof(ASSET_PACK_ENTRY) > asset_pack.size - h->toc_offset ||
+		h->names_offset > asset_pack.size || h->names_size > asset_pack.size - h->names_offset)
+	{
+		cerr << "ERROR: " << path << " is not a valid asset pack" << endl;
+		munmap(asset_pack.base, asset_pack.size);
+		close(asset_pack.fd);
+		memset(&asset_pack, 0, sizeof(asset_pack));
+		return false;
+	}
+	asset_pack.header = h;
+	asset_pack.entries = (const ASSET_PACK_ENTRY*)(asset_pack.base + h->toc_offset);
+	asset_pack.names = (const char*)(asset_pack.base + h->names_offset);
+	if (!validate_asset_pack_entries())
+	{
+		cerr << "ERROR: " << path << " has corrupt entries, not using it" << endl;
+		munmap(asset_pack.base, asset_pack.size);
+		close(asset_pack.fd);
+		memset(&asset_pack, 0, sizeof(asset_pack));
+		return false;
+	}
+	asset_pack.shadowed = (u1*)calloc(h->entry_count ? h->entry_count : 1, 1);
+
+	// how much of the pack a previous run left in the page cache, cold or warm start
+	long page = sysconf(_SC_PAGESIZE);
+	u8 pages = (asset_pack.size + page - 1) / page;
+	unsigned char* in_core = (unsigned char*)malloc(pages);
+	asset_pack.resident = 0.0f;
+	if (mincore(asset_pack.base, asset_pack.size, in_core) == 0)
+	{
+		u8 count = 0;
+		for (u8 i = 0; i < pages; i++) count += in_core[i] & 1;
+		asset_pack.resident = (f4)count / pages;
+	}
+	free(in_core);
+	return true;
+}
+
+void close_asset_pack()
+{
+	if (!asset_pack.base) return;
+	munmap(asset_pack.base, asset_pack.size);
+	close(asset_pack.fd);
+	free(asset_pack.shadowed);
+	memset(&asset_pack, 0, sizeof(asset_pack));
+}
+
+/*
+	Index of name in the table of contents, or -1.
+*/
+s4 find_asset(const char* name)
+{
+	if (!asset_pack.header) return -1;
+	u8 hash = asset_hash(name);
+	s4 low = 0;
+	s4 high = (s4)asset_pack.header->entry_count;
+	while (low < high)
+	{
+		s4 mid = (low + high) / 2;
+		if (asset_pack.entries[mid].hash < hash) low = mid + 1;
+		else high = mid;
+	}
+	for (s4 i = low; i < (s4)asset_pack.header->entry_count && asset_pack.entries[i].hash == hash; i++)
+	{
+		if (strcmp(asset_pack.names + asset_pack.entries[i].name_offset, name)) continue;
+		return asset_pack.shadowed[i] ? -1 : i;
+	}
+	return -1;
+}
+
+/*
+	From now on read name from its loose file, e.g. after it was edited.
+*/
+void asset_shadow(const char* name)
+{
+	s4 index = find_asset(name);
+	if (index >= 0) asset_pack.shadowed[index] = 1;
+}
+
+/*
+	Start reading a batch of entries in the background. Entries that are
+	next to each other in the pack are merged into one request.
+*/
+void asset_prefetch(const char* const* names, s4 count)
+{
+	if (!asset_pack.header) return;
+	std::vector<const ASSET_PACK_ENTRY*> batch;
+	for (s4 i = 0; i < count; i++)
+	{
+		s4 index = find_asset(names[i]);
+		if (index >= 0) batch.push_back(&asset_pack.entries[index]);
+	}
+	std::sort(batch.begin(), batch.end(), [](const ASSET_PACK_ENTRY* a, const ASSET_PACK_ENTRY* b) {
+		return a->offset < b->offset;
+	});
+
+	long page = sysconf(_SC_PAGESIZE);
+	size_t i = 0;
+	while (i < batch.size())
+	{
+		u8 begin = batch[i]->offset & ~(u8)(page - 1);
+		u8 end = batch[i]->offset + batch[i]->size + 1;
+		// merge runs whose gap is smaller than a page, reading it is cheaper than another request
+		while (++i < batch.size() && batch[i]->offset <= end + page)
+		{
+			end = batch[i]->offset + batch[i]->size + 1;
+		}
+		madvise(asset_pack.base + begin, end - begin, MADV_WILLNEED);
+	}
+}
+
+b4 read_loose_file(const char* name, ASSET_DATA &out)
+{
+	FILE* file = fopen(name, "rb");
+	if (!file) return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	u1* data = (u1*)malloc(size + 1);
+	b4 ok = size >= 0 && fread(data, 1, size, file) == (size_t)size;
+	fclose(file);
+	if (!ok)
+	{
+		free(data);
+		return false;
+	}
+	data[size] = 0;
+	out.data = data;
+	out.size = size;
+	out.owned = true;
+	return true;
+}
+
+/*
+	Contents of name, from the pack when it is there and from a loose file
+	otherwise. Release with asset_release().
+*/
+b4 asset_load(const char* name, ASSET_DATA &out)
+{
+	out.data = 0;
+	out.size = 0;
+	out.owned = false;
+
+	s4 index = find_asset(name);
+	if (index < 0)
+	{
+		if (!read_loose_file(name, out)) return false;
+		asset_pack.loose_loads++;
+		asset_pack.bytes_loaded += out.size;
+		return true;
+	}
+
+	const ASSET_PACK_ENTRY &e = asset_pack.entries[index];
+	const u1* stored = asset_pack.base + e.offset;
+	if (e.flags & ASSET_COMPRESSED)
+	{
+		u1* data = (u1*)malloc(e.raw_size + 1);
+		s4 length = stbi_zlib_decode_buffer((char*)data, (s4)e.raw_size, (const char*)stored, (s4)e.size);
+		if (length != (s4)e.raw_size)
+		{
+			cerr << "ERROR: corrupt asset " << name << " in pack" << endl;
+			free(data);
+			return false;
+		}
+		data[e.raw_size] = 0;
+		out.data = data;
+		out.owned = true;
+	}
+	else
+	{
+		out.data = stored;
+	}
+	out.size = e.raw_size;
+	asset_pack.pack_loads++;
+	asset_pack.bytes_loaded += out.size;
+	return true;
+}
+
+void asset_release(ASSET_DATA &asset)
+{
+	if (asset.owned) free((void*)asset.data);
+	asset.data = 0;
+	asset.size = 0;
+	asset.owned = false;
+}
+
+/*
+	stbi_load() through the pack.
+*/
+stbi_uc* asset_load_image(const char* name, int* x, int* y, int* n, int req_comp)
+{
+	ASSET_DATA asset;
+	if (!asset_load(name, asset)) return 0;
+	stbi_uc* pixels = stbi_load_from_memory(asset.data, (int)asset.size, x, y, n, req_comp);
+	asset_release(asset);
+	return pixels;
+}
+
+f4* asset_load_imagef(const char* name, int* x, int* y, int* n, int req_comp)
+{
+	ASSET_DATA asset;
+	if (!asset_load(name, asset)) return 0;
+	f4* pixels = stbi_loadf_from_memory(asset.data, (int)asset.size, x, y, n, req_comp);
+	asset_release(asset);
+	return pixels;
+}
@@ -0,0 +1,441 @@
+/*
+	Batch rendering.
+
+	./sample_program --batch views.txt --batch-out thumbs
+	./sample_program --batch views.txt --batch-out - > stream
+
+	Renders a list of views without the interactive loop. Each line of the
+	view file is
+
+		name width height angle [radius elevation fov]
+
+	A camera orbits the scene like the interactive one: it sits at angle
+	(radians) around the up axis, radius away from it, elevation above the
+	ground, and looks at the origin. fov is the vertical field of view in
+	degrees. The defaults are 7, 6.5 and 45. Lines starting with # are
+	skipped.
+
+	Views are shelf packed into one BATCH_ATLAS_SIZE square render target,
+	so a single pass draws as many of them as fit, each into its own
+	viewport. Each tile is then read back, tightly packed, into the next
+	buffer of a readback ring, which is mapped only once the reads have
+	landed, normally while the next atlas is being drawn, so the GPU never
+	waits on the CPU. Encoding runs on a pool of worker threads.
+
+	With --batch-out DIR every view is written to DIR/name.png. With
+	--batch-out - the PNGs are streamed to stdout, each one preceded by a
+	"name width height bytes" line. Log output is moved to stderr so it
+	cannot corrupt the stream. Records can arrive in any order.
+
+	Occlusion queries carry visibility from one frame to the next of the
+	same camera, so they are turned off for the batch.
+*/
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define BATCH_ATLAS_SIZE 2048
+#define BATCH_JOB_COUNT 32   // views queued for the workers
+#define BATCH_MAX_WORKERS 8
+#define BATCH_MAX_TILES 256  // views drawn into one atlas
+#define BATCH_NAME_LENGTH 128
+
+void _RENDER_NORMAL(glm::mat4 &view, glm::mat4 &projection, vec3 scale, s4 x, s4 y, s4 width, s4 height);
+
+struct BATCH_VIEW
+{
+	char name[BATCH_NAME_LENGTH];
+	s4 width;
+	s4 height;
+	f4 angle;
+	f4 radius;
+	f4 elevation;
+	f4 fov; // degrees
+};
+
+struct BATCH_TILE
+{
+	s4 view;
+	s4 x;
+	s4 y;
+	u4 offset; // bytes into the slot's readback buffer
+};
+
+// tiles of one atlas readback, indexed like batch.ring.buffers
+struct BATCH_SLOT
+{
+	BATCH_TILE tiles[BATCH_MAX_TILES];
+	s4 tile_count;
+};
+
+enum BATCH_JOB_STATE
+{
+	BATCH_JOB_FREE,
+	BATCH_JOB_QUEUED,
+	BATCH_JOB_BUSY,
+};
+
+struct BATCH_JOB
+{
+	s4 state;
+	s4 view;
+	u1* pixels; // RGBA8, bottom row first
+	s4 capacity;
+};
+
+struct BATCH
+{
+	std::vector<BATCH_VIEW> views;
+	const char* out; // directory, or "-" for stdout
+	FILE* stream;    // stdout stream, 0 when writing files
+
+	RENDER_TARGET* atlas;
+	READBACK_RING ring;
+	BATCH_SLOT slots[READBACK_RING_SIZE];
+
+	BATCH_JOB jobs[BATCH_JOB_COUNT];
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::mutex stream_lock;
+	std::condition_variable job_ready;
+	std::condition_variable job_done;
+	b4 running;
+
+	u4 images_written; // by the workers, under lock
+	u4 images_failed;
+} batch;
+
+/*
+	Read the view list. Returns false if the file cannot be read or a line
+	is malformed.
+*/
+b4 load_batch_views(const char* path)
+{
+	ASSET_DATA file;
+	if (!read_loose_file(path, file))
+	{
+		cerr << "ERROR: could not read batch file " << path << endl;
+		return false;
+	}
+	b4 ok = true;
+	s4 line_number = 0;
+	const char* line = (const char*)file.data;
+	while (line && *line)
+	{
+		line_number++;
+		const char* next = strchr(line, '\n');
+		char text[512];
+		s4 length = next ? (s4)(next - line) : (s4)strlen(line);
+		if (length >= (s4)sizeof(text)) length = sizeof(text) - 1;
+		memcpy(text, line, length);
+		text[length] = 0;
+		line = next ? next + 1 : 0;
+
+		char* start = text;
+		while (*start == ' ' || *start == '\t') start++;
+		if (*start == 0 || *start == '#' || *start == '\r') continue;
+
+		BATCH_VIEW v;
+		v.radius = 7.0f;
+		v.elevation = 6.5f;
+		v.fov = 45.0f;
+		s4 fields = sscanf(start, "%127s %d %d %f %f %f %f", v.name, &v.width, &v.height,
+			&v.angle, &v.radius, &v.elevation, &v.fov);
+		if (fields < 4 || v.width <= 0 || v.height <= 0 ||
+			v.width > BATCH_ATLAS_SIZE || v.height > BATCH_ATLAS_SIZE)
+		{
+			cerr << "ERROR: " << path << ":" << line_number << ": expected name width height angle [radius elevation fov],"
+				 << " at most " << BATCH_ATLAS_SIZE << " pixels a side" << endl;
+			ok = false;
+			continue;
+		}
+		batch.views.push_back(v);
+	}
+	asset_release(file);
+	return ok;
+}
+
+b4 write_batch_png(const BATCH_VIEW &v, BATCH_JOB &job)
+{
+	// negative stride walks the rows bottom up, so the image is top row first
+	s4 stride = v.width * 4;
+	const u1* top = job.pixels + (v.height - 1) * stride;
+	if (!batch.stream)
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s.png", batch.out, v.name);
+		if (stbi_write_png(path, v.width, v.height, 4, top, -stride)) return true;
+		cerr << "batch: could not write " << path << endl;
+		return false;
+	}
+
+	std::vector<u1> png;
+	stbi_write_png_to_func([](void* context, void* data, int size) {
+		std::vector<u1>* out = (std::vector<u1>*)context;
+		out->insert(out->end(), (u1*)data, (u1*)data + size);
+	}, &png, v.width, v.height, 4, top, -stride);
+	if (png.empty()) return false;
+
+	std::lock_guard<std::mutex> guard(batch.stream_lock);
+	fprintf(batch.stream, "%s %d %d %zu\n", v.name, v.width, v.height, png.size());
+	return fwrite(png.data(), 1, png.size(), batch.stream) == png.size();
+}
+
+void batch_worker()
+{
+	std::unique_lock<std::mutex> guard(batch.lock);
+	for (;;)
+	{
+		BATCH_JOB* job = 0;
+		batch.job_ready.wait(guard, [&job]{
+			for (s4 i = 0; i < BATCH_JOB_COUNT && !job; i++)
+			{
+				if (batch.jobs[i].state == BATCH_JOB_QUEUED) job = &batch.jobs[i];
+			}
+			return job || !batch.running;
+		});
+		if (!job) return;
+		job->state = BATCH_JOB_BUSY;
+		guard.unlock();
+
+		b4 ok = write_batch_png(batch.views[job->view], *job);
+
+		guard.lock();
+		job->state = BATCH_JOB_FREE;
+		if (ok) batch.images_written++;
+		else batch.images_failed++;
+		batch.job_done.notify_one();
+	}
+}
+
+/*
+	Hand one tile of a mapped readback to the workers. Blocks only when
+	every job is queued or being encoded.
+*/
+void queue_batch_tile(const BATCH_TILE &tile, const u1* mapped)
+{
+	const BATCH_VIEW &v = batch.views[tile.view];
+	s4 size = v.width * v.height * 4;
+
+	std::unique_lock<std::mutex> guard(batch.lock);
+	BATCH_JOB* job = 0;
+	batch.job_done.wait(guard, [&job]{
+		for (s4 i = 0; i < BATCH_JOB_COUNT && !job; i++)
+		{
+			if (batch.jobs[i].state == BATCH_JOB_FREE) job = &batch.jobs[i];
+		}
+		return job != 0;
+	});
+	job->state = BATCH_JOB_BUSY; // ours until queued
+	guard.unlock();
+
+	if (job->capacity < size)
+	{
+		free(job->pixels);
+		job->pixels = (u1*)malloc(size);
+		job->capacity = size;
+	}
+	memcpy(job->pixels, mapped + tile.offset, size);
+	job->view = tile.view;
+
+	guard.lock();
+	job->state = BATCH_JOB_QUEUED;
+	guard.unlock();
+	batch.job_ready.notify_one();
+}
+
+void retire_batch_slot(s4 index)
+{
+	BATCH_SLOT &slot = batch.slots[index];
+	const u1* mapped = map_readback(batch.ring, index);
+	if (mapped)
+	{
+		for (s4 i = 0; i < slot.tile_count; i++)
+		{
+			queue_batch_tile(slot.tiles[i], mapped);
+		}
+	}
+	else
+	{
+		cerr << "batch: could not map readback" << endl;
+		std::lock_guard<std::mutex> guard(batch.lock);
+		batch.images_failed += slot.tile_count;
+	}
+	unmap_readback(batch.ring, index);
+}
+
+/*
+	Shelf pack views from first into an atlas. Returns how many fit, at
+	least one.
+*/
+s4 pack_batch_tiles(s4 first, BATCH_SLOT &slot)
+{
+	s4 x = 0, y = 0, shelf_height = 0;
+	u4 offset = 0;
+	slot.tile_count = 0;
+	for (s4 i = first; i < (s4)batch.views.size() && slot.tile_count < BATCH_MAX_TILES; i++)
+	{
+		const BATCH_VIEW &v = batch.views[i];
+		if (x + v.width > BATCH_ATLAS_SIZE)
+		{
+			x = 0;
+			y += shelf_height;
+			shelf_height = 0;
+		}
+		if (y + v.height > BATCH_ATLAS_SIZE) break;
+
+		BATCH_TILE &tile = slot.tiles[slot.tile_count++];
+		tile.view = i;
+		tile.x = x;
+		tile.y = y;
+		tile.offset = offset;
+		offset += v.width * v.height * 4;
+		x += v.width;
+		if (v.height > shelf_height) shelf_height = v.height;
+	}
+	return slot.tile_count;
+}
+
+/*
+	Draw every tile of slot into the atlas and start reading them back.
+*/
+void render_batch_atlas(BATCH_SLOT &slot)
+{
+	begin_render_target_frame();
+	begin_resource_frame();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, batch.atlas->fbo);
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(0.23f, 0.47f, 0.58f, 1.0f);
+	for (s4 i = 0; i < slot.tile_count; i++)
+	{
+		BATCH_TILE &tile = slot.tiles[i];
+		BATCH_VIEW &v = batch.views[tile.view];
+		glViewport(tile.x, tile.y, v.width, v.height);
+		glScissor(tile.x, tile.y, v.width, v.height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		glm::vec3 eye(v.radius * cosf(v.angle), v.radius * sinf(v.angle), v.elevation);
+		glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(v.fov), (f4)v.width / v.height, 0.1f, 100.0f);
+		_RENDER_NORMAL(view, projection, vec3(1.0f, 1.0f, 1.0f), tile.x, tile.y, v.width, v.height);
+	}
+	glDisable(GL_SCISSOR_TEST);
+	enforce_resource_budget();
+
+	u4 bytes = 0;
+	for (s4 i = 0; i < slot.tile_count; i++)
+	{
+		const BATCH_VIEW &v = batch.views[slot.tiles[i].view];
+		bytes += v.width * v.height * 4;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, batch.atlas->fbo);
+	begin_readback(batch.ring, bytes);
+	for (s4 i = 0; i < slot.tile_count; i++)
+	{
+		BATCH_TILE &tile = slot.tiles[i];
+		const BATCH_VIEW &v = batch.views[tile.view];
+		glReadPixels(tile.x, tile.y, v.width, v.height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)(uintptr_t)tile.offset);
+	}
+	end_readback(batch.ring);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/*
+	Render every view in views_path and write them to out. Call after the
+	scene is set up, instead of the interactive loop. Returns false if any
+	view could not be rendered or written.
+*/
+b4 run_batch_render(const char* views_path, const char* out)
+{
+	if (!load_batch_views(views_path)) return false;
+	if (!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object)
+	{
+		cerr << "ERROR: batch rendering needs pixel buffer objects" << endl;
+		return false;
+	}
+	batch.out = out;
+	batch.stream = 0;
+	if (!strcmp(out, "-"))
+	{
+		// keep the real stdout for images and send everything printed to stderr
+		fflush(stdout);
+		cout.flush();
+		batch.stream = fdopen(dup(1), "wb");
+		dup2(2, 1);
+	}
+	if (sgl.window) SDL_HideWindow(sgl.window);
+	occlusion.enabled = false;
+
+	RENDER_TARGET_DESC desc;
+	desc.width = BATCH_ATLAS_SIZE;
+	desc.height = BATCH_ATLAS_SIZE;
+	desc.color_format = GL_RGBA8;
+	desc.depth_stencil = true;
+	desc.samples = 1;
+	batch.atlas = acquire_render_target(desc);
+	if (!batch.atlas)
+	{
+		cerr << "ERROR: could not create the batch atlas" << endl;
+		return false;
+	}
+
+	init_readback_ring(batch.ring);
+	for (s4 i = 0; i < BATCH_JOB_COUNT; i++)
+	{
+		batch.jobs[i].state = BATCH_JOB_FREE;
+		batch.jobs[i].pixels = 0;
+		batch.jobs[i].capacity = 0;
+	}
+	batch.images_written = 0;
+	batch.images_failed = 0;
+	batch.running = true;
+	s4 threads = SDL_GetCPUCount() - 1;
+	if (threads < 1) threads = 1;
+	if (threads > BATCH_MAX_WORKERS) threads = BATCH_MAX_WORKERS;
+	for (s4 i = 0; i < threads; i++)
+	{
+		batch.workers.push_back(std::thread(batch_worker));
+	}
+
+	u8 begin = SDL_GetPerformanceCounter();
+	s4 atlases = 0;
+	s4 first = 0;
+	while (first < (s4)batch.views.size())
+	{
+		BATCH_SLOT &slot = batch.slots[next_readback(batch.ring, retire_batch_slot)];
+		first += pack_batch_tiles(first, slot);
+		render_batch_atlas(slot);
+		atlases++;
+	}
+
+	destroy_readback_ring(batch.ring, retire_batch_slot);
+	{
+		std::lock_guard<std::mutex> guard(batch.lock);
+		batch.running = false;
+	}
+	batch.job_ready.notify_all();
+	for (size_t i = 0; i < batch.workers.size(); i++)
+	{
+		batch.workers[i].join();
+	}
+	batch.workers.clear();
+	for (s4 i = 0; i < BATCH_JOB_COUNT; i++)
+	{
+		free(batch.jobs[i].pixels);
+	}
+	release_render_target(batch.atlas);
+	glViewport(0, 0, sgl.width, sgl.height);
+	if (batch.stream) fclose(batch.stream);
+
+	f8 seconds = (f8)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+	cout << "batch: " << batch.images_written << " images in " << atlases << " atlases, "
+		 << seconds * 1000.0 << " ms, " << batch.images_written / seconds << " images/s";
+	if (batch.images_failed) cout << ", " << batch.images_failed << " failed";
+	cout << endl;
+	return batch.images_failed == 0 && batch.images_written == batch.views.size();
+}
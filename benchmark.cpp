@@ -0,0 +1,420 @@
+/*
+	Benchmark suite.
+
+	benchmark [--filter TEXT] [--iterations N] [--out FILE]
+	          [--baseline FILE] [--threshold PERCENT] [--software-gl]
+
+	Runs a fixed list of scenarios through the renderer of sample_program
+	and reports per iteration times. Micro scenarios time one path in
+	isolation: shader variant compile and link, my_create_texture()
+	uploads, file_read(), camera and model matrix building, and light
+	binning. Frame scenarios build a synthetic scene and time whole frames:
+	clear, _RENDER_NORMAL() and glFinish(), so GPU time is included.
+
+	Results are written as JSON, one scenario per line, to --out or
+	stdout. With --baseline the medians are compared against an earlier
+	result file and every scenario slower by more than --threshold percent
+	(default 10) is reported as a regression. The exit code is then 1, so
+	a CI job can gate on it.
+
+	No display is needed. Without DISPLAY or WAYLAND_DISPLAY SDL is told to
+	use its offscreen video driver, and --software-gl asks Mesa for its
+	llvmpipe rasterizer, so the suite runs on GPU-less machines.
+
+	build: g++ benchmark.cpp -O2 -std=c++11 -pthread -lSDL2 -lGL -lGLU -lGLEW -I../b_libs -I../stb -o benchmark
+*/
+#define SGL_NO_MAIN
+#include "main.cpp"
+#include <algorithm>
+
+#define BENCH_WARMUP 3
+#define BENCH_MAX_RESULTS 64
+#define BENCH_NAME_LENGTH 64
+
+struct BENCH_RESULT
+{
+	char name[BENCH_NAME_LENGTH];
+	s4 iterations;
+	f8 mean_ms;
+	f8 median_ms;
+	f8 p95_ms;
+	f8 min_ms;
+};
+
+struct BENCH_SCENARIO
+{
+	const char* name;
+	s4 iterations;
+	void (*setup)(s4 param); // 0 for micro scenarios
+	f8 (*run)(s4 param);     // one iteration, returns its time in ms, or < 0 on failure
+	s4 param;
+};
+
+struct BENCHMARK
+{
+	const char* filter;
+	f4 iteration_scale;
+	BENCH_RESULT results[BENCH_MAX_RESULTS];
+	s4 result_count;
+	u1* texture_pixels;
+	glm::mat4 view;
+	glm::mat4 projection;
+	gu textures[64];
+	s4 texture_count;
+} bench;
+
+inline f8 bench_ms(u8 begin)
+{
+	return (f8)(SDL_GetPerformanceCounter() - begin) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// micro scenarios
+
+f8 bench_shader_compile(s4 key)
+{
+	char defines[512];
+	shader_variant_defines(SHADER_KEY((u4)key), defines, sizeof(defines));
+	u8 begin = SDL_GetPerformanceCounter();
+	GLuint program;
+	if (!link_shader_program(UBER_VERTEX_FILE, UBER_FRAGMENT_FILE, program, defines)) return -1.0;
+	f8 ms = bench_ms(begin);
+	glDeleteProgram(program);
+	return ms;
+}
+
+f8 bench_texture_upload(s4 size)
+{
+	u8 begin = SDL_GetPerformanceCounter();
+	GLuint texture = my_create_texture(size, size, true, bench.texture_pixels);
+	glFinish();
+	f8 ms = bench_ms(begin);
+	glDeleteTextures(1, &texture);
+	return ms;
+}
+
+f8 bench_file_read(s4)
+{
+	u8 begin = SDL_GetPerformanceCounter();
+	int size = 0;
+	char* data = file_read(UBER_FRAGMENT_FILE, &size);
+	f8 ms = bench_ms(begin);
+	if (!data) return -1.0;
+	free(data);
+	return ms;
+}
+
+f8 bench_matrices(s4 count)
+{
+	u8 begin = SDL_GetPerformanceCounter();
+	f4 checksum = 0.0f;
+	for (s4 i = 0; i < count; i++)
+	{
+		f4 angle = i * 0.001f;
+		glm::mat4 view = glm::lookAt(glm::vec3(7.0f * cosf(angle), 7.0f * sinf(angle), 6.5f),
+			glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(i * 0.5f, 0.0f, 0.0f));
+		glm::mat4 mvp = projection * view * model;
+		checksum += mvp[3][2];
+	}
+	f8 ms = bench_ms(begin);
+	// keep the loop from being optimized away
+	if (checksum == 12345.0f) cout << checksum << endl;
+	return ms;
+}
+
+f8 bench_light_binning(s4 count)
+{
+	clear_lights();
+	add_demo_lights(count);
+	glViewport(0, 0, sgl.width, sgl.height);
+	u8 begin = SDL_GetPerformanceCounter();
+	update_light_clusters(bench.view, bench.projection, 0, 0, sgl.width, sgl.height);
+	f8 ms = bench_ms(begin);
+	clear_lights();
+	lighting.ambient = glm::vec3(1.0f, 1.0f, 1.0f);
+	return ms;
+}
+
+// frame scenarios
+
+void bench_camera(glm::vec3 eye, glm::vec3 up, f4 fov)
+{
+	bench.view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), up);
+	bench.projection = glm::perspective(glm::radians(fov), (f4)sgl.width / sgl.height, 0.1f, 100.0f);
+}
+
+void bench_clear_scene()
+{
+	object_count = 0;
+	clear_lights();
+	lighting.ambient = glm::vec3(1.0f, 1.0f, 1.0f);
+	// query objects are kept, only the previous scene's answers are dropped
+	for (s4 i = 0; i < MAX_OBJECTS; i++)
+	{
+		occlusion.queries[i].pending = false;
+		occlusion.queries[i].visible = true;
+	}
+}
+
+gu bench_texture(s4 index)
+{
+	while (bench.texture_count <= index && bench.texture_count < 64)
+	{
+		// a distinct tint per texture, so none of them can be shared
+		s4 size = 256;
+		for (s4 i = 0; i < size * size; i++)
+		{
+			u1* p = bench.texture_pixels + i * 4;
+			p[0] = (u1)(i * 7 + bench.texture_count * 31);
+			p[1] = (u1)((i >> 8) * 5);
+			p[2] = (u1)(bench.texture_count * 53);
+			p[3] = 255;
+		}
+		bench.textures[bench.texture_count++] = my_create_texture(size, size, true, bench.texture_pixels);
+	}
+	return bench.textures[index % 64];
+}
+
+/*
+	count objects on a square grid, cycling through cubes, pyramids and
+	planes. textured_every = n textures every n-th object with one of
+	texture_count textures, 0 draws them all with vertex colors.
+*/
+void bench_grid(s4 count, s4 textured_every, s4 texture_count)
+{
+	bench_clear_scene();
+	PRIMITIVE* meshes[3] = { &cube, &pyramid, &plane };
+	s4 side = (s4)ceilf(sqrtf((f4)count));
+	for (s4 i = 0; i < count && i < MAX_OBJECTS; i++)
+	{
+		glm::vec3 position((i % side - side / 2) * 2.5f, (i / side - side / 2) * 2.5f, 0.0f);
+		add_object(meshes[i % 3], 0, 0, 0, position);
+		if (textured_every && i % textured_every == 0)
+		{
+			objects[object_count - 1].texture = bench_texture(i / textured_every % texture_count);
+		}
+	}
+	f4 extent = side * 2.5f;
+	bench_camera(glm::vec3(0.0f, -extent, extent * 0.8f), glm::vec3(0.0f, 0.0f, 1.0f), 45.0f);
+}
+
+void setup_cubes(s4 count)     { bench_grid(count, 0, 1); }
+void setup_mixed(s4 count)     { bench_grid(count, 2, 4); }
+void setup_textures(s4 count)  { bench_grid(MAX_OBJECTS, 1, count); }
+
+void setup_lights(s4 count)
+{
+	bench_grid(64, 2, 4);
+	add_demo_lights(count);
+}
+
+/*
+	count screen filling planes stacked towards the camera, every pixel is
+	covered count times.
+*/
+void setup_overdraw(s4 count)
+{
+	bench_clear_scene();
+	for (s4 i = 0; i < count && i < MAX_OBJECTS; i++)
+	{
+		add_object(&plane, 0, 0, 0, glm::vec3(0.0f, 0.0f, i * 0.02f));
+		if (i % 2) objects[object_count - 1].texture = bench_texture(i % 4);
+	}
+	bench_camera(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 1.0f, 0.0f), 40.0f);
+}
+
+f8 bench_frame(s4)
+{
+	u8 begin = SDL_GetPerformanceCounter();
+	begin_render_target_frame();
+	begin_resource_frame();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, sgl.width, sgl.height);
+	glClearColor(0.23f, 0.47f, 0.58f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	_RENDER_NORMAL(bench.view, bench.projection, vec3(1.0f, 1.0f, 1.0f), 0, 0, sgl.width, sgl.height);
+	enforce_resource_budget();
+	glFinish();
+	f8 ms = bench_ms(begin);
+	memory.transient_current = 0;
+	return ms;
+}
+
+const BENCH_SCENARIO BENCH_SCENARIOS[] = {
+	{ "shader_compile_texture",  20, 0, bench_shader_compile, (s4)BASIC_TEXTURE_SHADER_KEY.bits },
+	{ "shader_compile_basic",    20, 0, bench_shader_compile, (s4)BASIC_SHADER_KEY.bits },
+	{ "texture_upload_256",      50, 0, bench_texture_upload, 256 },
+	{ "texture_upload_1024",     20, 0, bench_texture_upload, 1024 },
+	{ "file_read",              200, 0, bench_file_read, 0 },
+	{ "matrices_10000",          50, 0, bench_matrices, 10000 },
+	{ "light_binning_1024",      50, 0, bench_light_binning, 1024 },
+	{ "frame_cubes_16",         100, setup_cubes, bench_frame, 16 },
+	{ "frame_cubes_256",        100, setup_cubes, bench_frame, 256 },
+	{ "frame_mixed_shaders_256",100, setup_mixed, bench_frame, 256 },
+	{ "frame_textures_64",      100, setup_textures, bench_frame, 64 },
+	{ "frame_lights_1024",       60, setup_lights, bench_frame, 1024 },
+	{ "frame_overdraw_32",      100, setup_overdraw, bench_frame, 32 },
+};
+const s4 BENCH_SCENARIO_COUNT = sizeof(BENCH_SCENARIOS) / sizeof(BENCH_SCENARIOS[0]);
+
+b4 run_scenario(const BENCH_SCENARIO &s, BENCH_RESULT &r)
+{
+	if (s.setup) s.setup(s.param);
+	s4 iterations = (s4)(s.iterations * bench.iteration_scale);
+	if (iterations < 1) iterations = 1;
+
+	for (s4 i = 0; i < BENCH_WARMUP; i++) s.run(s.param);
+	std::vector<f8> times(iterations);
+	for (s4 i = 0; i < iterations; i++)
+	{
+		times[i] = s.run(s.param);
+		if (times[i] < 0.0)
+		{
+			cerr << "benchmark: " << s.name << " failed" << endl;
+			return false;
+		}
+	}
+
+	std::sort(times.begin(), times.end());
+	f8 sum = 0.0;
+	for (s4 i = 0; i < iterations; i++) sum += times[i];
+	strncpy(r.name, s.name, BENCH_NAME_LENGTH - 1);
+	r.name[BENCH_NAME_LENGTH - 1] = 0;
+	r.iterations = iterations;
+	r.mean_ms = sum / iterations;
+	r.median_ms = times[iterations / 2];
+	r.p95_ms = times[(iterations * 95) / 100 < iterations ? (iterations * 95) / 100 : iterations - 1];
+	r.min_ms = times[0];
+	return true;
+}
+
+void write_results(FILE* file)
+{
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+	fprintf(file, "{\n\"renderer\": \"%s\",\n\"width\": %d, \"height\": %d,\n\"results\": [\n",
+		renderer ? renderer : "unknown", sgl.width, sgl.height);
+	for (s4 i = 0; i < bench.result_count; i++)
+	{
+		BENCH_RESULT &r = bench.results[i];
+		fprintf(file, "{\"name\": \"%s\", \"iterations\": %d, \"mean_ms\": %.4f, \"median_ms\": %.4f, \"p95_ms\": %.4f, \"min_ms\": %.4f}%s\n",
+			r.name, r.iterations, r.mean_ms, r.median_ms, r.p95_ms, r.min_ms, i + 1 < bench.result_count ? "," : "");
+	}
+	fprintf(file, "]\n}\n");
+}
+
+/*
+	Compare medians against a file written by write_results(). Returns the
+	number of regressions. Scenarios missing from either side are listed
+	but do not count.
+*/
+s4 compare_results(const char* path, f4 threshold)
+{
+	ASSET_DATA baseline;
+	if (!read_loose_file(path, baseline))
+	{
+		cerr << "benchmark: could not read baseline " << path << endl;
+		return 1;
+	}
+	s4 regressions = 0;
+	for (s4 i = 0; i < bench.result_count; i++)
+	{
+		BENCH_RESULT &r = bench.results[i];
+		char key[BENCH_NAME_LENGTH + 16];
+		snprintf(key, sizeof(key), "\"name\": \"%s\"", r.name);
+		const char* entry = strstr((const char*)baseline.data, key);
+		const char* median = entry ? strstr(entry, "\"median_ms\":") : 0;
+		if (!median)
+		{
+			fprintf(stderr, "  %-26s new, no baseline\n", r.name);
+			continue;
+		}
+		f8 before = atof(median + strlen("\"median_ms\":"));
+		f8 change = before > 0.0 ? (r.median_ms - before) * 100.0 / before : 0.0;
+		b4 regressed = change > threshold;
+		if (regressed) regressions++;
+		fprintf(stderr, "  %-26s %10.4f -> %10.4f ms  %+7.1f%%%s\n", r.name, before, r.median_ms, change,
+			regressed ? "  REGRESSION" : "");
+	}
+	asset_release(baseline);
+	fprintf(stderr, "benchmark: %d regressions over %.1f%%\n", regressions, threshold);
+	return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+	initialize_memory(memory, 8);
+	const char* out_path = 0;
+	const char* baseline_path = 0;
+	f4 threshold = 10.0f;
+	bench.filter = 0;
+	bench.iteration_scale = 1.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--filter") && i + 1 < argc) bench.filter = argv[++i];
+		else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) bench.iteration_scale = (f4)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--out") && i + 1 < argc) out_path = argv[++i];
+		else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baseline_path = argv[++i];
+		else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) threshold = (f4)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--software-gl")) setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+	}
+	if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) setenv("SDL_VIDEODRIVER", "offscreen", 0);
+
+	// the scenarios print nothing, keep stdout for the JSON
+	std::streambuf* log = cout.rdbuf(cerr.rdbuf());
+	open_asset_pack("assets.pack");
+	if (!create_sgl()) { cerr << "ERROR: failed to create sdl or opengl" << endl; return 2; }
+	create_plane();
+	create_cube();
+	create_pyramid();
+	create_mesh_lods(plane);
+	create_mesh_lods(cube);
+	create_mesh_lods(pyramid);
+	init_uniform_blocks(true);
+	init_lighting();
+	create_material(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	if (!create_basic_shader() || !create_offscreen_shader() ||
+		!create_color_verts_shader() || !create_basic_texture_shader() ||
+		!create_offscreen_texture())
+	{
+		cerr << "ERROR: could not create the shaders" << endl;
+		return 2;
+	}
+	init_resources(0);
+	init_occlusion();
+	init_command_buffers();
+	bench.texture_pixels = (u1*)malloc(1024 * 1024 * 4);
+	memset(bench.texture_pixels, 0x80, 1024 * 1024 * 4);
+	bench_camera(glm::vec3(7.0f, 0.0f, 6.5f), glm::vec3(0.0f, 0.0f, 1.0f), 45.0f);
+
+	b4 ok = true;
+	for (s4 i = 0; i < BENCH_SCENARIO_COUNT && bench.result_count < BENCH_MAX_RESULTS; i++)
+	{
+		const BENCH_SCENARIO &s = BENCH_SCENARIOS[i];
+		if (bench.filter && !strstr(s.name, bench.filter)) continue;
+		BENCH_RESULT &r = bench.results[bench.result_count];
+		if (!run_scenario(s, r)) { ok = false; continue; }
+		bench.result_count++;
+		fprintf(stderr, "%-26s median %9.4f ms  p95 %9.4f ms\n", r.name, r.median_ms, r.p95_ms);
+	}
+	cout.rdbuf(log);
+
+	FILE* out = out_path ? fopen(out_path, "w") : stdout;
+	if (!out) { cerr << "ERROR: could not create " << out_path << endl; return 2; }
+	write_results(out);
+	if (out != stdout) fclose(out);
+
+	s4 regressions = baseline_path ? compare_results(baseline_path, threshold) : 0;
+
+	destroy_command_buffers();
+	destroy_occlusion();
+	destroy_resources();
+	destroy_shader_variants();
+	destroy_uniform_blocks();
+	destroy_lighting();
+	glDeleteTextures(bench.texture_count, bench.textures);
+	free(bench.texture_pixels);
+	empty_program();
+	close_asset_pack();
+	return ok && regressions == 0 ? 0 : 1;
+}
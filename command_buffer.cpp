@@ -0,0 +1,463 @@
+/*
+	Command buffers.
+
+	GL calls have to come from the thread that owns the context, but working
+	out what to draw does not. Draw lists are recorded as small packed POD
+	commands that hold plain handles and values. Each recording thread
+	appends to its own buffer, so no locks are taken while recording.
+	The GL thread then replays the buffers in partition order through
+	execute_command_buffers(), which is a switch over the packed bytes. It
+	drops program, texture, material and buffer binds that would not change
+	anything.
+
+	The scene order is split into contiguous partitions, one per thread,
+	so replaying the buffers one after another keeps the front to back
+	order. Small scenes are recorded on the calling thread only, where
+	waking the workers would cost more than it saves.
+
+	Each buffer owns a malloc'd block that is rewound every frame and only
+	reallocated (doubling) when a frame records more than any frame before,
+	so a steady state frame allocates nothing. It is not taken from the
+	transient memory because that is rewound by the GL thread while the
+	workers may still be appending.
+*/
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define COMMAND_MAX_THREADS 8
+#define COMMAND_MIN_PARTITION 32 // objects per thread before recording goes wide
+#define COMMAND_INITIAL_CAPACITY (16 * 1024)
+
+enum COMMAND_TYPE
+{
+	CMD_USE_PROGRAM,
+	CMD_BIND_TEXTURE,
+	CMD_UNIFORM_MAT4,
+	CMD_UNIFORM_VEC3,
+	CMD_BIND_MESH,
+	CMD_BIND_MATERIAL,
+	CMD_DRAW_INDEXED,
+};
+
+struct COMMAND_HEADER
+{
+	u2 type;
+	u2 size; // bytes including the header, multiple of 4
+};
+
+struct CMD_PROGRAM { COMMAND_HEADER header; gu program; };
+struct CMD_TEXTURE { COMMAND_HEADER header; gu texture; };
+struct CMD_MAT4    { COMMAND_HEADER header; gi location; f4 value[16]; };
+struct CMD_VEC3    { COMMAND_HEADER header; gi location; f4 value[3]; };
+struct CMD_MESH
+{
+	COMMAND_HEADER header;
+	gu verts;
+	gu second; // uv or color buffer
+	gi attribute_coord3d;
+	gi attribute_second;
+	s4 second_size; // components per vertex in second
+};
+struct CMD_MATERIAL { COMMAND_HEADER header; s4 material; gi location; };
+struct CMD_DRAW    { COMMAND_HEADER header; gu indices; s4 count; };
+
+struct COMMAND_BUFFER
+{
+	u1* data;
+	u4 used;
+	u4 capacity;
+	gu program; // last program recorded, so view and proj are only set on a switch
+	s4 draws;
+	s4 triangles;
+	s4 culled;
+};
+
+struct COMMAND_JOB
+{
+	const s4* order;
+	s4 count;
+	s4 partitions;
+	const glm::mat4* view;
+	const glm::mat4* projection;
+	vec3 scale;
+};
+
+struct COMMANDS
+{
+	COMMAND_BUFFER buffers[COMMAND_MAX_THREADS];
+	s4 used_buffers; // buffers recorded this frame
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	u4 generation;
+	s4 workers_left;
+	b4 running;
+	COMMAND_JOB job;
+} commands;
+
+/*
+	Reserve size bytes at the end of the buffer and fill in the header.
+*/
+void* cmd_push(COMMAND_BUFFER &cb, u2 type, u4 size)
+{
+	if (cb.used + size > cb.capacity)
+	{
+		u4 capacity = cb.capacity ? cb.capacity : COMMAND_INITIAL_CAPACITY;
+		while (cb.used + size > capacity) capacity *= 2;
+		cb.data = (u1*)realloc(cb.data, capacity);
+		cb.capacity = capacity;
+	}
+	COMMAND_HEADER* header = (COMMAND_HEADER*)(cb.data + cb.used);
+	header->type = type;
+	header->size = (u2)size;
+	cb.used += size;
+	return header;
+}
+
+inline void cmd_use_program(COMMAND_BUFFER &cb, gu program)
+{
+	CMD_PROGRAM* c = (CMD_PROGRAM*)cmd_push(cb, CMD_USE_PROGRAM, sizeof(CMD_PROGRAM));
+	c->program = program;
+	cb.program = program;
+}
+
+inline void cmd_bind_texture(COMMAND_BUFFER &cb, gu texture)
+{
+	CMD_TEXTURE* c = (CMD_TEXTURE*)cmd_push(cb, CMD_BIND_TEXTURE, sizeof(CMD_TEXTURE));
+	c->texture = texture;
+}
+
+inline void cmd_uniform_mat4(COMMAND_BUFFER &cb, gi location, const glm::mat4 &value)
+{
+	CMD_MAT4* c = (CMD_MAT4*)cmd_push(cb, CMD_UNIFORM_MAT4, sizeof(CMD_MAT4));
+	c->location = location;
+	memcpy(c->value, glm::value_ptr(value), sizeof(c->value));
+}
+
+inline void cmd_uniform_vec3(COMMAND_BUFFER &cb, gi location, vec3 value)
+{
+	CMD_VEC3* c = (CMD_VEC3*)cmd_push(cb, CMD_UNIFORM_VEC3, sizeof(CMD_VEC3));
+	c->location = location;
+	c->value[0] = value.x;
+	c->value[1] = value.y;
+	c->value[2] = value.z;
+}
+
+inline void cmd_bind_mesh(COMMAND_BUFFER &cb, gu verts, gu second, gi attribute_coord3d, gi attribute_second, s4 second_size)
+{
+	CMD_MESH* c = (CMD_MESH*)cmd_push(cb, CMD_BIND_MESH, sizeof(CMD_MESH));
+	c->verts = verts;
+	c->second = second;
+	c->attribute_coord3d = attribute_coord3d;
+	c->attribute_second = attribute_second;
+	c->second_size = second_size;
+}
+
+inline void cmd_bind_material(COMMAND_BUFFER &cb, s4 material, gi location)
+{
+	CMD_MATERIAL* c = (CMD_MATERIAL*)cmd_push(cb, CMD_BIND_MATERIAL, sizeof(CMD_MATERIAL));
+	c->material = material;
+	c->location = location;
+}
+
+inline void cmd_draw_indexed(COMMAND_BUFFER &cb, gu indices, s4 count)
+{
+	CMD_DRAW* c = (CMD_DRAW*)cmd_push(cb, CMD_DRAW_INDEXED, sizeof(CMD_DRAW));
+	c->indices = indices;
+	c->count = count;
+}
+
+/*
+	Record the draw for one object: the basic_texture path for objects with
+	a texture, color_verts otherwise.
+*/
+void record_object(COMMAND_BUFFER &cb, const RENDER_OBJECT &o, const glm::mat4 &view, const glm::mat4 &projection, vec3 scale)
+{
+	PRIMITIVE &mesh = *o.mesh;
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), o.position);
+
+	if (o.texture)
+	{
+		if (cb.program != basic_texture.program)
+		{
+			cmd_use_program(cb, basic_texture.program);
+			// with uniform blocks the camera comes from camera_block
+			if (!uniform_blocks.enabled)
+			{
+				cmd_uniform_mat4(cb, basic_texture.uniform_view, view);
+				cmd_uniform_mat4(cb, basic_texture.uniform_proj, projection);
+			}
+			cmd_uniform_vec3(cb, basic_texture.uniform_scale, scale);
+		}
+		cmd_bind_texture(cb, o.texture);
+		cmd_uniform_mat4(cb, basic_texture.uniform_model, model);
+		cmd_bind_material(cb, o.material, basic_texture.uniform_material);
+		cmd_bind_mesh(cb, mesh.verts, mesh.uv_coords, basic_texture.attribute_coord3d, basic_texture.attribute_tex_coord2d, 2);
+	}
+	else
+	{
+		if (cb.program != color_verts.program)
+		{
+			cmd_use_program(cb, color_verts.program);
+			// with uniform blocks the camera comes from camera_block
+			if (!uniform_blocks.enabled)
+			{
+				cmd_uniform_mat4(cb, color_verts.uniform_view, view);
+				cmd_uniform_mat4(cb, color_verts.uniform_proj, projection);
+			}
+			cmd_uniform_vec3(cb, color_verts.uniform_scale, scale);
+		}
+		cmd_uniform_mat4(cb, color_verts.uniform_model, model);
+		cmd_bind_material(cb, o.material, color_verts.uniform_material);
+		cmd_bind_mesh(cb, mesh.verts, mesh.colors, color_verts.attribute_coord3d, color_verts.attribute_v_color, 3);
+	}
+
+	cmd_draw_indexed(cb, mesh.lod_indices[o.lod], mesh.lod_index_count[o.lod]);
+	cb.draws++;
+	cb.triangles += mesh.lod_index_count[o.lod] / 3;
+}
+
+/*
+	Record one partition of job into buffer index. Runs on any thread.
+*/
+void record_partition(const COMMAND_JOB &job, s4 index)
+{
+	COMMAND_BUFFER &cb = commands.buffers[index];
+	cb.used = 0;
+	cb.program = 0;
+	cb.draws = 0;
+	cb.triangles = 0;
+	cb.culled = 0;
+
+	s4 first = job.count * index / job.partitions;
+	s4 last = job.count * (index + 1) / job.partitions;
+	for (s4 i = first; i < last; i++)
+	{
+		if (!object_visible(job.order[i]))
+		{
+			cb.culled++;
+			continue;
+		}
+		record_object(cb, objects[job.order[i]], *job.view, *job.projection, job.scale);
+	}
+}
+
+void command_worker(s4 index)
+{
+	u4 seen = 0;
+	for (;;)
+	{
+		COMMAND_JOB job;
+		{
+			std::unique_lock<std::mutex> guard(commands.lock);
+			commands.wake.wait(guard, [&seen]{ return commands.generation != seen || !commands.running; });
+			if (!commands.running) return;
+			// the job is only written together with generation, so this copy
+			// belongs to the generation just seen and the GL thread waits for it.
+			// A worker waking late for an older generation skips straight to this one.
+			seen = commands.generation;
+			job = commands.job;
+			// workers past the partition count sit this frame out
+			if (index >= job.partitions) continue;
+		}
+		record_partition(job, index);
+
+		std::lock_guard<std::mutex> guard(commands.lock);
+		if (--commands.workers_left == 0) commands.done.notify_one();
+	}
+}
+
+void init_command_buffers()
+{
+	memset(commands.buffers, 0, sizeof(commands.buffers));
+	commands.used_buffers = 0;
+	commands.generation = 0;
+	commands.running = true;
+
+	// the calling thread records partition 0, worker i records partition i
+	s4 threads = SDL_GetCPUCount();
+	if (threads > COMMAND_MAX_THREADS) threads = COMMAND_MAX_THREADS;
+	for (s4 i = 1; i < threads; i++)
+	{
+		commands.workers.push_back(std::thread(command_worker, i));
+	}
+}
+
+void destroy_command_buffers()
+{
+	{
+		std::lock_guard<std::mutex> guard(commands.lock);
+		commands.running = false;
+	}
+	commands.wake.notify_all();
+	for (size_t i = 0; i < commands.workers.size(); i++)
+	{
+		commands.workers[i].join();
+	}
+	commands.workers.clear();
+	for (s4 i = 0; i < COMMAND_MAX_THREADS; i++)
+	{
+		free(commands.buffers[i].data);
+		commands.buffers[i].data = 0;
+		commands.buffers[i].capacity = 0;
+	}
+}
+
+/*
+	Record draw lists for the objects in order, skipping occluded ones.
+	Touches no GL state, the result is submitted with
+	execute_command_buffers().
+*/
+void record_draw_lists(const s4* order, s4 count, const glm::mat4 &view, const glm::mat4 &projection, vec3 scale)
+{
+	s4 partitions = count / COMMAND_MIN_PARTITION;
+	if (partitions > (s4)commands.workers.size() + 1) partitions = (s4)commands.workers.size() + 1;
+	if (partitions < 1) partitions = 1;
+
+	COMMAND_JOB job;
+	job.order = order;
+	job.count = count;
+	job.partitions = partitions;
+	job.view = &view;
+	job.projection = &projection;
+	job.scale = scale;
+	commands.used_buffers = partitions;
+
+	if (partitions == 1)
+	{
+		record_partition(job, 0);
+		return;
+	}
+
+	{
+		// workers read job, workers_left and generation under the same lock
+		std::lock_guard<std::mutex> guard(commands.lock);
+		commands.job = job;
+		commands.workers_left = partitions - 1;
+		commands.generation++;
+	}
+	commands.wake.notify_all();
+	record_partition(job, 0);
+
+	std::unique_lock<std::mutex> guard(commands.lock);
+	commands.done.wait(guard, []{ return commands.workers_left == 0; });
+}
+
+/*
+	Replay the recorded buffers on the GL thread, in partition order.
+*/
+void execute_command_buffers()
+{
+	gu program = 0;
+	gu texture = 0;
+	s4 material = -1;
+	gu verts = 0;
+	gu second = 0;
+	gi coord3d_location = -1;
+	gi second_location = -1;
+	u4 enabled = 0; // bit per enabled vertex attribute
+
+	for (s4 b = 0; b < commands.used_buffers; b++)
+	{
+		COMMAND_BUFFER &cb = commands.buffers[b];
+		stats.draws += cb.draws;
+		stats.triangles += cb.triangles;
+		stats.culled += cb.culled;
+
+		u1* at = cb.data;
+		u1* end = cb.data + cb.used;
+		while (at < end)
+		{
+			COMMAND_HEADER* header = (COMMAND_HEADER*)at;
+			switch (header->type)
+			{
+				case CMD_USE_PROGRAM:
+				{
+					CMD_PROGRAM* c = (CMD_PROGRAM*)header;
+					if (c->program != program)
+					{
+						glUseProgram(c->program);
+						// a plain material_color uniform belongs to the program
+						if (!uniform_blocks.enabled) material = -1;
+					}
+					program = c->program;
+				} break;
+				case CMD_BIND_TEXTURE:
+				{
+					CMD_TEXTURE* c = (CMD_TEXTURE*)header;
+					if (c->texture != texture) glBindTexture(GL_TEXTURE_2D, c->texture);
+					texture = c->texture;
+				} break;
+				case CMD_UNIFORM_MAT4:
+				{
+					CMD_MAT4* c = (CMD_MAT4*)header;
+					glUniformMatrix4fv(c->location, 1, GL_FALSE, c->value);
+				} break;
+				case CMD_UNIFORM_VEC3:
+				{
+					CMD_VEC3* c = (CMD_VEC3*)header;
+					glUniform3f(c->location, c->value[0], c->value[1], c->value[2]);
+				} break;
+				case CMD_BIND_MESH:
+				{
+					CMD_MESH* c = (CMD_MESH*)header;
+					// get_attrib() returns -1 for an attribute the linker dropped,
+					// such a location has no array to enable or point at
+					b4 has_coord3d = c->attribute_coord3d >= 0 && c->attribute_coord3d < 32;
+					b4 has_second = c->attribute_second >= 0 && c->attribute_second < 32;
+					u4 wanted = 0;
+					if (has_coord3d) wanted |= 1u << c->attribute_coord3d;
+					if (has_second) wanted |= 1u << c->attribute_second;
+					for (s4 a = 0; a < 32; a++)
+					{
+						u4 bit = 1u << a;
+						if ((wanted & bit) && !(enabled & bit)) glEnableVertexAttribArray(a);
+						if (!(wanted & bit) && (enabled & bit)) glDisableVertexAttribArray(a);
+					}
+					// pointers are context state, kept across programs as long as
+					// the buffers and attribute locations match
+					if (c->verts != verts || c->second != second ||
+						c->attribute_coord3d != coord3d_location || c->attribute_second != second_location)
+					{
+						if (has_coord3d)
+						{
+							glBindBuffer(GL_ARRAY_BUFFER, c->verts);
+							glVertexAttribPointer(c->attribute_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0);
+						}
+						if (has_second)
+						{
+							glBindBuffer(GL_ARRAY_BUFFER, c->second);
+							glVertexAttribPointer(c->attribute_second, c->second_size, GL_FLOAT, GL_FALSE, 0, 0);
+						}
+					}
+					enabled = wanted;
+					verts = c->verts;
+					second = c->second;
+					coord3d_location = c->attribute_coord3d;
+					second_location = c->attribute_second;
+				} break;
+				case CMD_BIND_MATERIAL:
+				{
+					CMD_MATERIAL* c = (CMD_MATERIAL*)header;
+					if (c->material != material) bind_material(c->material, c->location);
+					material = c->material;
+				} break;
+				case CMD_DRAW_INDEXED:
+				{
+					CMD_DRAW* c = (CMD_DRAW*)header;
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, c->indices);
+					glDrawElements(GL_TRIANGLES, c->count, GL_UNSIGNED_SHORT, 0);
+				} break;
+			}
+			at += header->size;
+		}
+	}
+
+	for (s4 a = 0; a < 32; a++)
+	{
+		if (enabled & (1u << a)) glDisableVertexAttribArray(a);
+	}
+}
@@ -0,0 +1,179 @@
+/*
+	Dynamic resolution.
+
+	With --dynamic-res <budget ms> the scene is drawn into the offscreen
+	target (FBO) at a fraction of the window size and stretched to the
+	window with a bilinear blit. Anything drawn to the window after
+	end_dynamic_resolution() stays at native resolution.
+
+	The GPU time of every frame is measured with a GL_TIME_ELAPSED query.
+	Results are read once available, like the occlusion queries, so the
+	CPU never waits; with the ring full a frame simply goes unmeasured.
+	The controller aims for DYNRES_TARGET of the budget. Shading cost is
+	taken to follow the pixel count, so the scale moves by the square root
+	of how far off the smoothed time is, at most DYNRES_MAX_STEP at a time.
+	Inside the dead band nothing changes, and after a change the results
+	still in flight (drawn at the old scale) are skipped, which keeps the
+	scale from oscillating.
+
+	The target stays allocated at window size, only the viewport shrinks,
+	so a scale change never reallocates.
+*/
+
+#define DYNRES_QUERY_COUNT 4
+#define DYNRES_MIN_SCALE 0.5f
+#define DYNRES_MAX_SCALE 1.0f
+#define DYNRES_TARGET 0.85f   // of the budget, leaves room for spikes
+#define DYNRES_DEAD_BAND 0.1f // of the budget around the target
+#define DYNRES_MAX_STEP 0.05f
+#define DYNRES_SMOOTHING 0.2f // weight of a new measurement
+
+struct DYNAMIC_RESOLUTION
+{
+	b4 enabled;
+	f4 budget_ms;
+	f4 scale;
+	f4 gpu_ms; // smoothed, 0 until the first result
+	s4 width;  // drawn size this frame
+	s4 height;
+	gu queries[DYNRES_QUERY_COUNT];
+	b4 pending[DYNRES_QUERY_COUNT];
+	s4 next;
+	b4 timing; // this frame has a query running
+	s4 settle; // results left to skip after a scale change
+} dynamic_res;
+
+void init_dynamic_resolution(f4 budget_ms)
+{
+	dynamic_res.enabled = false;
+	dynamic_res.budget_ms = budget_ms;
+	dynamic_res.scale = 1.0f;
+	dynamic_res.gpu_ms = 0.0f;
+	dynamic_res.width = sgl.width;
+	dynamic_res.height = sgl.height;
+	dynamic_res.next = 0;
+	dynamic_res.timing = false;
+	dynamic_res.settle = 0;
+	for (s4 i = 0; i < DYNRES_QUERY_COUNT; i++)
+	{
+		dynamic_res.queries[i] = 0;
+		dynamic_res.pending[i] = false;
+	}
+	stats.resolution_scale = 1.0f;
+	stats.gpu_ms = 0.0f;
+	if (budget_ms <= 0.0f) return;
+
+	if (!(GLEW_VERSION_3_3 || GLEW_ARB_timer_query) || !(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) || !FBO)
+	{
+		cerr << "dynamic resolution needs timer queries and framebuffer blits, rendering at native size" << endl;
+		return;
+	}
+	glGenQueries(DYNRES_QUERY_COUNT, dynamic_res.queries);
+	dynamic_res.enabled = true;
+}
+
+void destroy_dynamic_resolution()
+{
+	if (dynamic_res.enabled) glDeleteQueries(DYNRES_QUERY_COUNT, dynamic_res.queries);
+	dynamic_res.enabled = false;
+}
+
+void update_resolution_scale(f4 gpu_ms)
+{
+	dynamic_res.gpu_ms = dynamic_res.gpu_ms > 0.0f ?
+		dynamic_res.gpu_ms + (gpu_ms - dynamic_res.gpu_ms) * DYNRES_SMOOTHING : gpu_ms;
+	if (dynamic_res.settle > 0)
+	{
+		dynamic_res.settle--;
+		return;
+	}
+
+	f4 target = dynamic_res.budget_ms * DYNRES_TARGET;
+	f4 band = dynamic_res.budget_ms * DYNRES_DEAD_BAND;
+	if (fabsf(dynamic_res.gpu_ms - target) <= band) return;
+
+	f4 wanted = dynamic_res.scale * sqrtf(target / dynamic_res.gpu_ms);
+	f4 scale = dynamic_res.scale;
+	if (wanted > scale + DYNRES_MAX_STEP) scale += DYNRES_MAX_STEP;
+	else if (wanted < scale - DYNRES_MAX_STEP) scale -= DYNRES_MAX_STEP;
+	else scale = wanted;
+	if (scale < DYNRES_MIN_SCALE) scale = DYNRES_MIN_SCALE;
+	if (scale > DYNRES_MAX_SCALE) scale = DYNRES_MAX_SCALE;
+	if (scale == dynamic_res.scale) return;
+
+	dynamic_res.scale = scale;
+	dynamic_res.settle = DYNRES_QUERY_COUNT;
+}
+
+/*
+	Bind where the scene goes this frame and set the viewport to
+	dynamic_res.width x height. The window itself, at full size, when
+	dynamic resolution is off.
+*/
+void begin_dynamic_resolution()
+{
+	if (!dynamic_res.enabled)
+	{
+		dynamic_res.width = sgl.width;
+		dynamic_res.height = sgl.height;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, sgl.width, sgl.height);
+		return;
+	}
+
+	// oldest first, so the smoothing sees the frames in order
+	for (s4 i = 0; i < DYNRES_QUERY_COUNT; i++)
+	{
+		s4 q = (dynamic_res.next + i) % DYNRES_QUERY_COUNT;
+		if (!dynamic_res.pending[q]) continue;
+		GLuint available = 0;
+		glGetQueryObjectuiv(dynamic_res.queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(dynamic_res.queries[q], GL_QUERY_RESULT, &ns);
+		dynamic_res.pending[q] = false;
+		update_resolution_scale((f4)(ns / 1000000.0));
+	}
+
+	dynamic_res.width = (s4)(sgl.width * dynamic_res.scale + 0.5f);
+	dynamic_res.height = (s4)(sgl.height * dynamic_res.scale + 0.5f);
+	if (dynamic_res.width < 1) dynamic_res.width = 1;
+	if (dynamic_res.height < 1) dynamic_res.height = 1;
+	stats.resolution_scale = dynamic_res.scale;
+	stats.gpu_ms = dynamic_res.gpu_ms;
+
+	dynamic_res.timing = !dynamic_res.pending[dynamic_res.next];
+	if (dynamic_res.timing) glBeginQuery(GL_TIME_ELAPSED, dynamic_res.queries[dynamic_res.next]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, dynamic_res.width, dynamic_res.height);
+	// the clear must not touch the rest of the full size target
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, dynamic_res.width, dynamic_res.height);
+}
+
+/*
+	Stretch the scene to the window and leave the window bound at native
+	size.
+*/
+void end_dynamic_resolution()
+{
+	if (!dynamic_res.enabled) return;
+
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	b4 native = dynamic_res.width == sgl.width && dynamic_res.height == sgl.height;
+	glBlitFramebuffer(0, 0, dynamic_res.width, dynamic_res.height, 0, 0, sgl.width, sgl.height,
+		GL_COLOR_BUFFER_BIT, native ? GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, sgl.width, sgl.height);
+
+	// the blit is part of what the budget pays for
+	if (dynamic_res.timing)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		dynamic_res.pending[dynamic_res.next] = true;
+		dynamic_res.next = (dynamic_res.next + 1) % DYNRES_QUERY_COUNT;
+	}
+}
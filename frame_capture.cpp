@@ -0,0 +1,462 @@
+/*
+	Frame capture.
+
+	Readback goes through a readback ring. capture_frame() starts an
+	asynchronous glReadPixels into the next buffer; buffers that have
+	landed are mapped a few frames later, copied into a job buffer and
+	handed to the workers, so the GL thread does not wait on the GPU or on
+	encoding. PNG encoding is slower than a frame, so PNG and golden
+	captures run a pool of workers like batch_render.cpp, each taking any
+	queued frame. The GL thread only blocks when all CAPTURE_JOB_COUNT jobs
+	are still queued or being encoded.
+
+	The workers either write PNGs, compare against golden PNGs written by
+	an earlier PNG capture and report per-pixel error, or stream raw I420
+	(YUV 4:2:0) to a pipe. The stream has to stay in frame order, so it
+	gets a single worker that always takes the oldest queued frame. Golden
+	compares make a fixed-length run usable as a rendering regression
+	test:
+
+		./sample_program --capture-png out --frames 120
+		./sample_program --golden out --frames 120
+		./sample_program --software --golden out --frames 120
+		./sample_program --capture-yuv "ffmpeg -f rawvideo -pix_fmt yuv420p -s 800x600 -i - out.mp4"
+*/
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define CAPTURE_JOB_COUNT 16  // frames queued for the workers
+#define CAPTURE_MAX_WORKERS 8
+
+enum CAPTURE_MODE
+{
+	CAPTURE_OFF,
+	CAPTURE_PNG,
+	CAPTURE_YUV,
+	CAPTURE_GOLDEN,
+};
+
+struct CAPTURE_SLOT
+{
+	s4 width;
+	s4 height;
+	s4 size;
+	u4 frame;
+};
+
+enum CAPTURE_JOB_STATE
+{
+	CAPTURE_JOB_FREE,
+	CAPTURE_JOB_QUEUED,
+	CAPTURE_JOB_BUSY,
+};
+
+struct CAPTURE_JOB
+{
+	s4 state;
+	u1* pixels;  // RGBA8, bottom row first as GL returns it
+	s4 capacity;
+	s4 width;
+	s4 height;
+	u4 frame;
+};
+
+struct FRAME_CAPTURE
+{
+	CAPTURE_MODE mode;
+	const char* target;  // directory for png/golden, shell command for yuv
+	s4 max_frames;       // quit after this many captured frames, 0 = unlimited
+	f4 threshold;        // golden: per channel difference counted as an error, 0..255
+
+	READBACK_RING ring;
+	CAPTURE_SLOT slots[READBACK_RING_SIZE];
+	u4 frames_issued;
+
+	// job states are guarded by lock
+	CAPTURE_JOB jobs[CAPTURE_JOB_COUNT];
+	std::mutex lock;
+	std::condition_variable job_ready;
+	std::condition_variable job_done;
+	std::vector<std::thread> workers;
+	b4 running;
+
+	FILE* pipe;
+	u1* yuv; // used by the single yuv worker only
+	s4 yuv_capacity;
+
+	// golden compare results, written by the workers under lock
+	u4 frames_written;
+	u4 frames_compared;
+	u4 frames_failed;
+	f8 worst_mean_error;
+	s4 worst_max_error;
+} capture;
+
+void capture_write_png(CAPTURE_JOB &job)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/frame_%05u.png", capture.target, job.frame);
+	// negative stride walks the rows bottom up, so the file is top row first
+	s4 stride = job.width * 4;
+	if (!stbi_write_png(path, job.width, job.height, 4, job.pixels + (job.height - 1) * stride, -stride))
+	{
+		cerr << "capture: could not write " << path << endl;
+	}
+}
+
+void capture_write_yuv(CAPTURE_JOB &job)
+{
+	s4 w = job.width & ~1;
+	s4 h = job.height & ~1;
+	s4 size = w * h + 2 * (w / 2) * (h / 2);
+	if (size > capture.yuv_capacity)
+	{
+		free(capture.yuv);
+		capture.yuv = (u1*)malloc(size);
+		capture.yuv_capacity = size;
+	}
+	u1* Y = capture.yuv;
+	u1* U = Y + w * h;
+	u1* V = U + (w / 2) * (h / 2);
+
+	// BT.601 limited range, flipping rows so the stream is top row first
+	for (s4 y = 0; y < h; y++)
+	{
+		const u1* row = job.pixels + (job.height - 1 - y) * job.width * 4;
+		for (s4 x = 0; x < w; x++)
+		{
+			s4 r = row[x*4+0], g = row[x*4+1], b = row[x*4+2];
+			Y[y*w + x] = (u1)(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+			if ((x & 1) == 0 && (y & 1) == 0)
+			{
+				s4 i = (y/2) * (w/2) + x/2;
+				U[i] = (u1)(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+				V[i] = (u1)(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+			}
+		}
+	}
+	if (fwrite(capture.yuv, 1, size, capture.pipe) != (size_t)size)
+	{
+		cerr << "capture: yuv pipe closed" << endl;
+	}
+}
+
+void capture_compare_golden(CAPTURE_JOB &job)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/frame_%05u.png", capture.target, job.frame);
+	s4 gw, gh, gn;
+	u1* golden = stbi_load(path, &gw, &gh, &gn, 4);
+	if (!golden)
+	{
+		cerr << "capture: missing golden " << path << endl;
+		std::lock_guard<std::mutex> guard(capture.lock);
+		capture.frames_failed++;
+		return;
+	}
+	if (gw != job.width || gh != job.height)
+	{
+		cerr << "capture: " << path << " is " << gw << "x" << gh << ", frame is "
+			 << job.width << "x" << job.height << endl;
+		stbi_image_free(golden);
+		std::lock_guard<std::mutex> guard(capture.lock);
+		capture.frames_failed++;
+		return;
+	}
+
+	// reuse the golden buffer as the diff image
+	s8 error_sum = 0;
+	s4 max_error = 0;
+	s4 bad_pixels = 0;
+	for (s4 y = 0; y < gh; y++)
+	{
+		// golden rows are top first, readback rows bottom first
+		u1* g = golden + y * gw * 4;
+		u1* p = job.pixels + (gh - 1 - y) * gw * 4;
+		for (s4 x = 0; x < gw; x++, g += 4, p += 4)
+		{
+			s4 e = 0;
+			for (s4 c = 0; c < 4; c++)
+			{
+				s4 d = abs((s4)g[c] - (s4)p[c]);
+				if (d > e) e = d;
+			}
+			error_sum += e;
+			if (e > max_error) max_error = e;
+			if (e > capture.threshold) bad_pixels++;
+			g[0] = g[1] = g[2] = (u1)e;
+			g[3] = 255;
+		}
+	}
+
+	f8 mean_error = (f8)error_sum / (job.width * job.height);
+	{
+		std::lock_guard<std::mutex> guard(capture.lock);
+		capture.frames_compared++;
+		if (bad_pixels > 0) capture.frames_failed++;
+		if (mean_error > capture.worst_mean_error) capture.worst_mean_error = mean_error;
+		if (max_error > capture.worst_max_error) capture.worst_max_error = max_error;
+	}
+
+	if (bad_pixels > 0)
+	{
+		snprintf(path, sizeof(path), "%s/frame_%05u_diff.png", capture.target, job.frame);
+		stbi_write_png(path, gw, gh, 4, golden, gw * 4);
+		printf("golden frame %u: FAIL %d pixels over %.0f, mean %.3f, max %d (%s)\n",
+			job.frame, bad_pixels, capture.threshold, mean_error, max_error, path);
+	}
+	stbi_image_free(golden);
+}
+
+void capture_worker()
+{
+	std::unique_lock<std::mutex> guard(capture.lock);
+	for (;;)
+	{
+		// oldest queued frame first, which keeps the single yuv worker in order
+		CAPTURE_JOB* job = 0;
+		capture.job_ready.wait(guard, [&job]{
+			for (s4 i = 0; i < CAPTURE_JOB_COUNT; i++)
+			{
+				CAPTURE_JOB &j = capture.jobs[i];
+				if (j.state == CAPTURE_JOB_QUEUED && (!job || j.frame < job->frame)) job = &j;
+			}
+			return job || !capture.running;
+		});
+		if (!job) return;
+		job->state = CAPTURE_JOB_BUSY;
+		guard.unlock();
+
+		switch (capture.mode)
+		{
+			case CAPTURE_PNG:    { capture_write_png(*job); } break;
+			case CAPTURE_YUV:    { capture_write_yuv(*job); } break;
+			case CAPTURE_GOLDEN: { capture_compare_golden(*job); } break;
+			default: {} break;
+		}
+
+		guard.lock();
+		job->state = CAPTURE_JOB_FREE;
+		capture.frames_written++;
+		capture.job_done.notify_one();
+	}
+}
+
+/*
+	Recognises --capture-png DIR, --capture-yuv CMD, --golden DIR,
+	--threshold N and --frames N. Other arguments are ignored.
+*/
+void parse_capture_args(int argc, char* argv[])
+{
+	capture.mode = CAPTURE_OFF;
+	capture.threshold = 2.0f;
+	capture.max_frames = 0;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if      (!strcmp(argv[i], "--capture-png")) { capture.mode = CAPTURE_PNG; capture.target = argv[++i]; }
+		else if (!strcmp(argv[i], "--capture-yuv")) { capture.mode = CAPTURE_YUV; capture.target = argv[++i]; }
+		else if (!strcmp(argv[i], "--golden"))      { capture.mode = CAPTURE_GOLDEN; capture.target = argv[++i]; }
+		else if (!strcmp(argv[i], "--threshold"))   { capture.threshold = (f4)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--frames"))      { capture.max_frames = atoi(argv[++i]); }
+	}
+}
+
+b4 start_frame_capture()
+{
+	if (capture.mode == CAPTURE_OFF) return true;
+
+	if (!sgl.software && !GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object)
+	{
+		cerr << "Error: frame capture needs pixel buffer objects" << endl;
+		capture.mode = CAPTURE_OFF;
+		return false;
+	}
+
+	if (capture.mode == CAPTURE_YUV)
+	{
+		capture.pipe = popen(capture.target, "w");
+		if (!capture.pipe)
+		{
+			cerr << "Error: could not open pipe to " << capture.target << endl;
+			capture.mode = CAPTURE_OFF;
+			return false;
+		}
+	}
+
+	if (!sgl.software) init_readback_ring(capture.ring);
+	for (s4 i = 0; i < CAPTURE_JOB_COUNT; i++)
+	{
+		capture.jobs[i].state = CAPTURE_JOB_FREE;
+		capture.jobs[i].pixels = 0;
+		capture.jobs[i].capacity = 0;
+	}
+	capture.frames_issued = 0;
+	capture.running = true;
+	s4 threads = 1;
+	if (capture.mode != CAPTURE_YUV)
+	{
+		threads = SDL_GetCPUCount() - 1;
+		if (threads < 1) threads = 1;
+		if (threads > CAPTURE_MAX_WORKERS) threads = CAPTURE_MAX_WORKERS;
+	}
+	for (s4 i = 0; i < threads; i++)
+	{
+		capture.workers.push_back(std::thread(capture_worker));
+	}
+	return true;
+}
+
+/*
+	Wait for a free job and size its buffer. Blocks only when every job is
+	queued or being encoded. The job is ours until submit_capture_job() or
+	cancel_capture_job().
+*/
+CAPTURE_JOB& reserve_capture_job(s4 width, s4 height, u4 frame)
+{
+	std::unique_lock<std::mutex> guard(capture.lock);
+	CAPTURE_JOB* free_job = 0;
+	capture.job_done.wait(guard, [&free_job]{
+		for (s4 i = 0; i < CAPTURE_JOB_COUNT && !free_job; i++)
+		{
+			if (capture.jobs[i].state == CAPTURE_JOB_FREE) free_job = &capture.jobs[i];
+		}
+		return free_job != 0;
+	});
+	CAPTURE_JOB &job = *free_job;
+	job.state = CAPTURE_JOB_BUSY;
+	guard.unlock();
+
+	s4 size = width * height * 4;
+	if (job.capacity < size)
+	{
+		free(job.pixels);
+		job.pixels = (u1*)malloc(size);
+		job.capacity = size;
+	}
+	job.width = width;
+	job.height = height;
+	job.frame = frame;
+	return job;
+}
+
+void submit_capture_job(CAPTURE_JOB &job)
+{
+	{
+		std::lock_guard<std::mutex> guard(capture.lock);
+		job.state = CAPTURE_JOB_QUEUED;
+	}
+	capture.job_ready.notify_one();
+}
+
+void cancel_capture_job(CAPTURE_JOB &job)
+{
+	std::lock_guard<std::mutex> guard(capture.lock);
+	job.state = CAPTURE_JOB_FREE;
+}
+
+/*
+	Copy a finished readback into a job for the workers.
+*/
+void retire_capture_slot(s4 index)
+{
+	CAPTURE_SLOT &slot = capture.slots[index];
+	CAPTURE_JOB &job = reserve_capture_job(slot.width, slot.height, slot.frame);
+
+	const u1* mapped = map_readback(capture.ring, index);
+	if (mapped) memcpy(job.pixels, mapped, slot.size);
+	unmap_readback(capture.ring, index);
+	if (mapped) submit_capture_job(job);
+	else cancel_capture_job(job);
+}
+
+/*
+	Call after the frame has been drawn into fbo and before swapping.
+	Returns false once --frames captures have been issued.
+*/
+b4 capture_frame(gu fbo, s4 width, s4 height)
+{
+	if (capture.mode == CAPTURE_OFF) return true;
+
+	// retires landed readbacks in the order they were issued, so frames stay in order
+	CAPTURE_SLOT &slot = capture.slots[next_readback(capture.ring, retire_capture_slot)];
+	slot.width = width;
+	slot.height = height;
+	slot.size = width * height * 4;
+	slot.frame = capture.frames_issued;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	begin_readback(capture.ring, slot.size);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	end_readback(capture.ring);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	capture.frames_issued++;
+	return capture.max_frames == 0 || capture.frames_issued < (u4)capture.max_frames;
+}
+
+/*
+	Capture a frame that already lives in memory, e.g. the software
+	rasterizer's framebuffer. Rows are bottom first like glReadPixels,
+	stride is in pixels.
+*/
+b4 capture_pixels(const u4* pixels, s4 width, s4 height, s4 stride)
+{
+	if (capture.mode == CAPTURE_OFF) return true;
+
+	CAPTURE_JOB &job = reserve_capture_job(width, height, capture.frames_issued);
+	for (s4 y = 0; y < height; y++)
+	{
+		memcpy(job.pixels + y * width * 4, pixels + y * stride, width * 4);
+	}
+	submit_capture_job(job);
+
+	capture.frames_issued++;
+	return capture.max_frames == 0 || capture.frames_issued < (u4)capture.max_frames;
+}
+
+/*
+	Drains outstanding readbacks and the workers. Returns false if a golden
+	compare failed, so main() can turn it into the exit code.
+*/
+b4 stop_frame_capture()
+{
+	if (capture.mode == CAPTURE_OFF) return true;
+
+	if (!sgl.software) destroy_readback_ring(capture.ring, retire_capture_slot);
+
+	{
+		std::lock_guard<std::mutex> guard(capture.lock);
+		capture.running = false;
+	}
+	capture.job_ready.notify_all();
+	for (size_t i = 0; i < capture.workers.size(); i++)
+	{
+		capture.workers[i].join();
+	}
+	capture.workers.clear();
+
+	for (s4 i = 0; i < CAPTURE_JOB_COUNT; i++)
+	{
+		free(capture.jobs[i].pixels);
+	}
+	free(capture.yuv);
+	if (capture.pipe) pclose(capture.pipe);
+
+	b4 ok = true;
+	if (capture.mode == CAPTURE_GOLDEN)
+	{
+		ok = capture.frames_failed == 0 && capture.frames_compared > 0;
+		printf("golden: %u frames compared, %u failed, worst mean error %.3f, worst max error %d\n",
+			capture.frames_compared, capture.frames_failed,
+			capture.worst_mean_error, capture.worst_max_error);
+	}
+	else
+	{
+		printf("capture: %u frames written\n", capture.frames_written);
+	}
+	capture.mode = CAPTURE_OFF;
+	return ok;
+}
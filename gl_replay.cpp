@@ -0,0 +1,661 @@
+/*
+	Replays a trace written by sample_program --gl-trace (see gl_trace.cpp).
+
+	gl_replay <file> [--loops N] [--software-gl]
+
+	Every recorded call is made again against a hidden window of the
+	traced size. Object names, uniform locations, block indices and
+	attribute locations are mapped from the capturing driver's to this
+	one's as they are created, the last three per program. Vertex arrays
+	are context state that outlives glUseProgram, so their traced setup is
+	kept and pointed at the new program's locations when a switch changes
+	them. Payloads are passed straight from the loaded trace. No assets or
+	window system are needed: without DISPLAY or WAYLAND_DISPLAY SDL's
+	offscreen driver is used, --software-gl asks Mesa for llvmpipe.
+
+	Prints every frame's time, taken with a glFinish() at each FRAME record
+	so the GPU is included, next to the time the frame took when it was
+	captured. Then a table of the calls by total CPU time spent in them.
+	Calls before the first frame (startup, shader compiles) are reported
+	as setup. With --loops the frames are replayed again after the first
+	pass, without the setup, to get steadier numbers. Records after the
+	last frame (teardown in traces from older builds) are never replayed,
+	and every pass must leave the same GL state at each frame as the first
+	one, otherwise the later passes are not measuring the same work and
+	the replay fails.
+
+	build: g++ gl_replay.cpp -O2 -std=c++11 -lSDL2 -lGL -lGLEW -I../b_libs -o gl_replay
+*/
+#define GL_TRACE_REPLAY
+#include "global_vars.cpp"
+#include "gl_trace.cpp"
+
+#define REPLAY_UNSET -2 // mapping entry never filled, the old value is used as is
+
+struct REPLAY_BLOB
+{
+	const u1* data;
+	u4 size;
+};
+
+// one traced attribute location's vertex array, as the capturing driver saw it
+struct REPLAY_ARRAY
+{
+	b4 enabled;
+	b4 has_pointer;
+	u4 buffer; // traced name
+	u4 size;
+	u4 type;
+	u4 normalized;
+	u4 stride;
+	u4 offset;
+};
+
+struct REPLAY_CALL_STATS
+{
+	u8 count;
+	u8 ticks;
+};
+
+struct REPLAY
+{
+	u1* trace;
+	u8 size;
+	u8 frames_end; // offset just past the last FRAME record
+	GL_TRACE_HEADER header;
+	std::vector<REPLAY_BLOB> blobs; // by id
+	// by the capturing driver's names
+	std::vector<gu> buffers;
+	std::vector<gu> textures;
+	std::vector<gu> framebuffers;
+	std::vector<gu> renderbuffers;
+	std::vector<gu> queries;
+	std::vector<gu> programs; // shaders share the name space
+	std::vector<std::vector<s4>> uniform_locations; // [program][location]
+	std::vector<std::vector<s4>> block_indices;     // [program][index]
+	std::vector<std::vector<s4>> attributes;        // [program][location]
+	std::vector<REPLAY_ARRAY> arrays; // by traced attribute location
+	u4 array_buffer; // GL_ARRAY_BUFFER binding, as traced
+	GLsync syncs[GL_TRACE_SYNC_SLOTS];
+	u4 program; // current, as traced
+	b4 pack_buffer_bound;
+	std::vector<u1> scratch; // glReadPixels target without a pack buffer
+	REPLAY_CALL_STATS calls[TRACE_OP_COUNT];
+} replay;
+
+inline void set_id(std::vector<gu> &map, u4 old, gu id)
+{
+	if (old >= map.size()) map.resize(old + 1, 0);
+	map[old] = id;
+}
+
+inline gu get_id(std::vector<gu> &map, u4 old)
+{
+	return old < map.size() ? map[old] : 0;
+}
+
+inline void set_mapped(std::vector<s4> &map, s4 old, s4 value)
+{
+	if (old < 0) return;
+	if ((u4)old >= map.size()) map.resize(old + 1, REPLAY_UNSET);
+	map[old] = value;
+}
+
+inline s4 get_mapped(std::vector<s4> &map, s4 old)
+{
+	if (old < 0 || (u4)old >= map.size() || map[old] == REPLAY_UNSET) return old;
+	return map[old];
+}
+
+inline std::vector<s4> &program_map(std::vector<std::vector<s4>> &maps, u4 program)
+{
+	if (program >= maps.size()) maps.resize(program + 1);
+	return maps[program];
+}
+
+inline s4 uniform_location(u4 old)
+{
+	return get_mapped(program_map(replay.uniform_locations, replay.program), (s4)old);
+}
+
+inline s4 attribute_location(u4 program, u4 old)
+{
+	return get_mapped(program_map(replay.attributes, program), (s4)old);
+}
+
+inline REPLAY_ARRAY &traced_array(u4 location)
+{
+	if (location >= replay.arrays.size()) replay.arrays.resize(location + 1, REPLAY_ARRAY());
+	return replay.arrays[location];
+}
+
+void set_array_pointer(s4 location, const REPLAY_ARRAY &array)
+{
+	glVertexAttribPointer(location, array.size, array.type, array.normalized, array.stride,
+		(const void*)(uintptr_t)array.offset);
+}
+
+/*
+	Called on a program switch. When the two programs put any traced
+	location somewhere else on this driver, the arrays set up through the
+	old mapping are torn down and set up again through the new one.
+*/
+void remap_vertex_arrays(u4 from, u4 to)
+{
+	b4 changed = false;
+	for (u4 i = 0; i < replay.arrays.size() && !changed; i++)
+	{
+		changed = attribute_location(from, i) != attribute_location(to, i);
+	}
+	if (!changed) return;
+
+	for (u4 i = 0; i < replay.arrays.size(); i++)
+	{
+		s4 location = attribute_location(from, i);
+		if (replay.arrays[i].enabled && location >= 0) glDisableVertexAttribArray(location);
+	}
+	for (u4 i = 0; i < replay.arrays.size(); i++)
+	{
+		REPLAY_ARRAY &array = replay.arrays[i];
+		s4 location = attribute_location(to, i);
+		if (location < 0) continue;
+		if (array.has_pointer)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, get_id(replay.buffers, array.buffer));
+			set_array_pointer(location, array);
+		}
+		if (array.enabled) glEnableVertexAttribArray(location);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, get_id(replay.buffers, replay.array_buffer));
+}
+
+inline f4 word_float(u4 word)
+{
+	f4 f;
+	memcpy(&f, &word, 4);
+	return f;
+}
+
+inline const u1* blob_data(u4 id)
+{
+	return id && id < replay.blobs.size() ? replay.blobs[id].data : 0;
+}
+
+inline const u4* blob_words(u4 id)
+{
+	return (const u4*)blob_data(id);
+}
+
+/*
+	Generate n objects with gen and map them to the names in blob.
+*/
+void replay_gen(void (*gen)(GLsizei, GLuint*), std::vector<gu> &map, u4 n, u4 blob)
+{
+	std::vector<gu> ids(n);
+	gen(n, ids.data());
+	const u4* old = blob_words(blob);
+	for (u4 i = 0; old && i < n; i++) set_id(map, old[i], ids[i]);
+}
+
+void replay_delete(void (*del)(GLsizei, const GLuint*), std::vector<gu> &map, u4 n, u4 blob)
+{
+	std::vector<gu> ids(n);
+	const u4* old = blob_words(blob);
+	for (u4 i = 0; old && i < n; i++)
+	{
+		ids[i] = get_id(map, old[i]);
+		set_id(map, old[i], 0);
+	}
+	del(n, ids.data());
+}
+
+// GLEW's entry points are macros over function pointers, these take their address
+void gen_buffers(GLsizei n, GLuint* ids) { glGenBuffers(n, ids); }
+void gen_framebuffers(GLsizei n, GLuint* ids) { glGenFramebuffers(n, ids); }
+void gen_queries(GLsizei n, GLuint* ids) { glGenQueries(n, ids); }
+void gen_renderbuffers(GLsizei n, GLuint* ids) { glGenRenderbuffers(n, ids); }
+void gen_textures(GLsizei n, GLuint* ids) { glGenTextures(n, ids); }
+void delete_buffers(GLsizei n, const GLuint* ids) { glDeleteBuffers(n, ids); }
+void delete_framebuffers(GLsizei n, const GLuint* ids) { glDeleteFramebuffers(n, ids); }
+void delete_queries(GLsizei n, const GLuint* ids) { glDeleteQueries(n, ids); }
+void delete_renderbuffers(GLsizei n, const GLuint* ids) { glDeleteRenderbuffers(n, ids); }
+void delete_textures(GLsizei n, const GLuint* ids) { glDeleteTextures(n, ids); }
+
+/*
+	Make one recorded call. a holds its argc words.
+*/
+b4 replay_call(u2 op, const u4* a, u2 argc)
+{
+	switch (op)
+	{
+	case TRACE_glActiveTexture: glActiveTexture(a[0]); break;
+	case TRACE_glAttachShader: glAttachShader(get_id(replay.programs, a[0]), get_id(replay.programs, a[1])); break;
+	case TRACE_glBeginQuery: glBeginQuery(a[0], get_id(replay.queries, a[1])); break;
+	case TRACE_glBindBuffer:
+		if (a[0] == GL_PIXEL_PACK_BUFFER) replay.pack_buffer_bound = a[1] != 0;
+		if (a[0] == GL_ARRAY_BUFFER) replay.array_buffer = a[1];
+		glBindBuffer(a[0], get_id(replay.buffers, a[1]));
+		break;
+	case TRACE_glBindBufferBase: glBindBufferBase(a[0], a[1], get_id(replay.buffers, a[2])); break;
+	case TRACE_glBindBufferRange: glBindBufferRange(a[0], a[1], get_id(replay.buffers, a[2]), (GLintptr)a[3], (GLsizeiptr)a[4]); break;
+	case TRACE_glBindFramebuffer: glBindFramebuffer(a[0], get_id(replay.framebuffers, a[1])); break;
+	case TRACE_glBindRenderbuffer: glBindRenderbuffer(a[0], get_id(replay.renderbuffers, a[1])); break;
+	case TRACE_glBindTexture: glBindTexture(a[0], get_id(replay.textures, a[1])); break;
+	case TRACE_glBlendFunc: glBlendFunc(a[0], a[1]); break;
+	case TRACE_glBlitFramebuffer:
+		glBlitFramebuffer((s4)a[0], (s4)a[1], (s4)a[2], (s4)a[3], (s4)a[4], (s4)a[5], (s4)a[6], (s4)a[7], a[8], a[9]);
+		break;
+	case TRACE_glBufferData: glBufferData(a[0], (GLsizeiptr)a[1], blob_data(a[2]), a[3]); break;
+	case TRACE_glBufferSubData: glBufferSubData(a[0], (GLintptr)a[1], (GLsizeiptr)a[2], blob_data(a[3])); break;
+	case TRACE_glClear: glClear(a[0]); break;
+	case TRACE_glClearColor: glClearColor(word_float(a[0]), word_float(a[1]), word_float(a[2]), word_float(a[3])); break;
+	case TRACE_glClientWaitSync:
+		if (a[0] < GL_TRACE_SYNC_SLOTS && replay.syncs[a[0]])
+		{
+			glClientWaitSync(replay.syncs[a[0]], a[1], (GLuint64)a[2] | ((GLuint64)a[3] << 32));
+		}
+		break;
+	case TRACE_glColorMask: glColorMask(a[0], a[1], a[2], a[3]); break;
+	case TRACE_glCompileShader: glCompileShader(get_id(replay.programs, a[0])); break;
+	case TRACE_glCreateProgram: set_id(replay.programs, a[0], glCreateProgram()); break;
+	case TRACE_glCreateShader: set_id(replay.programs, a[1], glCreateShader(a[0])); break;
+	case TRACE_glDeleteBuffers: replay_delete(delete_buffers, replay.buffers, a[0], a[1]); break;
+	case TRACE_glDeleteFramebuffers: replay_delete(delete_framebuffers, replay.framebuffers, a[0], a[1]); break;
+	case TRACE_glDeleteProgram:
+		glDeleteProgram(get_id(replay.programs, a[0]));
+		program_map(replay.uniform_locations, a[0]).clear();
+		program_map(replay.block_indices, a[0]).clear();
+		program_map(replay.attributes, a[0]).clear();
+		break;
+	case TRACE_glDeleteQueries: replay_delete(delete_queries, replay.queries, a[0], a[1]); break;
+	case TRACE_glDeleteRenderbuffers: replay_delete(delete_renderbuffers, replay.renderbuffers, a[0], a[1]); break;
+	case TRACE_glDeleteShader: glDeleteShader(get_id(replay.programs, a[0])); break;
+	case TRACE_glDeleteSync:
+		if (a[0] < GL_TRACE_SYNC_SLOTS && replay.syncs[a[0]])
+		{
+			glDeleteSync(replay.syncs[a[0]]);
+			replay.syncs[a[0]] = 0;
+		}
+		break;
+	case TRACE_glDeleteTextures: replay_delete(delete_textures, replay.textures, a[0], a[1]); break;
+	case TRACE_glDepthFunc: glDepthFunc(a[0]); break;
+	case TRACE_glDepthMask: glDepthMask(a[0]); break;
+	case TRACE_glDetachShader: glDetachShader(get_id(replay.programs, a[0]), get_id(replay.programs, a[1])); break;
+	case TRACE_glDisable: glDisable(a[0]); break;
+	case TRACE_glDisableVertexAttribArray:
+	{
+		traced_array(a[0]).enabled = false;
+		s4 location = attribute_location(replay.program, a[0]);
+		if (location >= 0) glDisableVertexAttribArray(location);
+		break;
+	}
+	case TRACE_glDrawArrays: glDrawArrays(a[0], (s4)a[1], a[2]); break;
+	case TRACE_glDrawElements: glDrawElements(a[0], a[1], a[2], (const void*)(uintptr_t)a[3]); break;
+	case TRACE_glEnable: glEnable(a[0]); break;
+	case TRACE_glEnableVertexAttribArray:
+	{
+		traced_array(a[0]).enabled = true;
+		s4 location = attribute_location(replay.program, a[0]);
+		if (location >= 0) glEnableVertexAttribArray(location);
+		break;
+	}
+	case TRACE_glEndQuery: glEndQuery(a[0]); break;
+	case TRACE_glFenceSync:
+		if (a[2] < GL_TRACE_SYNC_SLOTS)
+		{
+			if (replay.syncs[a[2]]) glDeleteSync(replay.syncs[a[2]]);
+			replay.syncs[a[2]] = glFenceSync(a[0], a[1]);
+		}
+		break;
+	case TRACE_glFinish: glFinish(); break;
+	case TRACE_glFramebufferRenderbuffer: glFramebufferRenderbuffer(a[0], a[1], a[2], get_id(replay.renderbuffers, a[3])); break;
+	case TRACE_glFramebufferTexture2D: glFramebufferTexture2D(a[0], a[1], a[2], get_id(replay.textures, a[3]), a[4]); break;
+	case TRACE_glGenBuffers: replay_gen(gen_buffers, replay.buffers, a[0], a[1]); break;
+	case TRACE_glGenFramebuffers: replay_gen(gen_framebuffers, replay.framebuffers, a[0], a[1]); break;
+	case TRACE_glGenQueries: replay_gen(gen_queries, replay.queries, a[0], a[1]); break;
+	case TRACE_glGenRenderbuffers: replay_gen(gen_renderbuffers, replay.renderbuffers, a[0], a[1]); break;
+	case TRACE_glGenTextures: replay_gen(gen_textures, replay.textures, a[0], a[1]); break;
+	case TRACE_glGetAttribLocation:
+		set_mapped(program_map(replay.attributes, a[0]), (s4)a[2],
+			glGetAttribLocation(get_id(replay.programs, a[0]), (const char*)blob_data(a[1])));
+		break;
+	case TRACE_glGetQueryObjectuiv:
+	{
+		GLuint result;
+		glGetQueryObjectuiv(get_id(replay.queries, a[0]), a[1], &result);
+		break;
+	}
+	case TRACE_glGetUniformBlockIndex:
+		set_mapped(program_map(replay.block_indices, a[0]), (s4)a[2],
+			(s4)glGetUniformBlockIndex(get_id(replay.programs, a[0]), (const char*)blob_data(a[1])));
+		break;
+	case TRACE_glGetUniformLocation:
+		set_mapped(program_map(replay.uniform_locations, a[0]), (s4)a[2],
+			glGetUniformLocation(get_id(replay.programs, a[0]), (const char*)blob_data(a[1])));
+		break;
+	case TRACE_glLinkProgram: glLinkProgram(get_id(replay.programs, a[0])); break;
+	case TRACE_glMapBuffer: glMapBuffer(a[0], a[1]); break;
+	case TRACE_glPixelStorei: glPixelStorei(a[0], (s4)a[1]); break;
+	case TRACE_glReadPixels:
+	{
+		void* pixels = (void*)(uintptr_t)a[6];
+		if (!replay.pack_buffer_bound)
+		{
+			// big enough for any format at up to four floats a pixel
+			replay.scratch.resize((u8)a[2] * a[3] * 16);
+			pixels = replay.scratch.data();
+		}
+		glReadPixels((s4)a[0], (s4)a[1], a[2], a[3], a[4], a[5], pixels);
+		break;
+	}
+	case TRACE_glRenderbufferStorage: glRenderbufferStorage(a[0], a[1], a[2], a[3]); break;
+	case TRACE_glRenderbufferStorageMultisample: glRenderbufferStorageMultisample(a[0], a[1], a[2], a[3], a[4]); break;
+	case TRACE_glScissor: glScissor((s4)a[0], (s4)a[1], a[2], a[3]); break;
+	case TRACE_glShaderSource:
+	{
+		const GLchar* strings[GL_TRACE_MAX_ARGS];
+		GLint lengths[GL_TRACE_MAX_ARGS];
+		u4 count = a[1] < argc - 2u ? a[1] : argc - 2u;
+		for (u4 i = 0; i < count; i++)
+		{
+			u4 id = a[2 + i];
+			strings[i] = id ? (const GLchar*)blob_data(id) : "";
+			lengths[i] = id && id < replay.blobs.size() ? replay.blobs[id].size : 0;
+		}
+		glShaderSource(get_id(replay.programs, a[0]), count, strings, lengths);
+		break;
+	}
+	case TRACE_glTexBuffer: glTexBuffer(a[0], a[1], get_id(replay.buffers, a[2])); break;
+	case TRACE_glTexImage2D: glTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], blob_data(a[8])); break;
+	case TRACE_glTexParameteri: glTexParameteri(a[0], a[1], (s4)a[2]); break;
+	case TRACE_glUniform1f: glUniform1f(uniform_location(a[0]), word_float(a[1])); break;
+	case TRACE_glUniform1i: glUniform1i(uniform_location(a[0]), (s4)a[1]); break;
+	case TRACE_glUniform3f: glUniform3f(uniform_location(a[0]), word_float(a[1]), word_float(a[2]), word_float(a[3])); break;
+	case TRACE_glUniform4fv: glUniform4fv(uniform_location(a[0]), a[1], (const GLfloat*)blob_data(a[2])); break;
+	case TRACE_glUniformBlockBinding:
+		glUniformBlockBinding(get_id(replay.programs, a[0]),
+			get_mapped(program_map(replay.block_indices, a[0]), (s4)a[1]), a[2]);
+		break;
+	case TRACE_glUniformMatrix4fv: glUniformMatrix4fv(uniform_location(a[0]), a[1], a[2], (const GLfloat*)blob_data(a[3])); break;
+	case TRACE_glUnmapBuffer: glUnmapBuffer(a[0]); break;
+	case TRACE_glUseProgram:
+		glUseProgram(get_id(replay.programs, a[0]));
+		remap_vertex_arrays(replay.program, a[0]);
+		replay.program = a[0];
+		break;
+	case TRACE_glVertexAttribPointer:
+	{
+		REPLAY_ARRAY &array = traced_array(a[0]);
+		array.has_pointer = true;
+		array.buffer = replay.array_buffer;
+		array.size = a[1];
+		array.type = a[2];
+		array.normalized = a[3];
+		array.stride = a[4];
+		array.offset = a[5];
+		s4 location = attribute_location(replay.program, a[0]);
+		if (location >= 0) set_array_pointer(location, array);
+		break;
+	}
+	case TRACE_glViewport: glViewport((s4)a[0], (s4)a[1], a[2], a[3]); break;
+	default: return false;
+	}
+	return true;
+}
+
+b4 load_trace(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		cerr << "gl_replay: could not open " << path << endl;
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	replay.size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	replay.trace = (u1*)malloc(replay.size);
+	b4 ok = replay.trace && fread(replay.trace, 1, replay.size, file) == replay.size;
+	fclose(file);
+	if (!ok || replay.size < sizeof(GL_TRACE_HEADER))
+	{
+		cerr << "gl_replay: could not read " << path << endl;
+		return false;
+	}
+	memcpy(&replay.header, replay.trace, sizeof(GL_TRACE_HEADER));
+	if (replay.header.magic != GL_TRACE_MAGIC || replay.header.version != GL_TRACE_VERSION)
+	{
+		cerr << "gl_replay: " << path << " is not a version " << GL_TRACE_VERSION << " gl trace" << endl;
+		return false;
+	}
+
+	// find the last frame, a record at a time like replay_trace()
+	const u1* p = replay.trace + sizeof(GL_TRACE_HEADER);
+	const u1* end = replay.trace + replay.size;
+	replay.frames_end = 0;
+	while (p + sizeof(GL_TRACE_RECORD) <= end)
+	{
+		GL_TRACE_RECORD r;
+		memcpy(&r, p, sizeof(r));
+		const u4* a = (const u4*)(p + sizeof(r));
+		p += sizeof(r) + r.argc * 4;
+		if (p > end || r.argc > GL_TRACE_MAX_ARGS) break;
+		if (r.op == TRACE_BLOB) p += (a[1] + 3) & ~3u;
+		else if (r.op == TRACE_FRAME) replay.frames_end = p - replay.trace;
+	}
+	if (!replay.frames_end)
+	{
+		cerr << "gl_replay: " << path << " has no frames" << endl;
+		return false;
+	}
+	if (replay.header.width <= 0 || replay.header.height <= 0)
+	{
+		// the program did not shut down cleanly, use its default size
+		replay.header.width = 800;
+		replay.header.height = 600;
+	}
+	return true;
+}
+
+/*
+	Digest of the bindings a frame leaves behind and of the errors raised
+	during it. Drawing with a deleted program or buffer changes both.
+*/
+u8 replay_state_hash()
+{
+	GLenum queries[] = {
+		GL_CURRENT_PROGRAM, GL_ARRAY_BUFFER_BINDING, GL_ELEMENT_ARRAY_BUFFER_BINDING,
+		GL_TEXTURE_BINDING_2D, GL_DRAW_FRAMEBUFFER_BINDING, GL_READ_FRAMEBUFFER_BINDING,
+	};
+	u8 hash = 14695981039346656037ULL;
+	for (u4 i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+	{
+		GLint value = 0;
+		glGetIntegerv(queries[i], &value);
+		hash = (hash ^ (u4)value) * 1099511628211ULL;
+	}
+	GLint program = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	hash = (hash ^ (program && glIsProgram(program))) * 1099511628211ULL;
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	for (s4 i = 0; i < 4; i++) hash = (hash ^ (u4)viewport[i]) * 1099511628211ULL;
+	for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError())
+	{
+		hash = (hash ^ error) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+	Replay every record up to the last frame. With skip_setup the calls
+	before the first frame are left out, they were made by an earlier pass.
+	frame_ms and frame_state get one entry per FRAME record. Returns false
+	on a malformed trace.
+*/
+b4 replay_trace(b4 skip_setup, std::vector<f8> &frame_ms, std::vector<f8> &captured_ms, std::vector<u8> &frame_state, f8 &setup_ms)
+{
+	const u1* p = replay.trace + sizeof(GL_TRACE_HEADER);
+	const u1* end = replay.trace + replay.frames_end;
+	b4 in_setup = true;
+	u8 frame_begin = SDL_GetPerformanceCounter();
+	f8 frequency = (f8)SDL_GetPerformanceFrequency();
+	while (p + sizeof(GL_TRACE_RECORD) <= end)
+	{
+		GL_TRACE_RECORD r;
+		memcpy(&r, p, sizeof(r));
+		const u4* a = (const u4*)(p + sizeof(r));
+		p += sizeof(r) + r.argc * 4;
+		if (p > end || r.argc > GL_TRACE_MAX_ARGS) return false;
+
+		if (r.op == TRACE_BLOB)
+		{
+			u4 id = a[0];
+			u4 size = a[1];
+			if (p + size > end) return false;
+			if (id >= replay.blobs.size()) replay.blobs.resize(id + 1);
+			replay.blobs[id].data = p;
+			replay.blobs[id].size = size;
+			p += (size + 3) & ~3u;
+			continue;
+		}
+		if (r.op == TRACE_FRAME)
+		{
+			glFinish();
+			u8 now = SDL_GetPerformanceCounter();
+			f8 ms = (now - frame_begin) * 1000.0 / frequency;
+			frame_begin = now;
+			frame_state.push_back(replay_state_hash());
+			if (in_setup)
+			{
+				// the first frame carries all of startup
+				if (!skip_setup) setup_ms = ms;
+				in_setup = false;
+			}
+			else
+			{
+				frame_ms.push_back(ms);
+				captured_ms.push_back(word_float(a[1]));
+			}
+			continue;
+		}
+		if (in_setup && skip_setup) continue;
+
+		u8 begin = SDL_GetPerformanceCounter();
+		if (!replay_call(r.op, a, r.argc))
+		{
+			cerr << "gl_replay: unknown call " << r.op << " at offset " << (p - replay.trace) << endl;
+			return false;
+		}
+		replay.calls[r.op].count++;
+		replay.calls[r.op].ticks += SDL_GetPerformanceCounter() - begin;
+	}
+	return true;
+}
+
+b4 create_replay_window()
+{
+	if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) setenv("SDL_VIDEODRIVER", "offscreen", 0);
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+	sgl.width = replay.header.width;
+	sgl.height = replay.header.height;
+	sgl.window = SDL_CreateWindow("gl_replay", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		sgl.width, sgl.height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (!sgl.window || !SDL_GL_CreateContext(sgl.window))
+	{
+		cerr << "gl_replay: no GL context: " << SDL_GetError() << endl;
+		return false;
+	}
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		cerr << "gl_replay: glewInit failed" << endl;
+		return false;
+	}
+	return true;
+}
+
+f8 percentile(std::vector<f8> sorted, f4 p)
+{
+	if (sorted.empty()) return 0.0;
+	std::sort(sorted.begin(), sorted.end());
+	u8 i = (u8)(p * (sorted.size() - 1));
+	return sorted[i];
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		cerr << "usage: gl_replay <file> [--loops N] [--software-gl]" << endl;
+		return 1;
+	}
+	s4 loops = 1;
+	for (int i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--loops") && i + 1 < argc) loops = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--software-gl")) setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+	}
+	if (!load_trace(argv[1])) return 1;
+	if (!create_replay_window()) return 1;
+	cout << "trace: " << replay.header.frames << " frames, " << replay.header.width << "x" << replay.header.height
+		 << ", " << replay.size / 1024 << " KB" << endl;
+	cout << "replaying on: " << glGetString(GL_RENDERER) << endl;
+
+	std::vector<f8> frame_ms;
+	std::vector<f8> captured_ms;
+	f8 setup_ms = 0.0;
+	std::vector<u8> first_state;
+	for (s4 loop = 0; loop < loops; loop++)
+	{
+		std::vector<u8> state;
+		if (!replay_trace(loop > 0, frame_ms, captured_ms, state, setup_ms))
+		{
+			cerr << "gl_replay: " << argv[1] << " is truncated or corrupt" << endl;
+			return 1;
+		}
+		if (loop == 0)
+		{
+			first_state = state;
+			continue;
+		}
+		// frame 0 carries the setup, later passes skip it
+		for (u8 i = 1; i < state.size() && i < first_state.size(); i++)
+		{
+			if (state[i] == first_state[i]) continue;
+			cerr << "gl_replay: pass " << loop + 1 << " left different GL state than pass 1 at frame " << i
+				 << ", its timings would not be comparable" << endl;
+			return 1;
+		}
+	}
+
+	printf("setup (first frame): %.3f ms\n", setup_ms);
+	printf("%8s %12s %12s\n", "frame", "replay ms", "captured ms");
+	for (u8 i = 0; i < frame_ms.size(); i++)
+	{
+		printf("%8d %12.3f %12.3f\n", (s4)i, frame_ms[i], captured_ms[i]);
+	}
+	printf("frames: median %.3f ms, p95 %.3f ms, max %.3f ms (captured median %.3f ms)\n",
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.95f), percentile(frame_ms, 1.0f), percentile(captured_ms, 0.5f));
+
+	s4 order[TRACE_OP_COUNT];
+	for (s4 i = 0; i < TRACE_OP_COUNT; i++) order[i] = i;
+	std::sort(order, order + TRACE_OP_COUNT, [](s4 a, s4 b) {
+		return replay.calls[a].ticks > replay.calls[b].ticks;
+	});
+	f8 frequency = (f8)SDL_GetPerformanceFrequency();
+	printf("\n%-34s %10s %12s %10s\n", "call", "count", "total ms", "us/call");
+	for (s4 i = 0; i < TRACE_OP_COUNT; i++)
+	{
+		REPLAY_CALL_STATS &c = replay.calls[order[i]];
+		if (!c.count) continue;
+		f8 ms = c.ticks * 1000.0 / frequency;
+		printf("%-34s %10llu %12.3f %10.3f\n", GL_TRACE_NAMES[order[i]], (unsigned long long)c.count, ms, ms * 1000.0 / c.count);
+	}
+
+	free(replay.trace);
+	SDL_DestroyWindow(sgl.window);
+	SDL_Quit();
+	return 0;
+}
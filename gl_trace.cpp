@@ -0,0 +1,899 @@
+/*
+	GL call trace.
+
+	With --gl-trace <file> every state changing GL call the renderer makes
+	is written to a binary trace, so a slow frame can be replayed and
+	profiled away from the machine it happened on (gl_replay.cpp). Read
+	backs and queries that only return values (glGetIntegerv, info logs,
+	glCheckFramebufferStatus) are not recorded.
+
+	The calls are intercepted by redefining each gl* name to a trace_gl*
+	wrapper below, so this file has to come right after global_vars.cpp
+	and before any code that calls GL. A wrapper makes the real call and,
+	while a trace is open, appends a record:
+
+		GL_TRACE_HEADER
+		GL_TRACE_RECORD { op, argc } + argc 32 bit words, repeated
+
+	Words are the call's arguments in order, floats by their bits, object
+	names as the capturing driver returned them. Values a call returns
+	(glCreateProgram, glGetUniformLocation, glFenceSync) are appended as
+	the last word so the replay can map them to its own. Payloads (buffer
+	and texture data, uniform arrays, shader sources, names) are stored
+	once as a BLOB record { id, size } + bytes padded to 4, and calls refer
+	to them by id, 0 meaning none. Blobs are deduplicated by FNV-1a hash,
+	so a static vertex buffer or an unchanged light list costs nothing the
+	second time. gl_trace_frame() after every swap adds a FRAME record with
+	the frame's CPU time on the capturing machine.
+*/
+
+#define GL_TRACE_MAGIC 0x52544c47 // "GLTR"
+#define GL_TRACE_VERSION 1
+#define GL_TRACE_MAX_ARGS 12
+#define GL_TRACE_BLOB_SLOTS (1 << 16) // power of two
+#define GL_TRACE_SYNC_SLOTS 64
+
+#define GL_TRACE_CALLS(X) \
+	X(BLOB) X(FRAME) \
+	X(glActiveTexture) X(glAttachShader) X(glBeginQuery) X(glBindBuffer) \
+	X(glBindBufferBase) X(glBindBufferRange) X(glBindFramebuffer) X(glBindRenderbuffer) \
+	X(glBindTexture) X(glBlendFunc) X(glBlitFramebuffer) X(glBufferData) \
+	X(glBufferSubData) X(glClear) X(glClearColor) X(glClientWaitSync) \
+	X(glColorMask) X(glCompileShader) X(glCreateProgram) X(glCreateShader) \
+	X(glDeleteBuffers) X(glDeleteFramebuffers) X(glDeleteProgram) X(glDeleteQueries) \
+	X(glDeleteRenderbuffers) X(glDeleteShader) X(glDeleteSync) X(glDeleteTextures) \
+	X(glDepthFunc) X(glDepthMask) X(glDetachShader) X(glDisable) \
+	X(glDisableVertexAttribArray) X(glDrawArrays) X(glDrawElements) X(glEnable) X(glEnableVertexAttribArray) \
+	X(glEndQuery) X(glFenceSync) X(glFinish) X(glFramebufferRenderbuffer) \
+	X(glFramebufferTexture2D) X(glGenBuffers) X(glGenFramebuffers) X(glGenQueries) \
+	X(glGenRenderbuffers) X(glGenTextures) X(glGetAttribLocation) X(glGetQueryObjectuiv) \
+	X(glGetUniformBlockIndex) X(glGetUniformLocation) X(glLinkProgram) X(glMapBuffer) \
+	X(glPixelStorei) X(glReadPixels) X(glRenderbufferStorage) X(glRenderbufferStorageMultisample) \
+	X(glScissor) X(glShaderSource) X(glTexBuffer) X(glTexImage2D) \
+	X(glTexParameteri) X(glUniform1f) X(glUniform1i) X(glUniform3f) X(glUniform4fv) \
+	X(glUniformBlockBinding) X(glUniformMatrix4fv) X(glUnmapBuffer) X(glUseProgram) \
+	X(glVertexAttribPointer) X(glViewport)
+
+enum GL_TRACE_OP
+{
+#define GL_TRACE_ENUM(name) TRACE_##name,
+	GL_TRACE_CALLS(GL_TRACE_ENUM)
+#undef GL_TRACE_ENUM
+	TRACE_OP_COUNT
+};
+
+const char* GL_TRACE_NAMES[] = {
+#define GL_TRACE_NAME(name) #name,
+	GL_TRACE_CALLS(GL_TRACE_NAME)
+#undef GL_TRACE_NAME
+};
+
+struct GL_TRACE_HEADER
+{
+	u4 magic;
+	u4 version;
+	s4 width; // window size, for the replay's window
+	s4 height;
+	u4 frames;
+	u4 blobs;
+};
+
+struct GL_TRACE_RECORD
+{
+	u2 op;   // GL_TRACE_OP
+	u2 argc; // words that follow
+};
+
+#ifndef GL_TRACE_REPLAY
+
+struct GL_TRACE_BLOB_SLOT
+{
+	u8 hash;
+	u4 size;
+	u4 id; // 0 for an empty slot
+};
+
+struct GL_TRACE
+{
+	FILE* file;
+	s4 max_frames; // 0 traces until exit
+	u4 frames;
+	u4 blob_count;
+	u8 blob_bytes;
+	u8 deduplicated_bytes;
+	s4 unpack_alignment;
+	u8 frame_begin;
+	GL_TRACE_BLOB_SLOT* blobs;
+	GLsync syncs[GL_TRACE_SYNC_SLOTS]; // slot is the id the trace uses
+	u4 next_sync;
+} gl_trace;
+
+inline u4 trace_word(u4 v) { return v; }
+inline u4 trace_word(s4 v) { return (u4)v; }
+inline u4 trace_word(u1 v) { return v; }
+inline u4 trace_word(f4 v) { u4 u; memcpy(&u, &v, 4); return u; }
+
+inline void trace_write(u2 op, u2 argc, const u4* words)
+{
+	GL_TRACE_RECORD r = { op, argc };
+	fwrite(&r, sizeof(r), 1, gl_trace.file);
+	if (argc) fwrite(words, 4, argc, gl_trace.file);
+}
+
+inline void trace_call(u2 op)
+{
+	trace_write(op, 0, 0);
+}
+
+template <typename... A> inline void trace_call(u2 op, A... args)
+{
+	u4 words[] = { trace_word(args)... };
+	trace_write(op, sizeof...(A), words);
+}
+
+u8 trace_hash(const u1* data, u8 size)
+{
+	u8 hash = 14695981039346656037ULL;
+	for (u8 i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+	Id of a blob holding size bytes at data, written to the trace the first
+	time these bytes are seen. 0 for no data. Once the table is full new
+	payloads are written every time.
+*/
+u4 trace_blob(const void* data, u8 size)
+{
+	if (!data || !size) return 0;
+	u8 hash = trace_hash((const u1*)data, size);
+	u4 slot = (u4)hash & (GL_TRACE_BLOB_SLOTS - 1);
+	for (u4 probe = 0; probe < 16; probe++)
+	{
+		GL_TRACE_BLOB_SLOT &b = gl_trace.blobs[(slot + probe) & (GL_TRACE_BLOB_SLOTS - 1)];
+		if (b.id && b.hash == hash && b.size == size)
+		{
+			gl_trace.deduplicated_bytes += size;
+			return b.id;
+		}
+		if (!b.id)
+		{
+			slot = (slot + probe) & (GL_TRACE_BLOB_SLOTS - 1);
+			break;
+		}
+	}
+
+	u4 id = ++gl_trace.blob_count;
+	u4 words[2] = { id, (u4)size };
+	trace_write(TRACE_BLOB, 2, words);
+	fwrite(data, 1, size, gl_trace.file);
+	u4 zero = 0;
+	if (size & 3) fwrite(&zero, 1, 4 - (size & 3), gl_trace.file);
+	gl_trace.blob_bytes += size;
+
+	GL_TRACE_BLOB_SLOT &b = gl_trace.blobs[slot];
+	if (!b.id)
+	{
+		b.hash = hash;
+		b.size = (u4)size;
+		b.id = id;
+	}
+	return id;
+}
+
+inline u4 trace_string(const char* s)
+{
+	return trace_blob(s, strlen(s) + 1);
+}
+
+/*
+	Bytes glTexImage2D reads for an image, rows padded to the unpack
+	alignment except the last.
+*/
+u8 trace_image_bytes(s4 width, s4 height, GLenum format, GLenum type)
+{
+	s4 components = 4;
+	if (format == GL_RED || format == GL_ALPHA || format == GL_LUMINANCE || format == GL_DEPTH_COMPONENT) components = 1;
+	else if (format == GL_RG || format == GL_LUMINANCE_ALPHA) components = 2;
+	else if (format == GL_RGB || format == GL_BGR) components = 3;
+	s4 size = 4;
+	if (type == GL_UNSIGNED_BYTE || type == GL_BYTE) size = 1;
+	else if (type == GL_UNSIGNED_SHORT || type == GL_SHORT || type == GL_HALF_FLOAT) size = 2;
+	u8 row = (u8)width * components * size;
+	u8 stride = (row + gl_trace.unpack_alignment - 1) / gl_trace.unpack_alignment * gl_trace.unpack_alignment;
+	return height > 0 ? stride * (height - 1) + row : 0;
+}
+
+u4 trace_sync_id(GLsync sync)
+{
+	for (u4 i = 0; i < GL_TRACE_SYNC_SLOTS; i++)
+	{
+		if (gl_trace.syncs[i] == sync) return i;
+	}
+	return GL_TRACE_SYNC_SLOTS;
+}
+
+b4 start_gl_trace(const char* path, s4 max_frames)
+{
+	gl_trace.file = fopen(path, "wb");
+	if (!gl_trace.file)
+	{
+		cerr << "Error: could not create gl trace " << path << endl;
+		return false;
+	}
+	setvbuf(gl_trace.file, 0, _IOFBF, 1 << 20);
+	gl_trace.blobs = (GL_TRACE_BLOB_SLOT*)calloc(GL_TRACE_BLOB_SLOTS, sizeof(GL_TRACE_BLOB_SLOT));
+	gl_trace.max_frames = max_frames;
+	gl_trace.frames = 0;
+	gl_trace.blob_count = 0;
+	gl_trace.blob_bytes = 0;
+	gl_trace.deduplicated_bytes = 0;
+	gl_trace.unpack_alignment = 4;
+	gl_trace.next_sync = 0;
+	for (u4 i = 0; i < GL_TRACE_SYNC_SLOTS; i++) gl_trace.syncs[i] = 0;
+	gl_trace.frame_begin = SDL_GetPerformanceCounter();
+
+	// completed by stop_gl_trace()
+	GL_TRACE_HEADER header = { GL_TRACE_MAGIC, GL_TRACE_VERSION, 0, 0, 0, 0 };
+	fwrite(&header, sizeof(header), 1, gl_trace.file);
+	return true;
+}
+
+/*
+	Call after every presented frame. Returns false once max_frames have
+	been traced, the caller should then quit.
+*/
+b4 gl_trace_frame()
+{
+	if (!gl_trace.file) return true;
+	u8 now = SDL_GetPerformanceCounter();
+	f4 ms = (f4)((f8)(now - gl_trace.frame_begin) * 1000.0 / SDL_GetPerformanceFrequency());
+	gl_trace.frame_begin = now;
+	trace_call(TRACE_FRAME, gl_trace.frames, ms);
+	gl_trace.frames++;
+	return !gl_trace.max_frames || gl_trace.frames < (u4)gl_trace.max_frames;
+}
+
+void stop_gl_trace()
+{
+	if (!gl_trace.file) return;
+	GL_TRACE_HEADER header = { GL_TRACE_MAGIC, GL_TRACE_VERSION, sgl.width, sgl.height, gl_trace.frames, gl_trace.blob_count };
+	fseek(gl_trace.file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, gl_trace.file);
+	fseek(gl_trace.file, 0, SEEK_END);
+	cout << "gl trace: " << gl_trace.frames << " frames, " << ftell(gl_trace.file) / 1024 << " KB, "
+		 << gl_trace.blob_count << " blobs (" << gl_trace.blob_bytes / 1024 << " KB stored, "
+		 << gl_trace.deduplicated_bytes / 1024 << " KB deduplicated)" << endl;
+	fclose(gl_trace.file);
+	gl_trace.file = 0;
+	free(gl_trace.blobs);
+	gl_trace.blobs = 0;
+}
+
+// wrappers, same signatures as the entry points they stand in for
+
+void trace_glActiveTexture(GLenum texture)
+{
+	glActiveTexture(texture);
+	if (gl_trace.file) trace_call(TRACE_glActiveTexture, texture);
+}
+
+void trace_glAttachShader(GLuint program, GLuint shader)
+{
+	glAttachShader(program, shader);
+	if (gl_trace.file) trace_call(TRACE_glAttachShader, program, shader);
+}
+
+void trace_glBeginQuery(GLenum target, GLuint id)
+{
+	glBeginQuery(target, id);
+	if (gl_trace.file) trace_call(TRACE_glBeginQuery, target, id);
+}
+
+void trace_glBindBuffer(GLenum target, GLuint buffer)
+{
+	glBindBuffer(target, buffer);
+	if (gl_trace.file) trace_call(TRACE_glBindBuffer, target, buffer);
+}
+
+void trace_glBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	glBindBufferBase(target, index, buffer);
+	if (gl_trace.file) trace_call(TRACE_glBindBufferBase, target, index, buffer);
+}
+
+void trace_glBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	glBindBufferRange(target, index, buffer, offset, size);
+	if (gl_trace.file) trace_call(TRACE_glBindBufferRange, target, index, buffer, (u4)offset, (u4)size);
+}
+
+void trace_glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	glBindFramebuffer(target, framebuffer);
+	if (gl_trace.file) trace_call(TRACE_glBindFramebuffer, target, framebuffer);
+}
+
+void trace_glBindRenderbuffer(GLenum target, GLuint renderbuffer)
+{
+	glBindRenderbuffer(target, renderbuffer);
+	if (gl_trace.file) trace_call(TRACE_glBindRenderbuffer, target, renderbuffer);
+}
+
+void trace_glBindTexture(GLenum target, GLuint texture)
+{
+	glBindTexture(target, texture);
+	if (gl_trace.file) trace_call(TRACE_glBindTexture, target, texture);
+}
+
+void trace_glBlendFunc(GLenum sfactor, GLenum dfactor)
+{
+	glBlendFunc(sfactor, dfactor);
+	if (gl_trace.file) trace_call(TRACE_glBlendFunc, sfactor, dfactor);
+}
+
+void trace_glBlitFramebuffer(GLint sx0, GLint sy0, GLint sx1, GLint sy1, GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter)
+{
+	glBlitFramebuffer(sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1, mask, filter);
+	if (gl_trace.file) trace_call(TRACE_glBlitFramebuffer, sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1, mask, filter);
+}
+
+void trace_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	glBufferData(target, size, data, usage);
+	if (gl_trace.file) trace_call(TRACE_glBufferData, target, (u4)size, trace_blob(data, size), usage);
+}
+
+void trace_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	glBufferSubData(target, offset, size, data);
+	if (gl_trace.file) trace_call(TRACE_glBufferSubData, target, (u4)offset, (u4)size, trace_blob(data, size));
+}
+
+void trace_glClear(GLbitfield mask)
+{
+	glClear(mask);
+	if (gl_trace.file) trace_call(TRACE_glClear, mask);
+}
+
+void trace_glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	glClearColor(r, g, b, a);
+	if (gl_trace.file) trace_call(TRACE_glClearColor, r, g, b, a);
+}
+
+GLenum trace_glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+	GLenum result = glClientWaitSync(sync, flags, timeout);
+	if (gl_trace.file) trace_call(TRACE_glClientWaitSync, trace_sync_id(sync), flags, (u4)timeout, (u4)(timeout >> 32));
+	return result;
+}
+
+void trace_glColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+	glColorMask(r, g, b, a);
+	if (gl_trace.file) trace_call(TRACE_glColorMask, r, g, b, a);
+}
+
+void trace_glCompileShader(GLuint shader)
+{
+	glCompileShader(shader);
+	if (gl_trace.file) trace_call(TRACE_glCompileShader, shader);
+}
+
+GLuint trace_glCreateProgram()
+{
+	GLuint program = glCreateProgram();
+	if (gl_trace.file) trace_call(TRACE_glCreateProgram, program);
+	return program;
+}
+
+GLuint trace_glCreateShader(GLenum type)
+{
+	GLuint shader = glCreateShader(type);
+	if (gl_trace.file) trace_call(TRACE_glCreateShader, type, shader);
+	return shader;
+}
+
+void trace_glDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	if (gl_trace.file) trace_call(TRACE_glDeleteBuffers, n, trace_blob(buffers, n * sizeof(GLuint)));
+	glDeleteBuffers(n, buffers);
+}
+
+void trace_glDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+	if (gl_trace.file) trace_call(TRACE_glDeleteFramebuffers, n, trace_blob(framebuffers, n * sizeof(GLuint)));
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+void trace_glDeleteProgram(GLuint program)
+{
+	glDeleteProgram(program);
+	if (gl_trace.file) trace_call(TRACE_glDeleteProgram, program);
+}
+
+void trace_glDeleteQueries(GLsizei n, const GLuint* ids)
+{
+	if (gl_trace.file) trace_call(TRACE_glDeleteQueries, n, trace_blob(ids, n * sizeof(GLuint)));
+	glDeleteQueries(n, ids);
+}
+
+void trace_glDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers)
+{
+	if (gl_trace.file) trace_call(TRACE_glDeleteRenderbuffers, n, trace_blob(renderbuffers, n * sizeof(GLuint)));
+	glDeleteRenderbuffers(n, renderbuffers);
+}
+
+void trace_glDeleteShader(GLuint shader)
+{
+	glDeleteShader(shader);
+	if (gl_trace.file) trace_call(TRACE_glDeleteShader, shader);
+}
+
+void trace_glDeleteSync(GLsync sync)
+{
+	if (gl_trace.file)
+	{
+		u4 id = trace_sync_id(sync);
+		trace_call(TRACE_glDeleteSync, id);
+		if (id < GL_TRACE_SYNC_SLOTS) gl_trace.syncs[id] = 0;
+	}
+	glDeleteSync(sync);
+}
+
+void trace_glDeleteTextures(GLsizei n, const GLuint* textures)
+{
+	if (gl_trace.file) trace_call(TRACE_glDeleteTextures, n, trace_blob(textures, n * sizeof(GLuint)));
+	glDeleteTextures(n, textures);
+}
+
+void trace_glDepthFunc(GLenum func)
+{
+	glDepthFunc(func);
+	if (gl_trace.file) trace_call(TRACE_glDepthFunc, func);
+}
+
+void trace_glDepthMask(GLboolean flag)
+{
+	glDepthMask(flag);
+	if (gl_trace.file) trace_call(TRACE_glDepthMask, flag);
+}
+
+void trace_glDetachShader(GLuint program, GLuint shader)
+{
+	glDetachShader(program, shader);
+	if (gl_trace.file) trace_call(TRACE_glDetachShader, program, shader);
+}
+
+void trace_glDisable(GLenum cap)
+{
+	glDisable(cap);
+	if (gl_trace.file) trace_call(TRACE_glDisable, cap);
+}
+
+void trace_glDisableVertexAttribArray(GLuint index)
+{
+	glDisableVertexAttribArray(index);
+	if (gl_trace.file) trace_call(TRACE_glDisableVertexAttribArray, index);
+}
+
+void trace_glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	glDrawArrays(mode, first, count);
+	if (gl_trace.file) trace_call(TRACE_glDrawArrays, mode, first, count);
+}
+
+void trace_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	glDrawElements(mode, count, type, indices);
+	// indices is always an offset into the bound element buffer here
+	if (gl_trace.file) trace_call(TRACE_glDrawElements, mode, count, type, (u4)(uintptr_t)indices);
+}
+
+void trace_glEnable(GLenum cap)
+{
+	glEnable(cap);
+	if (gl_trace.file) trace_call(TRACE_glEnable, cap);
+}
+
+void trace_glEnableVertexAttribArray(GLuint index)
+{
+	glEnableVertexAttribArray(index);
+	if (gl_trace.file) trace_call(TRACE_glEnableVertexAttribArray, index);
+}
+
+void trace_glEndQuery(GLenum target)
+{
+	glEndQuery(target);
+	if (gl_trace.file) trace_call(TRACE_glEndQuery, target);
+}
+
+GLsync trace_glFenceSync(GLenum condition, GLbitfield flags)
+{
+	GLsync sync = glFenceSync(condition, flags);
+	if (gl_trace.file)
+	{
+		// a fence still in use is never overwritten, the rings using fences are far smaller
+		u4 id = gl_trace.next_sync++ % GL_TRACE_SYNC_SLOTS;
+		gl_trace.syncs[id] = sync;
+		trace_call(TRACE_glFenceSync, condition, flags, id);
+	}
+	return sync;
+}
+
+void trace_glFinish()
+{
+	glFinish();
+	if (gl_trace.file) trace_call(TRACE_glFinish);
+}
+
+void trace_glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer)
+{
+	glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
+	if (gl_trace.file) trace_call(TRACE_glFramebufferRenderbuffer, target, attachment, renderbuffertarget, renderbuffer);
+}
+
+void trace_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+	glFramebufferTexture2D(target, attachment, textarget, texture, level);
+	if (gl_trace.file) trace_call(TRACE_glFramebufferTexture2D, target, attachment, textarget, texture, level);
+}
+
+void trace_glGenBuffers(GLsizei n, GLuint* buffers)
+{
+	glGenBuffers(n, buffers);
+	if (gl_trace.file) trace_call(TRACE_glGenBuffers, n, trace_blob(buffers, n * sizeof(GLuint)));
+}
+
+void trace_glGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+	glGenFramebuffers(n, framebuffers);
+	if (gl_trace.file) trace_call(TRACE_glGenFramebuffers, n, trace_blob(framebuffers, n * sizeof(GLuint)));
+}
+
+void trace_glGenQueries(GLsizei n, GLuint* ids)
+{
+	glGenQueries(n, ids);
+	if (gl_trace.file) trace_call(TRACE_glGenQueries, n, trace_blob(ids, n * sizeof(GLuint)));
+}
+
+void trace_glGenRenderbuffers(GLsizei n, GLuint* renderbuffers)
+{
+	glGenRenderbuffers(n, renderbuffers);
+	if (gl_trace.file) trace_call(TRACE_glGenRenderbuffers, n, trace_blob(renderbuffers, n * sizeof(GLuint)));
+}
+
+void trace_glGenTextures(GLsizei n, GLuint* textures)
+{
+	glGenTextures(n, textures);
+	if (gl_trace.file) trace_call(TRACE_glGenTextures, n, trace_blob(textures, n * sizeof(GLuint)));
+}
+
+GLint trace_glGetAttribLocation(GLuint program, const GLchar* name)
+{
+	GLint location = glGetAttribLocation(program, name);
+	if (gl_trace.file) trace_call(TRACE_glGetAttribLocation, program, trace_string(name), location);
+	return location;
+}
+
+void trace_glGetQueryObjectuiv(GLuint id, GLenum pname, GLuint* params)
+{
+	glGetQueryObjectuiv(id, pname, params);
+	// the result is not needed, but polling it is part of the frame's cost
+	if (gl_trace.file) trace_call(TRACE_glGetQueryObjectuiv, id, pname);
+}
+
+GLuint trace_glGetUniformBlockIndex(GLuint program, const GLchar* name)
+{
+	GLuint index = glGetUniformBlockIndex(program, name);
+	if (gl_trace.file) trace_call(TRACE_glGetUniformBlockIndex, program, trace_string(name), index);
+	return index;
+}
+
+GLint trace_glGetUniformLocation(GLuint program, const GLchar* name)
+{
+	GLint location = glGetUniformLocation(program, name);
+	if (gl_trace.file) trace_call(TRACE_glGetUniformLocation, program, trace_string(name), location);
+	return location;
+}
+
+void trace_glLinkProgram(GLuint program)
+{
+	glLinkProgram(program);
+	if (gl_trace.file) trace_call(TRACE_glLinkProgram, program);
+}
+
+void* trace_glMapBuffer(GLenum target, GLenum access)
+{
+	void* mapped = glMapBuffer(target, access);
+	// only read back buffers are mapped, nothing written through the mapping needs recording
+	if (gl_trace.file) trace_call(TRACE_glMapBuffer, target, access);
+	return mapped;
+}
+
+void trace_glPixelStorei(GLenum pname, GLint param)
+{
+	glPixelStorei(pname, param);
+	if (pname == GL_UNPACK_ALIGNMENT) gl_trace.unpack_alignment = param;
+	if (gl_trace.file) trace_call(TRACE_glPixelStorei, pname, param);
+}
+
+void trace_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels)
+{
+	glReadPixels(x, y, width, height, format, type, pixels);
+	// an offset when a pack buffer is bound, the replay reads into memory of its own otherwise
+	if (gl_trace.file) trace_call(TRACE_glReadPixels, x, y, width, height, format, type, (u4)(uintptr_t)pixels);
+}
+
+void trace_glRenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height)
+{
+	glRenderbufferStorage(target, internalformat, width, height);
+	if (gl_trace.file) trace_call(TRACE_glRenderbufferStorage, target, internalformat, width, height);
+}
+
+void trace_glRenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height)
+{
+	glRenderbufferStorageMultisample(target, samples, internalformat, width, height);
+	if (gl_trace.file) trace_call(TRACE_glRenderbufferStorageMultisample, target, samples, internalformat, width, height);
+}
+
+void trace_glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	glScissor(x, y, width, height);
+	if (gl_trace.file) trace_call(TRACE_glScissor, x, y, width, height);
+}
+
+void trace_glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length)
+{
+	glShaderSource(shader, count, string, length);
+	if (!gl_trace.file) return;
+	u4 words[GL_TRACE_MAX_ARGS];
+	s4 n = count < GL_TRACE_MAX_ARGS - 2 ? count : GL_TRACE_MAX_ARGS - 2;
+	words[0] = shader;
+	words[1] = n;
+	for (s4 i = 0; i < n; i++)
+	{
+		u8 size = length && length[i] >= 0 ? (u8)length[i] : strlen(string[i]);
+		// an empty string has no blob, the replay passes it as empty
+		words[2 + i] = trace_blob(string[i], size);
+	}
+	trace_write(TRACE_glShaderSource, 2 + n, words);
+}
+
+void trace_glTexBuffer(GLenum target, GLenum internalformat, GLuint buffer)
+{
+	glTexBuffer(target, internalformat, buffer);
+	if (gl_trace.file) trace_call(TRACE_glTexBuffer, target, internalformat, buffer);
+}
+
+void trace_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+	if (gl_trace.file)
+	{
+		u4 blob = trace_blob(pixels, trace_image_bytes(width, height, format, type));
+		trace_call(TRACE_glTexImage2D, target, level, internalformat, width, height, border, format, type, blob);
+	}
+}
+
+void trace_glTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+	glTexParameteri(target, pname, param);
+	if (gl_trace.file) trace_call(TRACE_glTexParameteri, target, pname, param);
+}
+
+void trace_glUniform1f(GLint location, GLfloat v0)
+{
+	glUniform1f(location, v0);
+	if (gl_trace.file) trace_call(TRACE_glUniform1f, location, v0);
+}
+
+void trace_glUniform1i(GLint location, GLint v0)
+{
+	glUniform1i(location, v0);
+	if (gl_trace.file) trace_call(TRACE_glUniform1i, location, v0);
+}
+
+void trace_glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	glUniform3f(location, v0, v1, v2);
+	if (gl_trace.file) trace_call(TRACE_glUniform3f, location, v0, v1, v2);
+}
+
+void trace_glUniform4fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	glUniform4fv(location, count, value);
+	if (gl_trace.file) trace_call(TRACE_glUniform4fv, location, count, trace_blob(value, count * 4 * sizeof(GLfloat)));
+}
+
+void trace_glUniformBlockBinding(GLuint program, GLuint index, GLuint binding)
+{
+	glUniformBlockBinding(program, index, binding);
+	if (gl_trace.file) trace_call(TRACE_glUniformBlockBinding, program, index, binding);
+}
+
+void trace_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	glUniformMatrix4fv(location, count, transpose, value);
+	if (gl_trace.file) trace_call(TRACE_glUniformMatrix4fv, location, count, transpose, trace_blob(value, count * 16 * sizeof(GLfloat)));
+}
+
+GLboolean trace_glUnmapBuffer(GLenum target)
+{
+	GLboolean result = glUnmapBuffer(target);
+	if (gl_trace.file) trace_call(TRACE_glUnmapBuffer, target);
+	return result;
+}
+
+void trace_glUseProgram(GLuint program)
+{
+	glUseProgram(program);
+	if (gl_trace.file) trace_call(TRACE_glUseProgram, program);
+}
+
+void trace_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+{
+	glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+	// always an offset into the bound array buffer here
+	if (gl_trace.file) trace_call(TRACE_glVertexAttribPointer, index, size, type, normalized, stride, (u4)(uintptr_t)pointer);
+}
+
+void trace_glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	glViewport(x, y, width, height);
+	if (gl_trace.file) trace_call(TRACE_glViewport, x, y, width, height);
+}
+
+// from here on every call goes through the wrappers
+
+#undef glActiveTexture
+#define glActiveTexture trace_glActiveTexture
+#undef glAttachShader
+#define glAttachShader trace_glAttachShader
+#undef glBeginQuery
+#define glBeginQuery trace_glBeginQuery
+#undef glBindBuffer
+#define glBindBuffer trace_glBindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase trace_glBindBufferBase
+#undef glBindBufferRange
+#define glBindBufferRange trace_glBindBufferRange
+#undef glBindFramebuffer
+#define glBindFramebuffer trace_glBindFramebuffer
+#undef glBindRenderbuffer
+#define glBindRenderbuffer trace_glBindRenderbuffer
+#undef glBindTexture
+#define glBindTexture trace_glBindTexture
+#undef glBlendFunc
+#define glBlendFunc trace_glBlendFunc
+#undef glBlitFramebuffer
+#define glBlitFramebuffer trace_glBlitFramebuffer
+#undef glBufferData
+#define glBufferData trace_glBufferData
+#undef glBufferSubData
+#define glBufferSubData trace_glBufferSubData
+#undef glClear
+#define glClear trace_glClear
+#undef glClearColor
+#define glClearColor trace_glClearColor
+#undef glClientWaitSync
+#define glClientWaitSync trace_glClientWaitSync
+#undef glColorMask
+#define glColorMask trace_glColorMask
+#undef glCompileShader
+#define glCompileShader trace_glCompileShader
+#undef glCreateProgram
+#define glCreateProgram trace_glCreateProgram
+#undef glCreateShader
+#define glCreateShader trace_glCreateShader
+#undef glDeleteBuffers
+#define glDeleteBuffers trace_glDeleteBuffers
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers trace_glDeleteFramebuffers
+#undef glDeleteProgram
+#define glDeleteProgram trace_glDeleteProgram
+#undef glDeleteQueries
+#define glDeleteQueries trace_glDeleteQueries
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers trace_glDeleteRenderbuffers
+#undef glDeleteShader
+#define glDeleteShader trace_glDeleteShader
+#undef glDeleteSync
+#define glDeleteSync trace_glDeleteSync
+#undef glDeleteTextures
+#define glDeleteTextures trace_glDeleteTextures
+#undef glDepthFunc
+#define glDepthFunc trace_glDepthFunc
+#undef glDepthMask
+#define glDepthMask trace_glDepthMask
+#undef glDetachShader
+#define glDetachShader trace_glDetachShader
+#undef glDisable
+#define glDisable trace_glDisable
+#undef glDisableVertexAttribArray
+#define glDisableVertexAttribArray trace_glDisableVertexAttribArray
+#undef glDrawArrays
+#define glDrawArrays trace_glDrawArrays
+#undef glDrawElements
+#define glDrawElements trace_glDrawElements
+#undef glEnable
+#define glEnable trace_glEnable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray trace_glEnableVertexAttribArray
+#undef glEndQuery
+#define glEndQuery trace_glEndQuery
+#undef glFenceSync
+#define glFenceSync trace_glFenceSync
+#undef glFinish
+#define glFinish trace_glFinish
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer trace_glFramebufferRenderbuffer
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D trace_glFramebufferTexture2D
+#undef glGenBuffers
+#define glGenBuffers trace_glGenBuffers
+#undef glGenFramebuffers
+#define glGenFramebuffers trace_glGenFramebuffers
+#undef glGenQueries
+#define glGenQueries trace_glGenQueries
+#undef glGenRenderbuffers
+#define glGenRenderbuffers trace_glGenRenderbuffers
+#undef glGenTextures
+#define glGenTextures trace_glGenTextures
+#undef glGetAttribLocation
+#define glGetAttribLocation trace_glGetAttribLocation
+#undef glGetQueryObjectuiv
+#define glGetQueryObjectuiv trace_glGetQueryObjectuiv
+#undef glGetUniformBlockIndex
+#define glGetUniformBlockIndex trace_glGetUniformBlockIndex
+#undef glGetUniformLocation
+#define glGetUniformLocation trace_glGetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram trace_glLinkProgram
+#undef glMapBuffer
+#define glMapBuffer trace_glMapBuffer
+#undef glPixelStorei
+#define glPixelStorei trace_glPixelStorei
+#undef glReadPixels
+#define glReadPixels trace_glReadPixels
+#undef glRenderbufferStorage
+#define glRenderbufferStorage trace_glRenderbufferStorage
+#undef glRenderbufferStorageMultisample
+#define glRenderbufferStorageMultisample trace_glRenderbufferStorageMultisample
+#undef glScissor
+#define glScissor trace_glScissor
+#undef glShaderSource
+#define glShaderSource trace_glShaderSource
+#undef glTexBuffer
+#define glTexBuffer trace_glTexBuffer
+#undef glTexImage2D
+#define glTexImage2D trace_glTexImage2D
+#undef glTexParameteri
+#define glTexParameteri trace_glTexParameteri
+#undef glUniform1f
+#define glUniform1f trace_glUniform1f
+#undef glUniform1i
+#define glUniform1i trace_glUniform1i
+#undef glUniform3f
+#define glUniform3f trace_glUniform3f
+#undef glUniform4fv
+#define glUniform4fv trace_glUniform4fv
+#undef glUniformBlockBinding
+#define glUniformBlockBinding trace_glUniformBlockBinding
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv trace_glUniformMatrix4fv
+#undef glUnmapBuffer
+#define glUnmapBuffer trace_glUnmapBuffer
+#undef glUseProgram
+#define glUseProgram trace_glUseProgram
+#undef glVertexAttribPointer
+#define glVertexAttribPointer trace_glVertexAttribPointer
+#undef glViewport
+#define glViewport trace_glViewport
+
+#endif // GL_TRACE_REPLAY
@@ -58,6 +58,7 @@ struct BASIC_TEXTURE_SHADER {
 	gi uniform_proj;
 	gi uniform_scale;
 	gi uniform_tex_source;
+	gi uniform_material; // plain uniform fallback only, see uniform_blocks.cpp
 	gi attribute_coord3d;
 	gi attribute_tex_coord2d;
 } basic_texture;
@@ -68,6 +69,7 @@ struct COLOR_VERTS_SHADER {
 	gi uniform_view;
 	gi uniform_proj;
 	gi uniform_scale;
+	gi uniform_material;
 	gi attribute_coord3d;
 	gi attribute_v_color;
 } color_verts;
@@ -82,19 +84,51 @@ struct OFFSCREEN_SHADER {
 	gi attribute_coord3d;
 } offscreen;
 
+struct POINT_SPRITE_SHADER {
+	gu program;
+	gi uniform_model;
+	gi uniform_view;
+	gi uniform_proj;
+	gi uniform_scale;
+	gi uniform_viewport_height;
+	gi attribute_coord3d;
+	gi attribute_point_size;
+	gi attribute_point_color;
+} point_sprite;
+
+#define MAX_LODS 4
+
 struct PRIMITIVE
 {
 	gu verts;
 	gu colors;
 	gu indices;
 	gu uv_coords;
+	// CPU copies of the static arrays in create_*(), used to build LODs
+	const GLfloat* cpu_verts;
+	const GLfloat* cpu_colors;
+	const GLfloat* cpu_uvs;
+	const GLushort* cpu_indices;
+	s4 vertex_count;
+	s4 index_count;
+	f4 radius; // bounding sphere around the model origin
+	// level 0 is indices, higher levels are simplified index buffers
+	// over the same vertex buffers
+	s4 lod_count;
+	gu lod_indices[MAX_LODS];
+	s4 lod_index_count[MAX_LODS];
+	// CPU copies of the levels, level 0 is cpu_indices. A reload after
+	// eviction uploads these instead of simplifying again
+	const GLushort* cpu_lod_indices[MAX_LODS];
+	b4 owns_cpu_lods; // malloc'd by create_mesh_lods(), not in a snapshot
 } plane, cube, pyramid; 
 
 struct SGL
 {
-	SDL_Window* window;
+	SDL_Window* window; // 0 when rendering headless in software
 	s4 width;
 	s4 height;
+	b4 software; // CPU rasterizer instead of OpenGL, see soft_raster.cpp
 } sgl;
 
 struct IMAGE {
@@ -104,8 +138,33 @@ struct IMAGE {
 	int n;
 } image_2, image_apple;
 
-gu texture_2;
-gu texture_apple;
+#define MAX_OBJECTS 256
+
+struct RENDER_OBJECT
+{
+	PRIMITIVE* mesh;
+	u4 mesh_resource;    // RESOURCE_HANDLE, 0 when not managed (software)
+	u4 texture_resource; // RESOURCE_HANDLE, 0 for untextured objects
+	gu texture; // resolved from texture_resource each frame, 0 draws with color_verts
+	s4 material; // index from create_material()
+	IMAGE* image; // pixels behind texture, for the software rasterizer
+	glm::vec3 position;
+	s4 lod; // level drawn last frame, kept for hysteresis
+	b4 occluder; // large opaque object drawn in the depth pre-pass
+};
+
+RENDER_OBJECT objects[MAX_OBJECTS];
+s4 object_count;
+
+struct RENDER_STATS
+{
+	s4 draws;
+	s4 triangles;
+	s4 culled;
+	f4 resolution_scale; // of the window the scene is drawn at, see dynamic_resolution.cpp
+	f4 gpu_ms;           // smoothed GPU frame time, 0 when not measured
+	s4 particles;
+} stats;
 
 gu offscreen_texture;
 gu FBO;
@@ -93,6 +93,13 @@ inline void poll_events()
 				default: {} break;
 			}
 		} 
+		else if( e.type == SDL_WINDOWEVENT )
+		{
+			if ( e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED )
+			{
+				onResize(e.window.data1, e.window.data2);
+			}
+		}
 		else if( e.type == SDL_QUIT )
 		{
 			input.quit_app = true;
@@ -0,0 +1,441 @@
+/*
+	Clustered forward lighting.
+
+	The view frustum is cut into a LIGHT_CLUSTER_X x LIGHT_CLUSTER_Y grid of
+	screen tiles and LIGHT_CLUSTER_Z depth slices. Slices are spaced
+	exponentially between the near and far planes, so clusters stay
+	roughly cube shaped at every distance. Each frame update_light_clusters()
+	moves the lights into view space and bins every light into the clusters
+	its bounding sphere touches. Only the slices between the sphere's
+	nearest and farthest depth are tested. Within a slice 8 cluster boxes
+	are tested at once with AVX2 when the CPU has it.
+
+	The result goes to the GPU through three texture buffers:
+
+		light_data     RGBA32F  LIGHT_HEADER_TEXELS header texels, then 3 per light
+		light_grid     RG32F    per cluster: first index, light count
+		light_indices  R32F     light numbers, grouped by cluster
+
+	A fragment of a SHADER_LIGHTS variant finds its cluster from
+	gl_FragCoord and its view space depth and loops over that cluster's
+	lights only. Shading cost follows the lights per cluster, not the
+	number of lights in the scene. The grid size and depth mapping are in
+	the header, so programs only need their sampler units set once.
+
+	Surfaces have no normals, the shader derives a flat one from the
+	screen space derivatives of the view space position. The lighting is
+	color * (ambient + sum of diffuse). With no lights and an ambient of 1
+	(the default) every variant draws exactly what it did unlit.
+
+	Texture buffers and texelFetchBuffer() need GL 3.1 and
+	EXT_gpu_shader4. Without them SHADER_LIGHTS is left out of every
+	variant and the scene is drawn unlit. The software rasterizer is unlit.
+*/
+#include <immintrin.h>
+
+#define MAX_LIGHTS 4096
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define LIGHT_CLUSTER_TILES (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y) // multiple of 8
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_TILES * LIGHT_CLUSTER_Z)
+#define LIGHT_HEADER_TEXELS 4
+#define LIGHT_TEXELS 3
+#define LIGHT_MAX_INDICES (1 << 20)
+#define LIGHT_DATA_UNIT 1
+#define LIGHT_GRID_UNIT 2
+#define LIGHT_INDEX_UNIT 3
+
+enum LIGHT_TYPE
+{
+	LIGHT_POINT,
+	LIGHT_SPOT,
+};
+
+struct LIGHT
+{
+	s4 type;
+	glm::vec3 position;
+	glm::vec3 direction; // spot lights, normalized
+	glm::vec3 color;
+	f4 range;     // no light past this distance
+	f4 cos_inner; // spot lights, full intensity inside this cone
+	f4 cos_outer; // spot lights, none outside this cone
+};
+
+// view space boxes of one depth slice, one array per bound so 8 tiles load at once
+struct LIGHT_SLICE
+{
+	f4 min_x[LIGHT_CLUSTER_TILES];
+	f4 max_x[LIGHT_CLUSTER_TILES];
+	f4 min_y[LIGHT_CLUSTER_TILES];
+	f4 max_y[LIGHT_CLUSTER_TILES];
+	f4 min_z;
+	f4 max_z;
+};
+
+struct LIGHTING
+{
+	b4 enabled;
+	b4 use_avx2;
+	LIGHT lights[MAX_LIGHTS];
+	s4 light_count;
+	glm::vec3 ambient;
+
+	// cluster boxes, rebuilt when the projection or viewport changes
+	LIGHT_SLICE slices[LIGHT_CLUSTER_Z];
+	glm::mat4 cluster_projection;
+	s4 cluster_width;
+	s4 cluster_height;
+	f4 near;
+	f4 far;
+	f4 z_scale; // slice = log(depth) * z_scale + z_bias
+	f4 z_bias;
+
+	// CPU side of the texture buffers
+	f4* data;
+	f4 grid[LIGHT_CLUSTER_COUNT * 2];
+	u4* pairs; // cluster << 16 | light, one per hit
+	f4* indices;
+	u4 counts[LIGHT_CLUSTER_COUNT];
+	s4 max_indices;
+	s4 index_count;
+	b4 warned_overflow;
+
+	gu buffers[3];
+	gu textures[3];
+} lighting;
+
+/*
+	Decide whether variants are lit. Call before any shader variant is
+	compiled.
+*/
+void init_lighting()
+{
+	lighting.enabled = false;
+	lighting.light_count = 0;
+	lighting.ambient = glm::vec3(1.0f, 1.0f, 1.0f);
+	lighting.cluster_width = 0;
+	lighting.use_avx2 = SDL_HasAVX2();
+
+	int profile;
+	SDL_GL_GetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, &profile);
+	if (profile == SDL_GL_CONTEXT_PROFILE_ES || !GLEW_VERSION_3_1 || !GLEW_EXT_gpu_shader4)
+	{
+		cout << "lighting: off, needs GL 3.1 and EXT_gpu_shader4" << endl;
+		return;
+	}
+
+	GLint max_texels = 65536;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	lighting.max_indices = max_texels < LIGHT_MAX_INDICES ? max_texels : LIGHT_MAX_INDICES;
+	lighting.data = (f4*)malloc((LIGHT_HEADER_TEXELS + MAX_LIGHTS * LIGHT_TEXELS) * 4 * sizeof(f4));
+	lighting.pairs = (u4*)malloc(lighting.max_indices * sizeof(u4));
+	lighting.indices = (f4*)malloc(lighting.max_indices * sizeof(f4));
+
+	const GLenum formats[3] = { GL_RGBA32F, GL_RG32F, GL_R32F };
+	const s4 units[3] = { LIGHT_DATA_UNIT, LIGHT_GRID_UNIT, LIGHT_INDEX_UNIT };
+	glGenBuffers(3, lighting.buffers);
+	glGenTextures(3, lighting.textures);
+	for (s4 i = 0; i < 3; i++)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, lighting.buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, 0, GL_STREAM_DRAW);
+		// nothing else uses these units, the buffers stay bound for good
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, lighting.textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], lighting.buffers[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	lighting.enabled = true;
+	cout << "lighting: " << LIGHT_CLUSTER_X << "x" << LIGHT_CLUSTER_Y << "x" << LIGHT_CLUSTER_Z
+		 << " clusters, " << (lighting.use_avx2 ? "AVX2" : "scalar") << " binning" << endl;
+}
+
+void destroy_lighting()
+{
+	if (!lighting.enabled) return;
+	glDeleteTextures(3, lighting.textures);
+	glDeleteBuffers(3, lighting.buffers);
+	free(lighting.data);
+	free(lighting.pairs);
+	free(lighting.indices);
+	lighting.data = 0;
+	lighting.pairs = 0;
+	lighting.indices = 0;
+	lighting.enabled = false;
+}
+
+/*
+	Point a freshly linked program's light samplers at their units.
+*/
+void bind_program_lights(GLuint program)
+{
+	if (!lighting.enabled) return;
+	gi data = glGetUniformLocation(program, "light_data");
+	if (data < 0) return;
+	GLint current = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+	glUseProgram(program);
+	glUniform1i(data, LIGHT_DATA_UNIT);
+	glUniform1i(glGetUniformLocation(program, "light_grid"), LIGHT_GRID_UNIT);
+	glUniform1i(glGetUniformLocation(program, "light_indices"), LIGHT_INDEX_UNIT);
+	glUseProgram(current);
+}
+
+s4 add_point_light(glm::vec3 position, f4 range, glm::vec3 color)
+{
+	if (lighting.light_count >= MAX_LIGHTS) return -1;
+	LIGHT &l = lighting.lights[lighting.light_count];
+	l.type = LIGHT_POINT;
+	l.position = position;
+	l.direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	l.color = color;
+	l.range = range;
+	l.cos_inner = 1.0f;
+	l.cos_outer = -1.0f;
+	return lighting.light_count++;
+}
+
+/*
+	Spot light at position shining along direction. Angles are the half
+	angles of the cones in degrees.
+*/
+s4 add_spot_light(glm::vec3 position, glm::vec3 direction, f4 range, glm::vec3 color, f4 inner_degrees, f4 outer_degrees)
+{
+	if (lighting.light_count >= MAX_LIGHTS) return -1;
+	LIGHT &l = lighting.lights[lighting.light_count];
+	l.type = LIGHT_SPOT;
+	l.position = position;
+	l.direction = glm::normalize(direction);
+	l.color = color;
+	l.range = range;
+	l.cos_inner = cosf(glm::radians(inner_degrees));
+	l.cos_outer = cosf(glm::radians(outer_degrees));
+	return lighting.light_count++;
+}
+
+void clear_lights()
+{
+	lighting.light_count = 0;
+}
+
+/*
+	View space boxes of every cluster for a symmetric perspective
+	projection.
+*/
+void build_light_clusters(const glm::mat4 &projection, s4 width, s4 height)
+{
+	// glm::perspective: P[2][2] = -(f+n)/(f-n), P[3][2] = -2fn/(f-n)
+	f4 a = projection[2][2];
+	f4 b = projection[3][2];
+	lighting.near = b / (a - 1.0f);
+	lighting.far = b / (a + 1.0f);
+	f4 log_ratio = logf(lighting.far / lighting.near);
+	lighting.z_scale = LIGHT_CLUSTER_Z / log_ratio;
+	lighting.z_bias = -LIGHT_CLUSTER_Z * logf(lighting.near) / log_ratio;
+
+	f4 inv_px = 1.0f / projection[0][0];
+	f4 inv_py = 1.0f / projection[1][1];
+	for (s4 z = 0; z < LIGHT_CLUSTER_Z; z++)
+	{
+		LIGHT_SLICE &s = lighting.slices[z];
+		f4 d0 = lighting.near * powf(lighting.far / lighting.near, (f4)z / LIGHT_CLUSTER_Z);
+		f4 d1 = lighting.near * powf(lighting.far / lighting.near, (f4)(z + 1) / LIGHT_CLUSTER_Z);
+		s.min_z = -d1;
+		s.max_z = -d0;
+		for (s4 y = 0; y < LIGHT_CLUSTER_Y; y++)
+		{
+			f4 ndc_y0 = -1.0f + 2.0f * y / LIGHT_CLUSTER_Y;
+			f4 ndc_y1 = -1.0f + 2.0f * (y + 1) / LIGHT_CLUSTER_Y;
+			for (s4 x = 0; x < LIGHT_CLUSTER_X; x++)
+			{
+				f4 ndc_x0 = -1.0f + 2.0f * x / LIGHT_CLUSTER_X;
+				f4 ndc_x1 = -1.0f + 2.0f * (x + 1) / LIGHT_CLUSTER_X;
+				// the tile's side planes spread with depth, the box spans both ends
+				s4 t = y * LIGHT_CLUSTER_X + x;
+				s.min_x[t] = fminf(ndc_x0 * d0, ndc_x0 * d1) * inv_px;
+				s.max_x[t] = fmaxf(ndc_x1 * d0, ndc_x1 * d1) * inv_px;
+				s.min_y[t] = fminf(ndc_y0 * d0, ndc_y0 * d1) * inv_py;
+				s.max_y[t] = fmaxf(ndc_y1 * d0, ndc_y1 * d1) * inv_py;
+			}
+		}
+	}
+	lighting.cluster_projection = projection;
+	lighting.cluster_width = width;
+	lighting.cluster_height = height;
+}
+
+/*
+	Bit per tile in [first, first + 8) of slice whose box the sphere
+	touches, the scalar twin of light_test_tiles_avx2().
+*/
+u4 light_test_tiles(const LIGHT_SLICE &s, s4 first, glm::vec3 c, f4 r2, f4 dz2)
+{
+	u4 mask = 0;
+	for (s4 i = 0; i < 8; i++)
+	{
+		f4 dx = fmaxf(fmaxf(s.min_x[first + i] - c.x, c.x - s.max_x[first + i]), 0.0f);
+		f4 dy = fmaxf(fmaxf(s.min_y[first + i] - c.y, c.y - s.max_y[first + i]), 0.0f);
+		if (dx * dx + dy * dy + dz2 <= r2) mask |= 1u << i;
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+u4 light_test_tiles_avx2(const LIGHT_SLICE &s, s4 first, glm::vec3 c, f4 r2, f4 dz2)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 cx = _mm256_set1_ps(c.x);
+	const __m256 cy = _mm256_set1_ps(c.y);
+	__m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(s.min_x + first), cx),
+		_mm256_sub_ps(cx, _mm256_loadu_ps(s.max_x + first))), zero);
+	__m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(s.min_y + first), cy),
+		_mm256_sub_ps(cy, _mm256_loadu_ps(s.max_y + first))), zero);
+	__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_set1_ps(dz2));
+	return (u4)_mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_set1_ps(r2), _CMP_LE_OQ));
+}
+
+inline s4 light_slice(f4 depth)
+{
+	s4 z = (s4)(logf(depth) * lighting.z_scale + lighting.z_bias);
+	return z < 0 ? 0 : (z >= LIGHT_CLUSTER_Z ? LIGHT_CLUSTER_Z - 1 : z);
+}
+
+/*
+	Add a (cluster, light) pair for every cluster the view space sphere
+	touches.
+*/
+void bin_light(s4 light, glm::vec3 center, f4 radius)
+{
+	f4 d0 = -center.z - radius;
+	f4 d1 = -center.z + radius;
+	if (d1 < lighting.near || d0 > lighting.far) return;
+	s4 z0 = light_slice(fmaxf(d0, lighting.near));
+	s4 z1 = light_slice(fminf(d1, lighting.far));
+	f4 r2 = radius * radius;
+	for (s4 z = z0; z <= z1; z++)
+	{
+		const LIGHT_SLICE &s = lighting.slices[z];
+		f4 dz = fmaxf(fmaxf(s.min_z - center.z, center.z - s.max_z), 0.0f);
+		f4 dz2 = dz * dz;
+		if (dz2 > r2) continue;
+		for (s4 first = 0; first < LIGHT_CLUSTER_TILES; first += 8)
+		{
+			u4 mask = lighting.use_avx2 ? light_test_tiles_avx2(s, first, center, r2, dz2)
+										: light_test_tiles(s, first, center, r2, dz2);
+			while (mask)
+			{
+				s4 bit = __builtin_ctz(mask);
+				mask &= mask - 1;
+				if (lighting.index_count >= lighting.max_indices)
+				{
+					if (!lighting.warned_overflow)
+					{
+						cerr << "WARNING: more than " << lighting.max_indices << " light cluster entries, lights dropped" << endl;
+						lighting.warned_overflow = true;
+					}
+					return;
+				}
+				u4 cluster = z * LIGHT_CLUSTER_TILES + first + bit;
+				lighting.pairs[lighting.index_count++] = (cluster << 16) | (u4)light;
+			}
+		}
+	}
+}
+
+/*
+	Bin the lights for a camera drawing into the viewport at x, y and
+	upload the texture buffers. Call before drawing lit variants, once per
+	frame or once per view when several share a framebuffer.
+*/
+void update_light_clusters(const glm::mat4 &view, const glm::mat4 &projection, s4 x, s4 y, s4 width, s4 height)
+{
+	if (!lighting.enabled) return;
+	if (projection != lighting.cluster_projection || width != lighting.cluster_width || height != lighting.cluster_height)
+	{
+		build_light_clusters(projection, width, height);
+	}
+
+	f4* header = lighting.data;
+	header[0] = lighting.ambient.x;
+	header[1] = lighting.ambient.y;
+	header[2] = lighting.ambient.z;
+	header[3] = 0.0f;
+	header[4] = (f4)LIGHT_CLUSTER_X / width;
+	header[5] = (f4)LIGHT_CLUSTER_Y / height;
+	header[6] = lighting.z_scale;
+	header[7] = lighting.z_bias;
+	header[8] = LIGHT_CLUSTER_X;
+	header[9] = LIGHT_CLUSTER_Y;
+	header[10] = LIGHT_CLUSTER_Z;
+	header[11] = 0.0f;
+	header[12] = (f4)x; // gl_FragCoord is relative to the window, not the viewport
+	header[13] = (f4)y;
+	header[14] = 0.0f;
+	header[15] = 0.0f;
+
+	lighting.index_count = 0;
+	for (s4 i = 0; i < lighting.light_count; i++)
+	{
+		const LIGHT &l = lighting.lights[i];
+		glm::vec3 position = glm::vec3(view * glm::vec4(l.position, 1.0f));
+		glm::vec3 direction = glm::vec3(view * glm::vec4(l.direction, 0.0f));
+		f4* texel = lighting.data + (LIGHT_HEADER_TEXELS + i * LIGHT_TEXELS) * 4;
+		texel[0] = position.x; texel[1] = position.y; texel[2] = position.z; texel[3] = l.range;
+		texel[4] = l.color.x;  texel[5] = l.color.y;  texel[6] = l.color.z;  texel[7] = l.cos_inner;
+		texel[8] = direction.x; texel[9] = direction.y; texel[10] = direction.z; texel[11] = l.cos_outer;
+
+		glm::vec3 center = position;
+		f4 radius = l.range;
+		if (l.type == LIGHT_SPOT)
+		{
+			// smallest sphere around the cone
+			f4 sin_outer = sqrtf(fmaxf(1.0f - l.cos_outer * l.cos_outer, 0.0f));
+			if (l.cos_outer < 0.70710678f)
+			{
+				center = position + direction * (l.range * l.cos_outer);
+				radius = l.range * sin_outer;
+			}
+			else
+			{
+				radius = l.range / (2.0f * l.cos_outer);
+				center = position + direction * radius;
+			}
+		}
+		bin_light(i, center, radius);
+	}
+
+	// counting sort by cluster, lights stay in order within a cluster
+	memset(lighting.counts, 0, sizeof(lighting.counts));
+	for (s4 i = 0; i < lighting.index_count; i++)
+	{
+		lighting.counts[lighting.pairs[i] >> 16]++;
+	}
+	u4 offset = 0;
+	for (s4 c = 0; c < LIGHT_CLUSTER_COUNT; c++)
+	{
+		lighting.grid[c * 2 + 0] = (f4)offset;
+		lighting.grid[c * 2 + 1] = (f4)lighting.counts[c];
+		u4 count = lighting.counts[c];
+		lighting.counts[c] = offset;
+		offset += count;
+	}
+	for (s4 i = 0; i < lighting.index_count; i++)
+	{
+		u4 pair = lighting.pairs[i];
+		lighting.indices[lighting.counts[pair >> 16]++] = (f4)(pair & 0xFFFF);
+	}
+
+	// orphan and refill, the GPU may still be reading last frame's lists
+	s4 index_count = lighting.index_count ? lighting.index_count : 1;
+	glBindBuffer(GL_TEXTURE_BUFFER, lighting.buffers[0]);
+	glBufferData(GL_TEXTURE_BUFFER, (LIGHT_HEADER_TEXELS + lighting.light_count * LIGHT_TEXELS) * 4 * sizeof(f4),
+		lighting.data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, lighting.buffers[1]);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(lighting.grid), lighting.grid, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, lighting.buffers[2]);
+	glBufferData(GL_TEXTURE_BUFFER, index_count * sizeof(f4), lighting.indices, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,352 @@
+/*
+	Level of detail.
+
+	create_mesh_lods() builds up to MAX_LODS-1 simplified index buffers for a
+	PRIMITIVE using quadric error half-edge collapse: a vertex is always
+	collapsed onto one of its neighbours, so every level indexes the same
+	vertex, color and uv buffers and only needs its own index buffer.
+	Vertices sharing a position with another vertex (uv or color seams) are
+	locked so levels never open cracks between islands.
+
+	The levels are kept on the CPU next to the mesh's other static arrays.
+	Eviction only drops the GL buffers (unload_mesh_lods()) and a reload
+	uploads the kept levels again (upload_mesh_lods()), so simplification
+	runs once per mesh, or never for meshes from a scene snapshot.
+
+	select_lod() picks a level per object from its projected height in
+	pixels. The thresholds have a hysteresis band so an object sitting on a
+	boundary does not pop back and forth every frame.
+*/
+
+// fraction of the base triangle count each level aims for
+const f4 LOD_TRIANGLE_RATIO[MAX_LODS] = { 1.0f, 0.5f, 0.25f, 0.125f };
+// allowed collapse error per level, as a fraction of the mesh radius
+const f4 LOD_ERROR_TOLERANCE[MAX_LODS] = { 0.0f, 0.02f, 0.05f, 0.1f };
+// projected height in pixels under which level i+1 is drawn instead of i
+const f4 LOD_PIXEL_THRESHOLD[MAX_LODS-1] = { 240.0f, 120.0f, 48.0f };
+#define LOD_HYSTERESIS 0.15f
+
+struct QUADRIC
+{
+	// symmetric 4x4: aa ab ac ad bb bc bd cc cd dd
+	f8 m[10];
+};
+
+void quadric_add_plane(QUADRIC &q, f8 a, f8 b, f8 c, f8 d)
+{
+	q.m[0] += a*a; q.m[1] += a*b; q.m[2] += a*c; q.m[3] += a*d;
+	q.m[4] += b*b; q.m[5] += b*c; q.m[6] += b*d;
+	q.m[7] += c*c; q.m[8] += c*d;
+	q.m[9] += d*d;
+}
+
+f8 quadric_error(const QUADRIC &q0, const QUADRIC &q1, const f4* p)
+{
+	f8 m[10];
+	for (s4 i = 0; i < 10; i++) m[i] = q0.m[i] + q1.m[i];
+	f8 x = p[0], y = p[1], z = p[2];
+	return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x
+		+ m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y
+		+ m[7]*z*z + 2*m[8]*z
+		+ m[9];
+}
+
+inline glm::vec3 mesh_vertex(const f4* verts, s4 i)
+{
+	return glm::vec3(verts[i*3+0], verts[i*3+1], verts[i*3+2]);
+}
+
+struct LOD_COLLAPSE
+{
+	f8 cost;
+	u2 from;
+	u2 to;
+	bool operator<(const LOD_COLLAPSE &o) const { return cost < o.cost; }
+};
+
+/*
+	Collapse edges cheapest first until the mesh has at most
+	target_index_count indices or every remaining collapse costs more than
+	max_error. Writes the surviving triangles to out and returns the
+	number of indices written.
+*/
+s4 simplify_mesh(const f4* verts, s4 vertex_count, const u2* indices, s4 index_count,
+				 s4 target_index_count, f8 max_error, u2* out)
+{
+	s4 tri_count = index_count / 3;
+	std::vector<u2> tris(indices, indices + index_count);
+	std::vector<u1> dead(tri_count, 0);
+	std::vector<QUADRIC> quadrics(vertex_count);
+	std::vector<u1> locked(vertex_count, 0);
+	for (s4 i = 0; i < vertex_count; i++)
+	{
+		for (s4 k = 0; k < 10; k++) quadrics[i].m[k] = 0.0;
+	}
+
+	// lock seam vertices: sort by position and look for equal neighbours
+	std::vector<s4> order(vertex_count);
+	for (s4 i = 0; i < vertex_count; i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [verts](s4 a, s4 b) {
+		for (s4 c = 0; c < 3; c++)
+		{
+			if (verts[a*3+c] != verts[b*3+c]) return verts[a*3+c] < verts[b*3+c];
+		}
+		return false;
+	});
+	for (s4 i = 1; i < vertex_count; i++)
+	{
+		s4 a = order[i-1], b = order[i];
+		if (verts[a*3+0] == verts[b*3+0] && verts[a*3+1] == verts[b*3+1] && verts[a*3+2] == verts[b*3+2])
+		{
+			locked[a] = locked[b] = 1;
+		}
+	}
+
+	// face planes, plus a perpendicular plane along each open border edge so
+	// borders keep their shape
+	// edge key in the high bits, owning triangle in the low bits
+	std::vector<u8> edges;
+	for (s4 t = 0; t < tri_count; t++)
+	{
+		u2* v = &tris[t*3];
+		glm::vec3 p0 = mesh_vertex(verts, v[0]);
+		glm::vec3 p1 = mesh_vertex(verts, v[1]);
+		glm::vec3 p2 = mesh_vertex(verts, v[2]);
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		f4 len = glm::length(n);
+		if (len == 0.0f) continue;
+		n = n / len;
+		f8 d = -glm::dot(n, p0);
+		for (s4 k = 0; k < 3; k++)
+		{
+			quadric_add_plane(quadrics[v[k]], n.x, n.y, n.z, d);
+			u2 a = v[k], b = v[(k+1)%3];
+			u8 key = a < b ? ((u4)a << 16) | b : ((u4)b << 16) | a;
+			edges.push_back((key << 32) | (u4)t);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); )
+	{
+		size_t j = i + 1;
+		while (j < edges.size() && (edges[j] >> 32) == (edges[i] >> 32)) j++;
+		if (j - i == 1)
+		{
+			u2 a = (u2)(edges[i] >> 48), b = (u2)(edges[i] >> 32);
+			u2* v = &tris[(edges[i] & 0xFFFFFFFF)*3];
+			glm::vec3 pa = mesh_vertex(verts, a);
+			glm::vec3 pb = mesh_vertex(verts, b);
+			glm::vec3 face = glm::cross(mesh_vertex(verts, v[1]) - mesh_vertex(verts, v[0]),
+										mesh_vertex(verts, v[2]) - mesh_vertex(verts, v[0]));
+			glm::vec3 n = glm::cross(pb - pa, face);
+			f4 len = glm::length(n);
+			if (len > 0.0f)
+			{
+				n = n / len;
+				f8 d = -glm::dot(n, pa);
+				// weighted so sliding along a border costs like a real crease
+				for (s4 w = 0; w < 4; w++)
+				{
+					quadric_add_plane(quadrics[a], n.x, n.y, n.z, d);
+					quadric_add_plane(quadrics[b], n.x, n.y, n.z, d);
+				}
+			}
+		}
+		i = j;
+	}
+
+	s4 live = tri_count;
+	s4 target_tris = target_index_count / 3;
+	std::vector<std::vector<s4> > vertex_tris(vertex_count);
+	std::vector<LOD_COLLAPSE> candidates;
+	std::vector<u1> touched(vertex_count);
+
+	// each pass collapses a set of independent edges, then rebuilds costs
+	while (live > target_tris)
+	{
+		for (s4 i = 0; i < vertex_count; i++) vertex_tris[i].clear();
+		candidates.clear();
+		for (s4 t = 0; t < tri_count; t++)
+		{
+			if (dead[t]) continue;
+			u2* v = &tris[t*3];
+			for (s4 k = 0; k < 3; k++)
+			{
+				vertex_tris[v[k]].push_back(t);
+				u2 a = v[k], b = v[(k+1)%3];
+				if (!locked[a]) { LOD_COLLAPSE c = { quadric_error(quadrics[a], quadrics[b], &verts[b*3]), a, b }; candidates.push_back(c); }
+				if (!locked[b]) { LOD_COLLAPSE c = { quadric_error(quadrics[a], quadrics[b], &verts[a*3]), b, a }; candidates.push_back(c); }
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+		std::fill(touched.begin(), touched.end(), 0);
+
+		s4 collapsed = 0;
+		for (size_t i = 0; i < candidates.size() && live > target_tris; i++)
+		{
+			LOD_COLLAPSE &c = candidates[i];
+			if (c.cost > max_error) break;
+			if (touched[c.from] || touched[c.to]) continue;
+
+			// reject collapses that would flip a surviving triangle
+			b4 flips = false;
+			glm::vec3 pto = mesh_vertex(verts, c.to);
+			for (size_t k = 0; k < vertex_tris[c.from].size() && !flips; k++)
+			{
+				u2* v = &tris[vertex_tris[c.from][k]*3];
+				if (v[0] == c.to || v[1] == c.to || v[2] == c.to) continue;
+				glm::vec3 p[3], q[3];
+				for (s4 j = 0; j < 3; j++)
+				{
+					p[j] = mesh_vertex(verts, v[j]);
+					q[j] = v[j] == c.from ? pto : p[j];
+				}
+				glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(n0, n1) <= 0.0f) flips = true;
+			}
+			if (flips) continue;
+
+			for (size_t k = 0; k < vertex_tris[c.from].size(); k++)
+			{
+				s4 t = vertex_tris[c.from][k];
+				u2* v = &tris[t*3];
+				for (s4 j = 0; j < 3; j++)
+				{
+					touched[v[j]] = 1;
+					if (v[j] == c.from) v[j] = c.to;
+				}
+				if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+				{
+					dead[t] = 1;
+					live--;
+				}
+			}
+			for (s4 k = 0; k < 10; k++) quadrics[c.to].m[k] += quadrics[c.from].m[k];
+			touched[c.to] = 1;
+			collapsed++;
+		}
+		if (collapsed == 0) break;
+	}
+
+	s4 count = 0;
+	for (s4 t = 0; t < tri_count; t++)
+	{
+		if (dead[t]) continue;
+		out[count++] = tris[t*3+0];
+		out[count++] = tris[t*3+1];
+		out[count++] = tris[t*3+2];
+	}
+	return count;
+}
+
+/*
+	Create the index buffers of levels 1 and up from their CPU copies.
+	Level 0 is the primitive's own index buffer. Does nothing on the
+	software rasterizer, like upload_primitive().
+*/
+void upload_mesh_lods(PRIMITIVE &p)
+{
+	p.lod_indices[0] = p.indices;
+	if (sgl.software) return;
+	for (s4 level = 1; level < p.lod_count; level++)
+	{
+		glGenBuffers(1, &p.lod_indices[level]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.lod_indices[level]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, p.lod_index_count[level] * sizeof(GLushort),
+			p.cpu_lod_indices[level], GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/*
+	Drop the GL buffers of levels 1 and up, keeping the CPU copies for
+	upload_mesh_lods().
+*/
+void unload_mesh_lods(PRIMITIVE &p)
+{
+	// level 0 is the base index buffer, owned by the primitive
+	for (s4 level = 1; level < p.lod_count; level++)
+	{
+		if (p.lod_indices[level]) glDeleteBuffers(1, &p.lod_indices[level]);
+		p.lod_indices[level] = 0;
+	}
+}
+
+void destroy_mesh_lods(PRIMITIVE &p)
+{
+	unload_mesh_lods(p);
+	for (s4 level = 1; level < p.lod_count && p.owns_cpu_lods; level++)
+	{
+		free((void*)p.cpu_lod_indices[level]);
+	}
+	for (s4 level = 1; level < MAX_LODS; level++)
+	{
+		p.cpu_lod_indices[level] = 0;
+	}
+	p.owns_cpu_lods = false;
+	p.lod_count = 1;
+}
+
+/*
+	Call after set_primitive_cpu_data() and upload_primitive(). Stops early
+	once a level no longer removes triangles, so lod_count can be lower
+	than MAX_LODS.
+*/
+void create_mesh_lods(PRIMITIVE &p)
+{
+	destroy_mesh_lods(p);
+	p.lod_indices[0] = p.indices;
+	p.lod_index_count[0] = p.index_count;
+	p.cpu_lod_indices[0] = p.cpu_indices;
+	if (!p.cpu_verts || !p.cpu_indices) return;
+
+	u2* scratch = (u2*)malloc(p.index_count * sizeof(u2));
+	p.owns_cpu_lods = true;
+	for (s4 level = 1; level < MAX_LODS; level++)
+	{
+		s4 target = (s4)(p.index_count / 3 * LOD_TRIANGLE_RATIO[level]) * 3;
+		f8 tolerance = LOD_ERROR_TOLERANCE[level] * p.radius;
+		s4 count = simplify_mesh(p.cpu_verts, p.vertex_count, p.cpu_indices, p.index_count,
+			target, tolerance * tolerance, scratch);
+		if (count == 0 || count >= p.lod_index_count[p.lod_count-1]) break;
+
+		u2* indices = (u2*)malloc(count * sizeof(u2));
+		memcpy(indices, scratch, count * sizeof(u2));
+		p.cpu_lod_indices[p.lod_count] = indices;
+		p.lod_index_count[p.lod_count] = count;
+		p.lod_count++;
+	}
+	free(scratch);
+	upload_mesh_lods(p);
+}
+
+/*
+	Update o.lod from the object's projected size. scale is the same
+	per-axis scale passed to the vertex shaders.
+*/
+void select_lod(RENDER_OBJECT &o, const glm::mat4 &view, const glm::mat4 &projection, vec3 scale, s4 viewport_height)
+{
+	PRIMITIVE &mesh = *o.mesh;
+	f4 max_scale = scale.x;
+	if (scale.y > max_scale) max_scale = scale.y;
+	if (scale.z > max_scale) max_scale = scale.z;
+
+	glm::vec4 center = view * glm::vec4(o.position, 1.0f);
+	f4 distance = -center.z;
+	f4 radius = mesh.radius * max_scale;
+	if (distance <= radius)
+	{
+		o.lod = 0;
+		return;
+	}
+
+	// projection[1][1] is cot(fovy/2), so this is the sphere's height on screen
+	f4 pixels = radius * projection[1][1] / distance * viewport_height;
+
+	s4 level = o.lod;
+	if (level >= mesh.lod_count) level = mesh.lod_count - 1;
+	while (level < mesh.lod_count - 1 && pixels < LOD_PIXEL_THRESHOLD[level] * (1.0f - LOD_HYSTERESIS)) level++;
+	while (level > 0 && pixels > LOD_PIXEL_THRESHOLD[level-1] * (1.0f + LOD_HYSTERESIS)) level--;
+	o.lod = level;
+}
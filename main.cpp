@@ -4,111 +4,290 @@
 	-2016
 */
 #include "global_vars.cpp"
+#include "gl_trace.cpp"
+#include "asset_pack.cpp"
+#include "render_targets.cpp"
+#include "readback_ring.cpp"
+#include "dynamic_resolution.cpp"
+#include "lod.cpp"
+#include "uniform_blocks.cpp"
+#include "lighting.cpp"
 #include "sgl_functions.cpp"
+#include "shader_variants.cpp"
 #include "input.cpp"
+#include "shader_reload.cpp"
+#include "occlusion.cpp"
+#include "command_buffer.cpp"
+#include "particles.cpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
-void _RENDER_NORMAL(glm::mat4 &view, glm::mat4 &projection, vec3 scale)
-{
-	{
-		glBindTexture(GL_TEXTURE_2D, texture_2);
-		glm::mat4 model = glm::translate(glm::mat4(1.0f),glm::vec3(0.0f,0.0f, 0.0f));
-		glUseProgram(basic_texture.program);
-		glUniformMatrix4fv(basic_texture.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(basic_texture.uniform_view, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(basic_texture.uniform_proj, 1, GL_FALSE, glm::value_ptr(projection));
-		glUniform3f(basic_texture.uniform_scale,scale.x,scale.y,scale.z);
-
-		glEnableVertexAttribArray(basic_texture.attribute_coord3d);
-		glBindBuffer(GL_ARRAY_BUFFER, plane.verts);
-		glVertexAttribPointer( basic_texture.attribute_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+#include "resources.cpp"
+#include "scene_snapshot.cpp"
+#include "frame_capture.cpp"
+#include "soft_raster.cpp"
+#include "batch_render.cpp"
 
-		glEnableVertexAttribArray(basic_texture.attribute_tex_coord2d);
-		glBindBuffer(GL_ARRAY_BUFFER, plane.uv_coords);
-		glVertexAttribPointer( basic_texture.attribute_tex_coord2d, 2, GL_FLOAT, GL_FALSE, 0, 0 );
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, plane.indices);
-		int size; 
-		glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-		glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+void add_object(PRIMITIVE* mesh, RESOURCE_HANDLE mesh_resource, RESOURCE_HANDLE texture_resource, IMAGE* image, glm::vec3 position, b4 occluder = false)
+{
+	if (object_count >= MAX_OBJECTS) return;
+	RENDER_OBJECT &o = objects[object_count++];
+	o.mesh = mesh;
+	o.mesh_resource = mesh_resource;
+	o.texture_resource = texture_resource;
+	o.texture = 0;
+	o.image = image;
+	o.position = position;
+	o.lod = 0;
+	o.occluder = occluder;
+	o.material = 0;
+}
 
-		glDisableVertexAttribArray(basic_texture.attribute_coord3d);
-		glDisableVertexAttribArray(basic_texture.attribute_tex_coord2d);
+/*
+	count lights scattered over the scene from a fixed seed, every eighth a
+	spot light pointing down. The rest of the scene is dimmed so they show.
+*/
+void add_demo_lights(s4 count)
+{
+	u4 seed = 12345;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	for (s4 i = 0; i < count; i++)
+	{
+		glm::vec3 position(random() * 10.0f - 5.0f, random() * 10.0f - 5.0f, 0.2f + random() * 1.3f);
+		glm::vec3 color(0.2f + random(), 0.2f + random(), 0.2f + random());
+		f4 range = 1.0f + random() * 1.5f;
+		if (i % 8 == 7) add_spot_light(position + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f), range * 2.0f, color, 15.0f, 30.0f);
+		else add_point_light(position, range, color);
 	}
+	if (count) lighting.ambient = glm::vec3(0.25f, 0.25f, 0.25f);
+}
+
+/*
+	Four fountains at the corners of the scene sharing count particles
+	alive at a time.
+*/
+void add_demo_particles(s4 count)
+{
+	const f4 lifetime = 2.0f;
+	const u4 colors[] = { 0xFF3080FF, 0xFF40FF80, 0xFFFF8040, 0xFF80E0FF };
+	for (s4 i = 0; i < 4; i++)
 	{
-		glBindTexture(GL_TEXTURE_2D, texture_apple);
-		glm::mat4 model = glm::translate(glm::mat4(1.0f),glm::vec3(2.5f,0.0f, 0.0f));
-		glUseProgram(basic_texture.program);
-		glUniformMatrix4fv(basic_texture.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(basic_texture.uniform_view, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(basic_texture.uniform_proj, 1, GL_FALSE, glm::value_ptr(projection));
-		glUniform3f(basic_texture.uniform_scale,scale.x,scale.y,scale.z);
+		f4 x = i & 1 ? 3.5f : -3.5f;
+		f4 y = i & 2 ? 3.5f : -3.5f;
+		add_particle_emitter(glm::vec3(x, y, 0.0f), glm::vec3(0.0f, 0.0f, 7.0f), 1.5f,
+			count / lifetime / 4.0f, lifetime, 0.06f, colors[i]);
+	}
+}
 
-		glEnableVertexAttribArray(basic_texture.attribute_coord3d);
-		glBindBuffer(GL_ARRAY_BUFFER, cube.verts);
-		glVertexAttribPointer( basic_texture.attribute_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+/*
+	Turn every light around the up axis.
+*/
+void orbit_lights(f4 angle)
+{
+	f4 c = cosf(angle);
+	f4 s = sinf(angle);
+	for (s4 i = 0; i < lighting.light_count; i++)
+	{
+		glm::vec3 &p = lighting.lights[i].position;
+		p = glm::vec3(c * p.x - s * p.y, s * p.x + c * p.y, p.z);
+	}
+}
 
-		glEnableVertexAttribArray(basic_texture.attribute_tex_coord2d);
-		glBindBuffer(GL_ARRAY_BUFFER, cube.uv_coords);
-		glVertexAttribPointer( basic_texture.attribute_tex_coord2d, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+/*
+	Draw the scene into the viewport at x, y of the bound framebuffer.
+*/
+void _RENDER_NORMAL(glm::mat4 &view, glm::mat4 &projection, vec3 scale, s4 x, s4 y, s4 width, s4 height)
+{
+	stats.draws = 0;
+	stats.triangles = 0;
+	stats.culled = 0;
+	update_camera_block(view, projection, SDL_GetTicks() / 1000.0f);
+	upload_materials();
+	update_light_clusters(view, projection, x, y, width, height);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.indices);
-		int size; 
-		glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-		glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+	s4 order[MAX_OBJECTS];
+	s4 count = sort_objects_front_to_back(view, order);
+	collect_occlusion_results();
 
-		glDisableVertexAttribArray(basic_texture.attribute_coord3d);
-		glDisableVertexAttribArray(basic_texture.attribute_tex_coord2d);
-	}
+	// only what is drawn this frame counts as used, occluded objects can age out
+	for (s4 i = 0; i < count; i++)
 	{
-		glUseProgram(color_verts.program);
-		glm::mat4 model = glm::translate(glm::mat4(1.0f),glm::vec3(-2.5f,0.0f, 0.0f));
-		glUniformMatrix4fv(color_verts.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(color_verts.uniform_view, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(color_verts.uniform_proj, 1, GL_FALSE, glm::value_ptr(projection));
-		glUniform3f(color_verts.uniform_scale,scale.x,scale.y,scale.z);
-
-		glEnableVertexAttribArray(color_verts.attribute_coord3d);
-		glBindBuffer(GL_ARRAY_BUFFER, pyramid.verts);
-		glVertexAttribPointer( color_verts.attribute_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+		if (!object_visible(i)) continue;
+		RENDER_OBJECT &o = objects[i];
+		if (o.mesh_resource) o.mesh = acquire_mesh(o.mesh_resource);
+		if (o.texture_resource) o.texture = acquire_texture(o.texture_resource);
+		select_lod(o, view, projection, scale, height);
+	}
 
-		glEnableVertexAttribArray(color_verts.attribute_v_color);
-		glBindBuffer(GL_ARRAY_BUFFER, pyramid.colors);
-		glVertexAttribPointer( color_verts.attribute_v_color, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+	render_depth_prepass(order, count, view, projection, scale);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pyramid.indices);
-		int size; 
-		glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-		glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+	record_draw_lists(order, count, view, projection, scale);
+	execute_command_buffers();
 
-		glDisableVertexAttribArray(color_verts.attribute_coord3d);
-		glDisableVertexAttribArray(color_verts.attribute_v_color);
-	}
+	issue_occlusion_queries(order, count, view, projection, scale);
+	// undo the prepass's GL_LEQUAL here, queries may be off (batch mode)
+	glDepthFunc(GL_LESS);
 }
 
+// benchmark.cpp includes this file for the renderer and brings its own main()
+#ifndef SGL_NO_MAIN
 int main(int argc, char* argv[]) { 
+	u8 startup_begin = SDL_GetPerformanceCounter();
 	initialize_memory(memory, 8); // 10 megabytes
+	parse_capture_args(argc, argv);
+	u8 vram_budget_mb = 0;
+	const char* pack_path = "assets.pack";
+	b4 no_ubo = false;
+	s4 light_count = 0;
+	const char* batch_path = 0;
+	const char* batch_out = ".";
+	const char* trace_path = 0;
+	s4 trace_frames = 0;
+	f4 frame_budget_ms = 0.0f;
+	s4 particle_count = 0;
+	const char* snapshot_path = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--software")) sgl.software = true;
+		if (!strcmp(argv[i], "--vram-budget") && i + 1 < argc) vram_budget_mb = atoi(argv[++i]);
+		if (!strcmp(argv[i], "--pack") && i + 1 < argc) pack_path = argv[++i];
+		if (!strcmp(argv[i], "--no-ubo")) no_ubo = true;
+		if (!strcmp(argv[i], "--lights") && i + 1 < argc) light_count = atoi(argv[++i]);
+		if (!strcmp(argv[i], "--batch") && i + 1 < argc) batch_path = argv[++i];
+		if (!strcmp(argv[i], "--batch-out") && i + 1 < argc) batch_out = argv[++i];
+		if (!strcmp(argv[i], "--gl-trace") && i + 1 < argc) trace_path = argv[++i];
+		if (!strcmp(argv[i], "--gl-trace-frames") && i + 1 < argc) trace_frames = atoi(argv[++i]);
+		if (!strcmp(argv[i], "--dynamic-res") && i + 1 < argc) frame_budget_ms = (f4)atof(argv[++i]);
+		if (!strcmp(argv[i], "--particles") && i + 1 < argc) particle_count = atoi(argv[++i]);
+		if (!strcmp(argv[i], "--snapshot") && i + 1 < argc) snapshot_path = argv[++i];
+	}
+	// started before the context so the trace sees every call from the first
+	if (trace_path && !sgl.software && !start_gl_trace(trace_path, trace_frames)) return 1;
+
+	// everything startup reads, so the disk works ahead of the loaders, and what a snapshot is made from
+	const char* startup_assets[] = { UBER_VERTEX_FILE, UBER_FRAGMENT_FILE, "test_2.png", "test_apple.png" };
+	const s4 startup_asset_count = sizeof(startup_assets) / sizeof(startup_assets[0]);
+	if (open_asset_pack(pack_path))
+	{
+		asset_prefetch(startup_assets, startup_asset_count);
+	}
 	
 	if (!create_sgl()) { cout << "ERROR: failed to create sdl or opengl" << endl; }
-	create_plane();
-	create_cube();
-	create_pyramid();
-	if (!create_basic_shader()) return false;
-	if (!create_offscreen_shader()) return false;
-	if (!create_color_verts_shader()) return false;
-	if (!create_basic_texture_shader()) return false;
+	b4 from_snapshot = false;
+	if (sgl.software)
+	{
+		create_plane();
+		create_cube();
+		create_pyramid();
+		init_soft_raster();
+	}
+	else
+	{
+		init_uniform_blocks(!no_ubo);
+		init_lighting();
+		add_demo_lights(light_count);
+		// a trace has to record the meshes and shaders being made, so it never starts from a snapshot
+		from_snapshot = snapshot_path && !trace_path && open_scene_snapshot(snapshot_path, startup_assets, startup_asset_count);
+		if (from_snapshot)
+		{
+			load_snapshot_meshes();
+			load_snapshot_materials();
+			load_snapshot_shaders();
+		}
+		else
+		{
+			create_plane();
+			create_cube();
+			create_pyramid();
+			create_mesh_lods(plane);
+			create_mesh_lods(cube);
+			create_mesh_lods(pyramid);
+			create_material(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)); // material 0, leaves colors as they are
+		}
+		const SHADER_KEY startup_variants[] = {
+			BASIC_SHADER_KEY, BASIC_TEXTURE_SHADER_KEY, COLOR_VERTS_SHADER_KEY, OFFSCREEN_SHADER_KEY, POINT_SPRITE_SHADER_KEY
+		};
+		s4 startup_variant_count = sizeof(startup_variants) / sizeof(startup_variants[0]);
+		// the point sprite variant only when something draws with it
+		if (particle_count <= 0) startup_variant_count--;
+		precompile_shader_variants(startup_variants, startup_variant_count);
+		if (!create_basic_shader()) return false;
+		if (!create_offscreen_shader()) return false;
+		if (!create_color_verts_shader()) return false;
+		if (!create_basic_texture_shader()) return false;
+		if (particle_count > 0 && create_point_sprite_shader() && init_particles(particle_count))
+		{
+			add_demo_particles(particle_count);
+		}
+
+		if (!create_offscreen_texture()) return false;
+		init_dynamic_resolution(frame_budget_ms);
+
+#ifdef DEBUG_BUILD
+		start_shader_reload();
+#endif
+	}
+
+	RESOURCE_HANDLE texture_2 = 0, texture_apple = 0;
+	RESOURCE_HANDLE plane_resource = 0, cube_resource = 0, pyramid_resource = 0;
+	if (sgl.software)
+	{
+		// the rasterizer samples straight from the decoded images
+		image_2.data = asset_load_image("test_2.png", &image_2.x, &image_2.y, &image_2.n, 4);
+		image_2.n = 4;
+		image_apple.data = asset_load_image("test_apple.png", &image_apple.x, &image_apple.y, &image_apple.n, 3);
+		image_apple.n = 3; // forced above, n now describes data
+	}
+	else if (from_snapshot)
+	{
+		init_resources(vram_budget_mb);
+		load_snapshot_objects();
+	}
+	else
+	{
+		init_resources(vram_budget_mb);
+		texture_2 = load_texture("test_2.png", 4);
+		texture_apple = load_texture("test_apple.png", 3);
+		plane_resource = register_mesh(plane);
+		// the cube also bounds every occlusion query, keep it resident
+		cube_resource = register_mesh(cube, true);
+		pyramid_resource = register_mesh(pyramid);
+	}
+
+	if (!from_snapshot)
+	{
+		add_object(&plane, plane_resource, texture_2, &image_2, glm::vec3(0.0f, 0.0f, 0.0f));
+		add_object(&cube, cube_resource, texture_apple, &image_apple, glm::vec3(2.5f, 0.0f, 0.0f), true);
+		add_object(&pyramid, pyramid_resource, 0, 0, glm::vec3(-2.5f, 0.0f, 0.0f));
+	}
 
-	if (!create_offscreen_texture()) return false;
+	if (!sgl.software)
+	{
+		init_occlusion();
+		init_command_buffers();
+	}
+	start_frame_capture();
 
-	texture_2 = 0;
-	image_2.data = stbi_load("test_2.png", &image_2.x, &image_2.y, &image_2.n, 0);
-	texture_2 = my_create_texture(256,256,true,image_2.data,false);
+	f8 startup_ms = (f8)(SDL_GetPerformanceCounter() - startup_begin) * 1000.0 / SDL_GetPerformanceFrequency();
+	cout << "startup: " << startup_ms << " ms, ";
+	if (asset_pack.header)
+	{
+		cout << (asset_pack.resident > 0.9f ? "warm" : "cold") << " pack ("
+			 << (s4)(asset_pack.resident * 100.0f) << "% cached), ";
+	}
+	cout << asset_pack.pack_loads << " assets from pack, " << asset_pack.loose_loads << " loose, "
+		 << asset_pack.bytes_loaded / 1024 << " KB" << endl;
 
-	texture_apple = 0;
-	image_apple.data = stbi_load("test_apple.png", &image_apple.x, &image_apple.y, &image_apple.n, 3);
-	texture_apple = my_create_texture(256,256,false,image_apple.data,false);
+	b4 batch_ok = true;
+	if (batch_path)
+	{
+		if (sgl.software) { cerr << "ERROR: --batch needs OpenGL" << endl; batch_ok = false; }
+		else batch_ok = run_batch_render(batch_path, batch_out);
+		input.quit_app = true;
+	}
 
 	f4 prev_camera_angle = -1;
 	b4 is_screen_dirty = true;
@@ -118,6 +297,20 @@ int main(int argc, char* argv[]) {
 	f4 physics_dt = 0.0f;
 	u4 time_physics_prev = SDL_GetTicks();
 
+	b4 first_frame = true;
+	auto first_frame_shown = [&]()
+	{
+		first_frame = false;
+		f8 first_frame_ms = (f8)(SDL_GetPerformanceCounter() - startup_begin) * 1000.0 / SDL_GetPerformanceFrequency();
+		cout << "first frame: " << first_frame_ms << " ms after launch, scene "
+			 << (from_snapshot ? "mapped from snapshot" : "built") << endl;
+		// only now, so writing the snapshot does not delay the first frame
+		if (snapshot_path && !from_snapshot && !sgl.software && !trace_path)
+		{
+			write_scene_snapshot(snapshot_path, startup_assets, startup_asset_count);
+		}
+	};
+
 	while(!input.quit_app)
 	{
 		u4 time_physics_curr = SDL_GetTicks();
@@ -125,12 +318,17 @@ int main(int argc, char* argv[]) {
 		time_physics_prev = time_physics_curr;
 
 		poll_events();
+#ifdef DEBUG_BUILD
+		update_shader_reload();
+#endif
 
 		physics_dt += frameTime;
 		if (physics_dt >= PHYSICS_MS)
 		{
 			physics_dt -= PHYSICS_MS;
 
+			orbit_lights(0.3f * PHYSICS_MS);
+			update_particles(PHYSICS_MS);
 			input.mouse_clicked = false;
 			input.mouse_right_clicked = false;
 		}
@@ -139,6 +337,8 @@ int main(int argc, char* argv[]) {
 		if (render_dt >= RENDER_MS )
 		{
 			render_dt = 0;
+			begin_render_target_frame();
+			if (!sgl.software) begin_resource_frame();
 		
 			glm::vec3 up_axis(0, 0, 1); 
 
@@ -149,6 +349,21 @@ int main(int argc, char* argv[]) {
 			glm::mat4 view = glm::lookAt(glm::vec3(pp.x,pp.y,pp.z), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
 			glm::mat4 projection = glm::perspective(45.0f, 1.0f*sgl.width/sgl.height, 0.1f, 100.0f);
 
+			if (sgl.software)
+			{
+				soft_begin_frame(0.23f,0.47f,0.58f,1.0f);
+				for (s4 i = 0; i < object_count; i++)
+				{
+					soft_draw_object(objects[i], view, projection, vec3(1.0f,1.0f,1.0f));
+				}
+				soft_end_frame();
+				if (!capture_pixels(soft.color, soft.width, soft.height, soft.stride)) input.quit_app = true;
+				soft_present();
+				if (first_frame) first_frame_shown();
+				memory.transient_current = 0;
+				continue;
+			}
+
 			glBindFramebuffer(GL_FRAMEBUFFER, FBO);
 			if (prev_camera_angle != camera_angle || is_screen_dirty)
 			{
@@ -159,21 +374,51 @@ int main(int argc, char* argv[]) {
 
 			// get_mouse_state();
 
-		   	glBindFramebuffer(GL_FRAMEBUFFER,0);
+			// the window at full size unless dynamic resolution picked a smaller one
+			begin_dynamic_resolution();
 			glClearColor(0.23f,0.47f,0.58f,1.0f); 
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-			_RENDER_NORMAL(view,projection,vec3(1.0f,1.0f,1.0f));
+			_RENDER_NORMAL(view,projection,vec3(1.0f,1.0f,1.0f),0,0,dynamic_res.width,dynamic_res.height);
+			render_particles(view, projection, dynamic_res.height);
+			end_dynamic_resolution();
+			enforce_resource_budget();
+
+			if (!capture_frame(0, sgl.width, sgl.height)) input.quit_app = true;
 
 			SDL_GL_SwapWindow(sgl.window);
+			if (first_frame) first_frame_shown();
+			if (!gl_trace_frame()) input.quit_app = true;
 		}
 
 		memory.transient_current = 0;
 	}
+	// closed at the last frame, a replay of the teardown below would draw later passes with deleted objects
+	stop_gl_trace();
+#ifdef DEBUG_BUILD
+	stop_shader_reload();
+#endif
+	b4 capture_ok = stop_frame_capture();
+	if (sgl.software)
+	{
+		destroy_soft_raster();
+	}
+	else
+	{
+		destroy_command_buffers();
+		destroy_occlusion();
+		destroy_resources();
+		destroy_shader_variants();
+		destroy_uniform_blocks();
+		destroy_lighting();
+		destroy_dynamic_resolution();
+		destroy_particles();
+	}
 	stbi_image_free(image_2.data);
 	stbi_image_free(image_apple.data);
-	glDeleteTextures(1,&texture_2);
-	glDeleteTextures(1,&texture_apple);
 	empty_program();
-	return 0;
-}
\ No newline at end of file
+	close_asset_pack();
+	close_scene_snapshot();
+	return capture_ok && batch_ok ? 0 : 1;
+}
+#endif
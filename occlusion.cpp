@@ -0,0 +1,177 @@
+/*
+	Occlusion culling.
+
+	Opaque objects are drawn front to back. Objects flagged as occluders can
+	first be laid down in a depth only pre-pass, after which the main pass
+	runs with GL_LEQUAL so hidden fragments fail early-Z instead of being
+	shaded. _RENDER_NORMAL puts GL_LESS back once the objects are drawn.
+
+	After the main pass every object's bounding box is drawn with color and
+	depth writes off inside an occlusion query. Results are only read once
+	GL_QUERY_RESULT_AVAILABLE says so, normally the next frame, so the CPU
+	never waits on the GPU; an object keeps its last visibility until a new
+	answer arrives. Hidden objects still get a query each frame so they
+	reappear as soon as they are uncovered, at the cost of one frame's lag.
+*/
+
+struct OCCLUSION_QUERY
+{
+	gu query;
+	b4 pending;
+	b4 visible;
+};
+
+struct OCCLUSION
+{
+	b4 enabled;
+	b4 depth_prepass;
+	GLenum query_target; // GL_ANY_SAMPLES_PASSED when available
+	OCCLUSION_QUERY queries[MAX_OBJECTS];
+	f4 depth[MAX_OBJECTS]; // view space distance, sort key
+} occlusion;
+
+void init_occlusion()
+{
+	occlusion.enabled = true;
+	occlusion.depth_prepass = true;
+	occlusion.query_target = (GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2) ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+	for (s4 i = 0; i < MAX_OBJECTS; i++)
+	{
+		occlusion.queries[i].query = 0;
+		occlusion.queries[i].pending = false;
+		occlusion.queries[i].visible = true;
+	}
+}
+
+void destroy_occlusion()
+{
+	for (s4 i = 0; i < MAX_OBJECTS; i++)
+	{
+		if (occlusion.queries[i].query) glDeleteQueries(1, &occlusion.queries[i].query);
+		occlusion.queries[i].query = 0;
+	}
+}
+
+inline f4 object_max_scale(vec3 scale)
+{
+	f4 s = scale.x;
+	if (scale.y > s) s = scale.y;
+	if (scale.z > s) s = scale.z;
+	return s;
+}
+
+/*
+	Fill order with object indices sorted nearest first.
+*/
+s4 sort_objects_front_to_back(const glm::mat4 &view, s4* order)
+{
+	for (s4 i = 0; i < object_count; i++)
+	{
+		glm::vec4 p = view * glm::vec4(objects[i].position, 1.0f);
+		occlusion.depth[i] = -p.z;
+		order[i] = i;
+	}
+	std::sort(order, order + object_count, [](s4 a, s4 b) {
+		return occlusion.depth[a] < occlusion.depth[b];
+	});
+	return object_count;
+}
+
+/*
+	Draw with the basic shader and only the position attribute. Used for
+	the pre-pass and for query boxes, both with color writes off.
+*/
+void draw_object_depth(PRIMITIVE &mesh, s4 lod, glm::vec3 position, glm::mat4 &view, glm::mat4 &projection, vec3 scale)
+{
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+	glUniformMatrix4fv(basic.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
+	set_camera_uniforms(basic.uniform_view, basic.uniform_proj, view, projection);
+	glUniform3f(basic.uniform_scale, scale.x, scale.y, scale.z);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.verts);
+	glVertexAttribPointer(basic.attribute_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.lod_indices[lod]);
+	glDrawElements(GL_TRIANGLES, mesh.lod_index_count[lod], GL_UNSIGNED_SHORT, 0);
+}
+
+void render_depth_prepass(s4* order, s4 count, glm::mat4 &view, glm::mat4 &projection, vec3 scale)
+{
+	if (!occlusion.depth_prepass) return;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glUseProgram(basic.program);
+	glEnableVertexAttribArray(basic.attribute_coord3d);
+	for (s4 i = 0; i < count; i++)
+	{
+		RENDER_OBJECT &o = objects[order[i]];
+		if (!o.occluder) continue;
+		draw_object_depth(*o.mesh, o.lod, o.position, view, projection, scale);
+	}
+	glDisableVertexAttribArray(basic.attribute_coord3d);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	// the main pass redraws the occluders at exactly the same depth
+	glDepthFunc(GL_LEQUAL);
+}
+
+/*
+	Pick up every query result the GPU has finished. Never blocks.
+*/
+void collect_occlusion_results()
+{
+	for (s4 i = 0; i < object_count; i++)
+	{
+		OCCLUSION_QUERY &q = occlusion.queries[i];
+		if (!q.pending) continue;
+		GLuint available = 0;
+		glGetQueryObjectuiv(q.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) continue;
+		GLuint samples = 0;
+		glGetQueryObjectuiv(q.query, GL_QUERY_RESULT, &samples);
+		q.visible = samples != 0;
+		q.pending = false;
+	}
+}
+
+b4 object_visible(s4 index)
+{
+	if (!occlusion.enabled) return true;
+	// occluders are drawn regardless, they are what hides everything else
+	if (objects[index].occluder) return true;
+	return occlusion.queries[index].visible;
+}
+
+void issue_occlusion_queries(s4* order, s4 count, glm::mat4 &view, glm::mat4 &projection, vec3 scale)
+{
+	if (!occlusion.enabled) return;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glUseProgram(basic.program);
+	glEnableVertexAttribArray(basic.attribute_coord3d);
+	for (s4 i = 0; i < count; i++)
+	{
+		s4 index = order[i];
+		RENDER_OBJECT &o = objects[index];
+		OCCLUSION_QUERY &q = occlusion.queries[index];
+		if (o.occluder || q.pending) continue;
+
+		// the unit cube scaled by the bounding radius encloses the object
+		f4 r = o.mesh->radius * object_max_scale(scale);
+		if (occlusion.depth[index] < r * 1.75f)
+		{
+			// camera is at or inside the box, its faces would be clipped away
+			q.visible = true;
+			continue;
+		}
+
+		if (!q.query) glGenQueries(1, &q.query);
+		glBeginQuery(occlusion.query_target, q.query);
+		draw_object_depth(cube, 0, o.position, view, projection, vec3(r, r, r));
+		glEndQuery(occlusion.query_target);
+		q.pending = true;
+	}
+	glDisableVertexAttribArray(basic.attribute_coord3d);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
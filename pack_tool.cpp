@@ -0,0 +1,165 @@
+/*
+	Offline packer for asset_pack.cpp.
+
+	pack_tool <out.pack> <file>...
+
+	Files are stored under the path given on the command line, which is the
+	name the program asks for at runtime. Data that zlib shrinks by at
+	least an eighth is stored compressed (shaders and other text). Images
+	are already compressed and are stored as they are, so they can be
+	viewed in place.
+
+	build: g++ pack_tool.cpp -O2 -std=c++11 -I../b_libs -I../stb -o pack_tool
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "b_memory.h"
+
+using namespace std;
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "asset_pack.cpp"
+
+struct PACK_INPUT
+{
+	const char* name;
+	ASSET_DATA raw;
+	u1* compressed; // 0 when stored
+	s4 compressed_size;
+	ASSET_PACK_ENTRY entry;
+};
+
+inline u8 align_up(u8 value, u8 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+b4 write_bytes(FILE* file, const void* data, u8 size)
+{
+	return fwrite(data, 1, size, file) == size;
+}
+
+b4 write_padding(FILE* file, u8 &at, u8 to)
+{
+	static const u1 zeros[ASSET_PACK_ALIGNMENT] = {};
+	while (at < to)
+	{
+		u8 n = to - at < ASSET_PACK_ALIGNMENT ? to - at : ASSET_PACK_ALIGNMENT;
+		if (!write_bytes(file, zeros, n)) return false;
+		at += n;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		cerr << "usage: pack_tool <out.pack> <file>..." << endl;
+		return 1;
+	}
+
+	std::vector<PACK_INPUT> inputs(argc - 2);
+	std::vector<char> names;
+	u8 total_raw = 0;
+	for (s4 i = 0; i < argc - 2; i++)
+	{
+		PACK_INPUT &in = inputs[i];
+		in.name = argv[i + 2];
+		if (!read_loose_file(in.name, in.raw))
+		{
+			cerr << "ERROR: could not read " << in.name << endl;
+			return 1;
+		}
+		total_raw += in.raw.size;
+
+		in.compressed = stbi_zlib_compress((u1*)in.raw.data, (s4)in.raw.size, &in.compressed_size, 8);
+		if (in.compressed && (u8)in.compressed_size > in.raw.size - in.raw.size / 8)
+		{
+			free(in.compressed);
+			in.compressed = 0;
+		}
+
+		ASSET_PACK_ENTRY &e = in.entry;
+		memset(&e, 0, sizeof(e));
+		e.hash = asset_hash(in.name);
+		e.raw_size = in.raw.size;
+		e.size = in.compressed ? (u8)in.compressed_size : in.raw.size;
+		e.flags = in.compressed ? ASSET_COMPRESSED : 0;
+		e.name_offset = (u4)names.size();
+		names.insert(names.end(), in.name, in.name + strlen(in.name) + 1);
+	}
+
+	std::sort(inputs.begin(), inputs.end(), [](const PACK_INPUT &a, const PACK_INPUT &b) {
+		return a.entry.hash < b.entry.hash;
+	});
+	for (size_t i = 1; i < inputs.size(); i++)
+	{
+		if (inputs[i].entry.hash == inputs[i-1].entry.hash && !strcmp(inputs[i].name, inputs[i-1].name))
+		{
+			cerr << "ERROR: " << inputs[i].name << " given twice" << endl;
+			return 1;
+		}
+	}
+
+	ASSET_PACK_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.magic = ASSET_PACK_MAGIC;
+	header.version = ASSET_PACK_VERSION;
+	header.entry_count = (u4)inputs.size();
+	header.names_size = (u4)names.size();
+	header.toc_offset = sizeof(ASSET_PACK_HEADER);
+	header.names_offset = header.toc_offset + inputs.size() * sizeof(ASSET_PACK_ENTRY);
+
+	// blobs keep their hash order, each followed by the NUL the runtime relies on
+	u8 at = align_up(header.names_offset + header.names_size, ASSET_PACK_ALIGNMENT);
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		inputs[i].entry.offset = at;
+		at = align_up(at + inputs[i].entry.size + 1, ASSET_PACK_ALIGNMENT);
+	}
+
+	FILE* file = fopen(argv[1], "wb");
+	if (!file)
+	{
+		cerr << "ERROR: could not create " << argv[1] << endl;
+		return 1;
+	}
+	b4 ok = write_bytes(file, &header, sizeof(header));
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		ok = ok && write_bytes(file, &inputs[i].entry, sizeof(ASSET_PACK_ENTRY));
+	}
+	ok = ok && write_bytes(file, names.data(), names.size());
+
+	at = header.names_offset + header.names_size;
+	u8 total_stored = 0;
+	for (size_t i = 0; i < inputs.size() && ok; i++)
+	{
+		PACK_INPUT &in = inputs[i];
+		const void* data = in.compressed ? (const void*)in.compressed : (const void*)in.raw.data;
+		ok = write_padding(file, at, in.entry.offset) &&
+			 write_bytes(file, data, in.entry.size) &&
+			 write_bytes(file, "", 1);
+		at += in.entry.size + 1;
+		total_stored += in.entry.size;
+		cout << (in.compressed ? "  zlib " : "  store ") << in.name << " "
+			 << in.entry.raw_size << " -> " << in.entry.size << endl;
+		free(in.compressed);
+		asset_release(in.raw);
+	}
+	ok = ok && fclose(file) == 0;
+	if (!ok)
+	{
+		cerr << "ERROR: failed writing " << argv[1] << endl;
+		return 1;
+	}
+	cout << argv[1] << ": " << inputs.size() << " entries, " << total_raw << " -> " << total_stored << " bytes" << endl;
+	return 0;
+}
@@ -0,0 +1,600 @@
+/*
+	Particles.
+
+	Particles are stored structure of arrays, one 32 byte aligned array per
+	field, so the update touches only the fields it needs and processes 8
+	particles per AVX2 instruction, 4 with SSE where AVX2 is missing. Live
+	particles are packed at the front, [0, count).
+
+	update_particles() runs once per physics step. The update is split in
+	chunks of PARTICLE_CHUNK that the worker threads and the calling thread
+	take from a shared counter, like the tiles in soft_raster.cpp. Dead
+	particles are then removed by moving live ones from the end into their
+	slots. The update counts the dead, and when there are any that pass
+	scans all live particles, so it costs one read of life per particle;
+	only as many particles as died are moved. The emitters then fill up the
+	free space from the end.
+
+	render_particles() draws them as point sprites after the opaque scene,
+	with depth writes off and the GL_SRC_ALPHA blend set up in create_sgl().
+	For that blend to be right they are sorted back to front first: the
+	workers compute a view depth key per particle, which is radix sorted in
+	three 11 bit passes. The workers then write the vertices in sorted order
+	into a staging array, uploaded into a GL_STREAM_DRAW buffer that is
+	respecified every frame so the driver never waits on last frame's draw.
+
+	The arrays hold state across frames, so they are allocated once at
+	init_particles() instead of from the per frame transient memory.
+*/
+#include <immintrin.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#define PARTICLE_CHUNK 16384 // particles per job, a multiple of 8
+#define MAX_PARTICLE_EMITTERS 16
+#define PARTICLE_RADIX_BITS 11
+#define PARTICLE_RADIX_SIZE (1 << PARTICLE_RADIX_BITS)
+#define PARTICLE_RADIX_PASSES 3 // covers the 32 bit depth key
+
+struct PARTICLE_EMITTER
+{
+	glm::vec3 position;
+	glm::vec3 velocity; // mean launch velocity
+	f4 spread;          // up to this much added to each velocity component
+	f4 rate;            // particles per second
+	f4 lifetime;        // seconds
+	f4 size;            // world units
+	u4 color;           // RGBA8, r in the low byte
+	f4 accumulator;     // fraction of a particle carried to the next step
+};
+
+struct PARTICLE_VERTEX
+{
+	f4 x, y, z;
+	f4 size;
+	u4 color; // alpha faded by remaining life
+};
+
+enum PARTICLE_JOB
+{
+	PARTICLE_JOB_UPDATE,
+	PARTICLE_JOB_KEYS,
+	PARTICLE_JOB_VERTICES,
+};
+
+struct PARTICLES
+{
+	b4 enabled;
+	s4 capacity;
+	s4 count;
+	f4* px;
+	f4* py;
+	f4* pz;
+	f4* vx;
+	f4* vy;
+	f4* vz;
+	f4* life; // seconds left, dead at <= 0
+	f4* inv_lifetime;
+	f4* size;
+	u4* color;
+
+	u8* keys;         // depth key << 32 | particle, back to front after sorting
+	u8* sorted;       // radix sort scratch
+	PARTICLE_VERTEX* vertices;
+	gu vbo;
+	b4 sort;
+
+	PARTICLE_EMITTER emitters[MAX_PARTICLE_EMITTERS];
+	s4 emitter_count;
+	glm::vec3 gravity;
+	f4 drag; // fraction of velocity lost per second
+	u4 seed;
+	b4 use_avx2;
+
+	// current job, read by the workers
+	PARTICLE_JOB job;
+	s4 job_count;
+	f4 dt;
+	f4 damping;       // velocity kept over dt
+	glm::vec4 view_z; // row of the view matrix giving view space z
+	std::atomic<s4> dead;
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	u4 generation;    // bumped for every job
+	std::atomic<u8> next_chunk; // generation << 32 | next chunk to take
+	s4 chunks_left;
+	s4 active; // workers inside run_particle_chunks(), the job is not changed under them
+	b4 running;
+} particles;
+
+inline f4* alloc_particle_array(s4 capacity)
+{
+	return (f4*)_mm_malloc(capacity * sizeof(f4), 32);
+}
+
+f4 particle_random()
+{
+	particles.seed = particles.seed * 1664525u + 1013904223u;
+	return (particles.seed >> 8) / 16777216.0f;
+}
+
+void update_particles_scalar(s4 begin, s4 end)
+{
+	f4 dt = particles.dt;
+	f4 damping = particles.damping;
+	glm::vec3 g = particles.gravity * dt;
+	s4 dead = 0;
+	for (s4 i = begin; i < end; i++)
+	{
+		particles.vx[i] = particles.vx[i] * damping + g.x;
+		particles.vy[i] = particles.vy[i] * damping + g.y;
+		particles.vz[i] = particles.vz[i] * damping + g.z;
+		particles.px[i] += particles.vx[i] * dt;
+		particles.py[i] += particles.vy[i] * dt;
+		particles.pz[i] += particles.vz[i] * dt;
+		particles.life[i] -= dt;
+		if (particles.life[i] <= 0.0f) dead++;
+	}
+	if (dead) particles.dead += dead;
+}
+
+/*
+	begin is a multiple of 8, so the loads are aligned. The remainder at
+	the end of the array goes to the scalar version.
+*/
+void update_particles_sse(s4 begin, s4 end)
+{
+	__m128 dt = _mm_set1_ps(particles.dt);
+	__m128 damping = _mm_set1_ps(particles.damping);
+	__m128 gx = _mm_set1_ps(particles.gravity.x * particles.dt);
+	__m128 gy = _mm_set1_ps(particles.gravity.y * particles.dt);
+	__m128 gz = _mm_set1_ps(particles.gravity.z * particles.dt);
+	__m128 zero = _mm_setzero_ps();
+	s4 dead = 0;
+	s4 i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 vx = _mm_add_ps(_mm_mul_ps(_mm_load_ps(particles.vx + i), damping), gx);
+		__m128 vy = _mm_add_ps(_mm_mul_ps(_mm_load_ps(particles.vy + i), damping), gy);
+		__m128 vz = _mm_add_ps(_mm_mul_ps(_mm_load_ps(particles.vz + i), damping), gz);
+		_mm_store_ps(particles.vx + i, vx);
+		_mm_store_ps(particles.vy + i, vy);
+		_mm_store_ps(particles.vz + i, vz);
+		_mm_store_ps(particles.px + i, _mm_add_ps(_mm_load_ps(particles.px + i), _mm_mul_ps(vx, dt)));
+		_mm_store_ps(particles.py + i, _mm_add_ps(_mm_load_ps(particles.py + i), _mm_mul_ps(vy, dt)));
+		_mm_store_ps(particles.pz + i, _mm_add_ps(_mm_load_ps(particles.pz + i), _mm_mul_ps(vz, dt)));
+		__m128 life = _mm_sub_ps(_mm_load_ps(particles.life + i), dt);
+		_mm_store_ps(particles.life + i, life);
+		dead += __builtin_popcount(_mm_movemask_ps(_mm_cmple_ps(life, zero)));
+	}
+	if (dead) particles.dead += dead;
+	update_particles_scalar(i, end);
+}
+
+__attribute__((target("avx2")))
+void update_particles_avx2(s4 begin, s4 end)
+{
+	__m256 dt = _mm256_set1_ps(particles.dt);
+	__m256 damping = _mm256_set1_ps(particles.damping);
+	__m256 gx = _mm256_set1_ps(particles.gravity.x * particles.dt);
+	__m256 gy = _mm256_set1_ps(particles.gravity.y * particles.dt);
+	__m256 gz = _mm256_set1_ps(particles.gravity.z * particles.dt);
+	__m256 zero = _mm256_setzero_ps();
+	s4 dead = 0;
+	s4 i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 vx = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(particles.vx + i), damping), gx);
+		__m256 vy = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(particles.vy + i), damping), gy);
+		__m256 vz = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(particles.vz + i), damping), gz);
+		_mm256_store_ps(particles.vx + i, vx);
+		_mm256_store_ps(particles.vy + i, vy);
+		_mm256_store_ps(particles.vz + i, vz);
+		_mm256_store_ps(particles.px + i, _mm256_add_ps(_mm256_load_ps(particles.px + i), _mm256_mul_ps(vx, dt)));
+		_mm256_store_ps(particles.py + i, _mm256_add_ps(_mm256_load_ps(particles.py + i), _mm256_mul_ps(vy, dt)));
+		_mm256_store_ps(particles.pz + i, _mm256_add_ps(_mm256_load_ps(particles.pz + i), _mm256_mul_ps(vz, dt)));
+		__m256 life = _mm256_sub_ps(_mm256_load_ps(particles.life + i), dt);
+		_mm256_store_ps(particles.life + i, life);
+		dead += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(life, zero, _CMP_LE_OQ)));
+	}
+	if (dead) particles.dead += dead;
+	update_particles_scalar(i, end);
+}
+
+/*
+	Keys sort ascending into back to front: the bits of a positive float
+	grow with its value, inverted the farthest comes first.
+*/
+void particle_depth_keys(s4 begin, s4 end)
+{
+	glm::vec4 r = particles.view_z;
+	for (s4 i = begin; i < end; i++)
+	{
+		f4 depth = -(r.x * particles.px[i] + r.y * particles.py[i] + r.z * particles.pz[i] + r.w);
+		if (depth < 0.0f) depth = 0.0f;
+		u4 bits;
+		memcpy(&bits, &depth, 4);
+		particles.keys[i] = ((u8)~bits << 32) | (u4)i;
+	}
+}
+
+void particle_vertices(s4 begin, s4 end)
+{
+	for (s4 j = begin; j < end; j++)
+	{
+		s4 i = particles.sort ? (s4)(u4)particles.keys[j] : j;
+		PARTICLE_VERTEX &v = particles.vertices[j];
+		v.x = particles.px[i];
+		v.y = particles.py[i];
+		v.z = particles.pz[i];
+		v.size = particles.size[i];
+		f4 fade = particles.life[i] * particles.inv_lifetime[i];
+		u4 c = particles.color[i];
+		v.color = (c & 0x00FFFFFF) | ((u4)((c >> 24) * fade) << 24);
+	}
+}
+
+/*
+	Take the next chunk of job generation, or -1 once they are all taken or
+	a newer job has replaced it. A worker that woke late holds an old
+	generation and so never takes a chunk of the next job.
+*/
+s4 take_particle_chunk(u4 generation, s4 chunk_count)
+{
+	u8 next = particles.next_chunk.load();
+	for (;;)
+	{
+		if ((u4)(next >> 32) != generation) return -1;
+		s4 chunk = (s4)(u4)next;
+		if (chunk >= chunk_count) return -1;
+		if (particles.next_chunk.compare_exchange_weak(next, next + 1)) return chunk;
+	}
+}
+
+void run_particle_chunks(PARTICLE_JOB job, s4 count, u4 generation)
+{
+	s4 chunk_count = (count + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+	s4 finished = 0;
+	for (;;)
+	{
+		s4 chunk = take_particle_chunk(generation, chunk_count);
+		if (chunk < 0) break;
+		s4 begin = chunk * PARTICLE_CHUNK;
+		s4 end = begin + PARTICLE_CHUNK < count ? begin + PARTICLE_CHUNK : count;
+		switch (job)
+		{
+			case PARTICLE_JOB_UPDATE:
+			{
+				if (particles.use_avx2) update_particles_avx2(begin, end);
+				else update_particles_sse(begin, end);
+			} break;
+			case PARTICLE_JOB_KEYS:     { particle_depth_keys(begin, end); } break;
+			case PARTICLE_JOB_VERTICES: { particle_vertices(begin, end); } break;
+		}
+		finished++;
+	}
+	if (finished)
+	{
+		std::lock_guard<std::mutex> guard(particles.lock);
+		particles.chunks_left -= finished;
+	}
+}
+
+void particle_worker()
+{
+	u4 seen = 0;
+	for (;;)
+	{
+		PARTICLE_JOB job;
+		s4 count;
+		{
+			std::unique_lock<std::mutex> guard(particles.lock);
+			particles.wake.wait(guard, [&seen]{ return particles.generation != seen || !particles.running; });
+			if (!particles.running) return;
+			seen = particles.generation;
+			job = particles.job;
+			count = particles.job_count;
+			particles.active++;
+		}
+		run_particle_chunks(job, count, seen);
+		{
+			std::lock_guard<std::mutex> guard(particles.lock);
+			particles.active--;
+		}
+		particles.done.notify_one();
+	}
+}
+
+/*
+	Run job over [0, count) on every thread and wait for it.
+*/
+void run_particle_job(PARTICLE_JOB job, s4 count)
+{
+	if (count <= 0) return;
+	s4 chunk_count = (count + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+	u4 generation;
+	{
+		std::lock_guard<std::mutex> guard(particles.lock);
+		generation = ++particles.generation;
+		particles.job = job;
+		particles.job_count = count;
+		particles.next_chunk = (u8)generation << 32;
+		particles.chunks_left = chunk_count;
+	}
+	// a single chunk is not worth waking anyone for
+	if (chunk_count > 1) particles.wake.notify_all();
+	run_particle_chunks(job, count, generation);
+
+	std::unique_lock<std::mutex> guard(particles.lock);
+	particles.done.wait(guard, []{ return particles.chunks_left == 0 && particles.active == 0; });
+}
+
+b4 init_particles(s4 capacity)
+{
+	particles.enabled = false;
+	particles.count = 0;
+	particles.emitter_count = 0;
+	if (capacity <= 0) return true;
+	if (!point_sprite.program)
+	{
+		cerr << "particles need the point sprite shader" << endl;
+		return false;
+	}
+
+	capacity = (capacity + 7) & ~7;
+	particles.capacity = capacity;
+	particles.px = alloc_particle_array(capacity);
+	particles.py = alloc_particle_array(capacity);
+	particles.pz = alloc_particle_array(capacity);
+	particles.vx = alloc_particle_array(capacity);
+	particles.vy = alloc_particle_array(capacity);
+	particles.vz = alloc_particle_array(capacity);
+	particles.life = alloc_particle_array(capacity);
+	particles.inv_lifetime = alloc_particle_array(capacity);
+	particles.size = alloc_particle_array(capacity);
+	particles.color = (u4*)alloc_particle_array(capacity);
+	particles.keys = (u8*)malloc(capacity * sizeof(u8));
+	particles.sorted = (u8*)malloc(capacity * sizeof(u8));
+	particles.vertices = (PARTICLE_VERTEX*)malloc(capacity * sizeof(PARTICLE_VERTEX));
+	glGenBuffers(1, &particles.vbo);
+
+	particles.sort = true;
+	particles.gravity = glm::vec3(0.0f, 0.0f, -9.8f);
+	particles.drag = 0.3f;
+	particles.seed = 777;
+	particles.use_avx2 = SDL_HasAVX2();
+	particles.generation = 0;
+	particles.active = 0;
+	particles.running = true;
+	// the calling thread works too
+	s4 threads = SDL_GetCPUCount() - 1;
+	for (s4 i = 0; i < threads; i++)
+	{
+		particles.workers.push_back(std::thread(particle_worker));
+	}
+	particles.enabled = true;
+	cout << "particles: " << capacity << ", " << (particles.use_avx2 ? "AVX2" : "SSE") << ", "
+		 << threads + 1 << " threads" << endl;
+	return true;
+}
+
+void destroy_particles()
+{
+	if (!particles.enabled) return;
+	{
+		std::lock_guard<std::mutex> guard(particles.lock);
+		particles.running = false;
+	}
+	particles.wake.notify_all();
+	for (size_t i = 0; i < particles.workers.size(); i++)
+	{
+		particles.workers[i].join();
+	}
+	particles.workers.clear();
+	_mm_free(particles.px);
+	_mm_free(particles.py);
+	_mm_free(particles.pz);
+	_mm_free(particles.vx);
+	_mm_free(particles.vy);
+	_mm_free(particles.vz);
+	_mm_free(particles.life);
+	_mm_free(particles.inv_lifetime);
+	_mm_free(particles.size);
+	_mm_free(particles.color);
+	free(particles.keys);
+	free(particles.sorted);
+	free(particles.vertices);
+	glDeleteBuffers(1, &particles.vbo);
+	particles.enabled = false;
+}
+
+s4 add_particle_emitter(glm::vec3 position, glm::vec3 velocity, f4 spread, f4 rate, f4 lifetime, f4 size, u4 color)
+{
+	if (particles.emitter_count >= MAX_PARTICLE_EMITTERS) return -1;
+	PARTICLE_EMITTER &e = particles.emitters[particles.emitter_count];
+	e.position = position;
+	e.velocity = velocity;
+	e.spread = spread;
+	e.rate = rate;
+	e.lifetime = lifetime;
+	e.size = size;
+	e.color = color;
+	e.accumulator = 0.0f;
+	return particles.emitter_count++;
+}
+
+void emit_particles(PARTICLE_EMITTER &e, f4 dt)
+{
+	e.accumulator += e.rate * dt;
+	s4 n = (s4)e.accumulator;
+	e.accumulator -= n;
+	if (n > particles.capacity - particles.count) n = particles.capacity - particles.count;
+	for (s4 k = 0; k < n; k++)
+	{
+		s4 i = particles.count++;
+		particles.px[i] = e.position.x;
+		particles.py[i] = e.position.y;
+		particles.pz[i] = e.position.z;
+		particles.vx[i] = e.velocity.x + (particle_random() * 2.0f - 1.0f) * e.spread;
+		particles.vy[i] = e.velocity.y + (particle_random() * 2.0f - 1.0f) * e.spread;
+		particles.vz[i] = e.velocity.z + (particle_random() * 2.0f - 1.0f) * e.spread;
+		// spread the lifetimes a little so an emitter does not die in waves
+		f4 lifetime = e.lifetime * (0.75f + 0.5f * particle_random());
+		particles.life[i] = lifetime;
+		particles.inv_lifetime[i] = 1.0f / lifetime;
+		particles.size[i] = e.size;
+		particles.color[i] = e.color;
+	}
+}
+
+/*
+	Fill the slots of dead particles with live ones from the end.
+*/
+void compact_particles()
+{
+	s4 i = 0;
+	s4 last = particles.count - 1;
+	while (i <= last)
+	{
+		if (particles.life[i] > 0.0f) { i++; continue; }
+		while (last > i && particles.life[last] <= 0.0f) last--;
+		if (last > i)
+		{
+			particles.px[i] = particles.px[last];
+			particles.py[i] = particles.py[last];
+			particles.pz[i] = particles.pz[last];
+			particles.vx[i] = particles.vx[last];
+			particles.vy[i] = particles.vy[last];
+			particles.vz[i] = particles.vz[last];
+			particles.life[i] = particles.life[last];
+			particles.inv_lifetime[i] = particles.inv_lifetime[last];
+			particles.size[i] = particles.size[last];
+			particles.color[i] = particles.color[last];
+			i++;
+		}
+		last--;
+	}
+	particles.count = i;
+}
+
+void update_particles(f4 dt)
+{
+	if (!particles.enabled) return;
+	particles.dt = dt;
+	particles.damping = powf(1.0f - particles.drag, dt);
+	particles.dead = 0;
+	run_particle_job(PARTICLE_JOB_UPDATE, particles.count);
+	if (particles.dead > 0) compact_particles();
+	for (s4 i = 0; i < particles.emitter_count; i++)
+	{
+		emit_particles(particles.emitters[i], dt);
+	}
+	stats.particles = particles.count;
+}
+
+/*
+	Stable LSD radix sort of keys on their upper 32 bits. Passes where every
+	key has the same digit are skipped.
+*/
+void sort_particle_keys()
+{
+	s4 count = particles.count;
+	s4 histogram[PARTICLE_RADIX_PASSES][PARTICLE_RADIX_SIZE];
+	memset(histogram, 0, sizeof(histogram));
+	for (s4 i = 0; i < count; i++)
+	{
+		u4 key = (u4)(particles.keys[i] >> 32);
+		for (s4 p = 0; p < PARTICLE_RADIX_PASSES; p++)
+		{
+			histogram[p][(key >> (p * PARTICLE_RADIX_BITS)) & (PARTICLE_RADIX_SIZE - 1)]++;
+		}
+	}
+
+	u8* from = particles.keys;
+	u8* to = particles.sorted;
+	for (s4 p = 0; p < PARTICLE_RADIX_PASSES; p++)
+	{
+		s4* h = histogram[p];
+		u4 first_digit = (u4)(from[0] >> (32 + p * PARTICLE_RADIX_BITS)) & (PARTICLE_RADIX_SIZE - 1);
+		if (h[first_digit] == count) continue;
+
+		s4 offset = 0;
+		for (s4 d = 0; d < PARTICLE_RADIX_SIZE; d++)
+		{
+			s4 n = h[d];
+			h[d] = offset;
+			offset += n;
+		}
+		s4 shift = 32 + p * PARTICLE_RADIX_BITS;
+		for (s4 i = 0; i < count; i++)
+		{
+			u8 k = from[i];
+			to[h[(k >> shift) & (PARTICLE_RADIX_SIZE - 1)]++] = k;
+		}
+		u8* t = from;
+		from = to;
+		to = t;
+	}
+	// an odd number of passes leaves the result in the scratch array
+	if (from != particles.keys)
+	{
+		particles.sorted = particles.keys;
+		particles.keys = from;
+	}
+}
+
+/*
+	Draw every live particle into the bound framebuffer. Call after the
+	opaque scene.
+*/
+void render_particles(glm::mat4 &view, glm::mat4 &projection, s4 viewport_height)
+{
+	if (!particles.enabled || particles.count == 0) return;
+	s4 count = particles.count;
+
+	if (particles.sort)
+	{
+		particles.view_z = glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+		run_particle_job(PARTICLE_JOB_KEYS, count);
+		sort_particle_keys();
+	}
+	run_particle_job(PARTICLE_JOB_VERTICES, count);
+
+	glBindBuffer(GL_ARRAY_BUFFER, particles.vbo);
+	// new storage every frame, the driver never waits on last frame's draw
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(PARTICLE_VERTEX), particles.vertices, GL_STREAM_DRAW);
+
+	POINT_SPRITE_SHADER &s = point_sprite;
+	glUseProgram(s.program);
+	glm::mat4 model(1.0f);
+	glUniformMatrix4fv(s.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
+	glUniform3f(s.uniform_scale, 1.0f, 1.0f, 1.0f);
+	set_camera_uniforms(s.uniform_view, s.uniform_proj, view, projection);
+	glUniform1f(s.uniform_viewport_height, (f4)viewport_height);
+
+	GLsizei stride = sizeof(PARTICLE_VERTEX);
+	glEnableVertexAttribArray(s.attribute_coord3d);
+	glEnableVertexAttribArray(s.attribute_point_size);
+	glEnableVertexAttribArray(s.attribute_point_color);
+	glVertexAttribPointer(s.attribute_coord3d, 3, GL_FLOAT, GL_FALSE, stride, 0);
+	glVertexAttribPointer(s.attribute_point_size, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(PARTICLE_VERTEX, size));
+	glVertexAttribPointer(s.attribute_point_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(PARTICLE_VERTEX, color));
+
+	glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	glEnable(GL_POINT_SPRITE);
+	glDepthMask(GL_FALSE);
+	glDrawArrays(GL_POINTS, 0, count);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_POINT_SPRITE);
+	glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+
+	glDisableVertexAttribArray(s.attribute_coord3d);
+	glDisableVertexAttribArray(s.attribute_point_size);
+	glDisableVertexAttribArray(s.attribute_point_color);
+	stats.draws++;
+}
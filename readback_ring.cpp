@@ -0,0 +1,154 @@
+/*
+	Readback ring.
+
+	A few pixel pack buffers used in turn so glReadPixels never stalls the
+	GL thread. The owner takes the next buffer with next_readback(), reads
+	into it between begin_readback() and end_readback(), and end_readback()
+	drops a fence behind the reads. Buffers whose fence has signalled are
+	handed to the owner's retire function, oldest first, normally a few
+	frames later; next_readback() only waits when the GPU is a whole ring
+	behind. Without sync objects mapping waits instead, but the ring keeps
+	that rare.
+
+	Whatever the owner needs to know about a readback (frame number, tile
+	layout) lives in its own array indexed like ring.buffers.
+*/
+
+#define READBACK_RING_SIZE 3 // readbacks in flight on the GPU
+
+struct READBACK_BUFFER
+{
+	gu pbo;
+	GLsync fence;
+	u4 capacity;
+	b4 pending;
+	b4 mapped;
+};
+
+struct READBACK_RING
+{
+	READBACK_BUFFER buffers[READBACK_RING_SIZE];
+	s4 next; // the oldest buffer, and the one the next readback goes into
+	b4 has_sync;
+};
+
+// called with a buffer whose reads have landed, map it with map_readback()
+typedef void (*READBACK_RETIRE)(s4 index);
+
+void init_readback_ring(READBACK_RING &ring)
+{
+	for (s4 i = 0; i < READBACK_RING_SIZE; i++)
+	{
+		READBACK_BUFFER &b = ring.buffers[i];
+		glGenBuffers(1, &b.pbo);
+		b.fence = 0;
+		b.capacity = 0;
+		b.pending = false;
+		b.mapped = false;
+	}
+	ring.next = 0;
+	ring.has_sync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+}
+
+b4 readback_ready(READBACK_RING &ring, s4 index, b4 wait)
+{
+	READBACK_BUFFER &b = ring.buffers[index];
+	if (!ring.has_sync || !b.fence) return true;
+	GLenum r = glClientWaitSync(b.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+	return r == GL_ALREADY_SIGNALED || r == GL_CONDITION_SATISFIED;
+}
+
+/*
+	Retire every readback that has landed and return the index of the
+	buffer to read into next. ring.next is the oldest, and nothing after a
+	buffer that has not landed is retired, so the owner sees readbacks in
+	the order it issued them.
+*/
+s4 next_readback(READBACK_RING &ring, READBACK_RETIRE retire)
+{
+	for (s4 i = 0; i < READBACK_RING_SIZE; i++)
+	{
+		s4 index = (ring.next + i) % READBACK_RING_SIZE;
+		if (!ring.buffers[index].pending) continue;
+		if (!readback_ready(ring, index, false)) break;
+		retire(index);
+	}
+	if (ring.buffers[ring.next].pending)
+	{
+		// the GPU is a whole ring behind, this is the only place we wait
+		readback_ready(ring, ring.next, true);
+		retire(ring.next);
+	}
+	return ring.next;
+}
+
+/*
+	Bind the buffer from next_readback() as GL_PIXEL_PACK_BUFFER with room
+	for bytes. glReadPixels offsets are relative to its start.
+*/
+void begin_readback(READBACK_RING &ring, u4 bytes)
+{
+	READBACK_BUFFER &b = ring.buffers[ring.next];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+	if (b.capacity < bytes)
+	{
+		b.capacity = bytes;
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, 0, GL_STREAM_READ);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+}
+
+void end_readback(READBACK_RING &ring)
+{
+	READBACK_BUFFER &b = ring.buffers[ring.next];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (ring.has_sync) b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	b.pending = true;
+	ring.next = (ring.next + 1) % READBACK_RING_SIZE;
+}
+
+/*
+	For the retire function. Returns 0 if the buffer could not be mapped,
+	unmap_readback() must be called either way.
+*/
+const u1* map_readback(READBACK_RING &ring, s4 index)
+{
+	READBACK_BUFFER &b = ring.buffers[index];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+	const u1* data = (const u1*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	b.mapped = data != 0;
+	return data;
+}
+
+void unmap_readback(READBACK_RING &ring, s4 index)
+{
+	READBACK_BUFFER &b = ring.buffers[index];
+	if (b.mapped) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (b.fence)
+	{
+		glDeleteSync(b.fence);
+		b.fence = 0;
+	}
+	b.mapped = false;
+	b.pending = false;
+}
+
+/*
+	Retire whatever is still in flight, oldest first, and delete the buffers.
+*/
+void destroy_readback_ring(READBACK_RING &ring, READBACK_RETIRE retire)
+{
+	for (s4 i = 0; i < READBACK_RING_SIZE; i++)
+	{
+		s4 index = (ring.next + i) % READBACK_RING_SIZE;
+		READBACK_BUFFER &b = ring.buffers[index];
+		if (b.pending)
+		{
+			readback_ready(ring, index, true);
+			retire(index);
+		}
+		glDeleteBuffers(1, &b.pbo);
+		b.pbo = 0;
+	}
+}
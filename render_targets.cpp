@@ -0,0 +1,302 @@
+/*
+	Render target manager.
+
+	Every offscreen framebuffer lives in one fixed pool. Targets are either
+	window sized (they follow the window through resize_render_targets())
+	or transient (acquired by description for a pass and released after).
+	Released transient targets stay allocated and are handed back to the
+	next pass asking for the same format and size, so a steady state frame
+	never creates GL objects. Resizing re-specifies storage on the existing
+	texture and renderbuffer names instead of generating new ones.
+*/
+
+#define MAX_RENDER_TARGETS 16
+// free transient targets nobody asked for in this many frames are deleted
+#define RENDER_TARGET_MAX_IDLE_FRAMES 120
+
+struct RENDER_TARGET_DESC
+{
+	s4 width;
+	s4 height;
+	GLenum color_format;  // sized internal format, GL_RGB8 / GL_RGBA8 / GL_RGBA16F
+	b4 depth_stencil;     // adds a GL_DEPTH24_STENCIL8 attachment
+	s4 samples;           // > 1 renders into multisampled storage resolved into color_texture
+};
+
+struct RENDER_TARGET
+{
+	RENDER_TARGET_DESC desc;
+	gu fbo;            // bind this to draw
+	gu color_texture;  // single sampled color result, sample from this
+	gu color_msaa;     // multisampled color renderbuffer, msaa only
+	gu depth_stencil;  // renderbuffer, multisampled when desc.samples > 1
+	gu resolve_fbo;    // wraps color_texture, msaa only
+	b4 allocated;
+	b4 in_use;
+	b4 window_sized;
+	u4 last_used_frame;
+};
+
+struct RENDER_TARGET_POOL
+{
+	RENDER_TARGET targets[MAX_RENDER_TARGETS];
+	u4 frame;
+	s4 max_samples;
+} rt_pool;
+
+// window sized color + depth/stencil target behind FBO / offscreen_texture
+RENDER_TARGET* offscreen_target;
+
+b4 same_render_target_desc(const RENDER_TARGET_DESC &a, const RENDER_TARGET_DESC &b)
+{
+	return a.width == b.width && a.height == b.height &&
+		a.color_format == b.color_format &&
+		a.depth_stencil == b.depth_stencil &&
+		a.samples == b.samples;
+}
+
+void render_target_pixel_format(GLenum internal_format, GLenum &format, GLenum &type)
+{
+	switch (internal_format)
+	{
+		case GL_RGBA8:   { format = GL_RGBA; type = GL_UNSIGNED_BYTE; } break;
+		case GL_RGBA16F: { format = GL_RGBA; type = GL_HALF_FLOAT; } break;
+		default:         { format = GL_RGB;  type = GL_UNSIGNED_BYTE; } break;
+	}
+}
+
+/*
+	(Re)specify storage for every attachment of rt using rt.desc.
+	Generates the GL names the first time only.
+*/
+b4 allocate_render_target_storage(RENDER_TARGET &rt)
+{
+	RENDER_TARGET_DESC &d = rt.desc;
+	b4 msaa = d.samples > 1;
+	b4 first_time = !rt.allocated;
+
+	if (first_time)
+	{
+		glGenFramebuffers(1, &rt.fbo);
+		glGenTextures(1, &rt.color_texture);
+		if (d.depth_stencil) glGenRenderbuffers(1, &rt.depth_stencil);
+		if (msaa)
+		{
+			glGenRenderbuffers(1, &rt.color_msaa);
+			glGenFramebuffers(1, &rt.resolve_fbo);
+		}
+	}
+
+	GLenum format, type;
+	render_target_pixel_format(d.color_format, format, type);
+	glBindTexture(GL_TEXTURE_2D, rt.color_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, d.color_format, d.width, d.height, 0, format, type, 0);
+	if (first_time)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (msaa)
+	{
+		glBindRenderbuffer(GL_RENDERBUFFER, rt.color_msaa);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, d.samples, d.color_format, d.width, d.height);
+	}
+	if (d.depth_stencil)
+	{
+		glBindRenderbuffer(GL_RENDERBUFFER, rt.depth_stencil);
+		if (msaa)
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, d.samples, GL_DEPTH24_STENCIL8, d.width, d.height);
+		else
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, d.width, d.height);
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (first_time)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+		if (msaa)
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rt.color_msaa);
+		else
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt.color_texture, 0);
+		if (d.depth_stencil)
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rt.depth_stencil);
+
+		if (msaa)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, rt.resolve_fbo);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt.color_texture, 0);
+		}
+	}
+
+	// set before the status check so a failed target can still be destroyed
+	rt.allocated = true;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "glCheckFramebufferStatus() ERROR: " << status << endl;
+		return false;
+	}
+	return true;
+}
+
+void destroy_render_target(RENDER_TARGET &rt)
+{
+	if (!rt.allocated) return;
+	glDeleteFramebuffers(1, &rt.fbo);
+	glDeleteTextures(1, &rt.color_texture);
+	if (rt.color_msaa) glDeleteRenderbuffers(1, &rt.color_msaa);
+	if (rt.depth_stencil) glDeleteRenderbuffers(1, &rt.depth_stencil);
+	if (rt.resolve_fbo) glDeleteFramebuffers(1, &rt.resolve_fbo);
+	rt = RENDER_TARGET();
+}
+
+void init_render_targets()
+{
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		rt_pool.targets[i] = RENDER_TARGET();
+	}
+	rt_pool.frame = 0;
+	rt_pool.max_samples = 1;
+	glGetIntegerv(GL_MAX_SAMPLES, &rt_pool.max_samples);
+}
+
+/*
+	Returns a free target matching desc, creating one only when the pool has
+	nothing reusable. Returns 0 if the pool is exhausted.
+*/
+RENDER_TARGET* acquire_render_target(RENDER_TARGET_DESC desc)
+{
+	if (desc.samples > rt_pool.max_samples) desc.samples = rt_pool.max_samples;
+	if (desc.samples < 1) desc.samples = 1;
+
+	RENDER_TARGET* empty = 0;
+	RENDER_TARGET* oldest_free = 0;
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		RENDER_TARGET &rt = rt_pool.targets[i];
+		if (!rt.allocated)
+		{
+			if (!empty) empty = &rt;
+			continue;
+		}
+		if (rt.in_use || rt.window_sized) continue;
+		if (same_render_target_desc(rt.desc, desc))
+		{
+			rt.in_use = true;
+			rt.last_used_frame = rt_pool.frame;
+			return &rt;
+		}
+		if (!oldest_free || rt.last_used_frame < oldest_free->last_used_frame)
+		{
+			oldest_free = &rt;
+		}
+	}
+
+	RENDER_TARGET* rt = empty;
+	if (!rt && oldest_free)
+	{
+		// pool is full, recycle the least recently used free target
+		destroy_render_target(*oldest_free);
+		rt = oldest_free;
+	}
+	if (!rt)
+	{
+		cout << "ERROR: render target pool exhausted." << endl;
+		return 0;
+	}
+
+	rt->desc = desc;
+	if (!allocate_render_target_storage(*rt))
+	{
+		destroy_render_target(*rt);
+		return 0;
+	}
+	rt->in_use = true;
+	rt->last_used_frame = rt_pool.frame;
+	return rt;
+}
+
+void release_render_target(RENDER_TARGET* rt)
+{
+	if (rt) rt->in_use = false;
+}
+
+/*
+	Acquire a target that lives until shutdown and follows the window size.
+*/
+RENDER_TARGET* acquire_window_render_target(GLenum color_format, b4 depth_stencil, s4 samples)
+{
+	RENDER_TARGET_DESC desc;
+	desc.width = sgl.width;
+	desc.height = sgl.height;
+	desc.color_format = color_format;
+	desc.depth_stencil = depth_stencil;
+	desc.samples = samples;
+	RENDER_TARGET* rt = acquire_render_target(desc);
+	if (rt) rt->window_sized = true;
+	return rt;
+}
+
+/*
+	Copy the multisampled color into color_texture. No-op without msaa.
+*/
+void resolve_render_target(RENDER_TARGET* rt)
+{
+	if (rt->desc.samples <= 1) return;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, rt->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rt->resolve_fbo);
+	glBlitFramebuffer(0, 0, rt->desc.width, rt->desc.height,
+		0, 0, rt->desc.width, rt->desc.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/*
+	Call once per frame. Ages out free transient targets that are no longer
+	requested, e.g. ones left at the old size after a resize.
+*/
+void begin_render_target_frame()
+{
+	rt_pool.frame++;
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		RENDER_TARGET &rt = rt_pool.targets[i];
+		if (rt.allocated && !rt.in_use && !rt.window_sized &&
+			rt_pool.frame - rt.last_used_frame > RENDER_TARGET_MAX_IDLE_FRAMES)
+		{
+			destroy_render_target(rt);
+		}
+	}
+}
+
+/*
+	Re-specifies storage for targets from acquire_window_render_target().
+	Transient targets are left alone: their size need not follow the window
+	(e.g. the batch atlas), and stale ones age out in begin_render_target_frame().
+*/
+void resize_render_targets(s4 width, s4 height)
+{
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		RENDER_TARGET &rt = rt_pool.targets[i];
+		if (!rt.allocated || !rt.window_sized) continue;
+		if (rt.desc.width == width && rt.desc.height == height) continue;
+		rt.desc.width = width;
+		rt.desc.height = height;
+		allocate_render_target_storage(rt);
+	}
+}
+
+void destroy_render_targets()
+{
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		destroy_render_target(rt_pool.targets[i]);
+	}
+}
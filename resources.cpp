@@ -0,0 +1,389 @@
+/*
+	GPU resource manager.
+
+	Textures and meshes are referred to by RESOURCE_HANDLE. A handle packs
+	a slot index in the low 16 bits and the slot's generation in the high
+	16 bits. A slot's generation is bumped when it is freed, so a stale
+	handle is caught instead of aliasing whatever reuses the slot. 0 is
+	never a valid handle.
+
+	Every resident resource records its byte size from its internal format
+	and when it was last used. Once per frame enforce_resource_budget()
+	evicts the least recently used textures and meshes until the total,
+	plus whatever the render target pool holds, fits the budget. Only
+	resources untouched for RESOURCE_MIN_IDLE_FRAMES are evicted, so
+	anything drawn recently is never thrashed.
+	Evicted resources keep their slot. The next acquire_texture() or
+	acquire_mesh() reloads them, textures from the asset pack, their file
+	on disk or the pixels they were registered with, and meshes from the
+	PRIMITIVE CPU copies.
+
+	Acquire only on the GL thread, before recording draw lists.
+*/
+
+#define MAX_RESOURCES 1024
+#define RESOURCE_MIN_IDLE_FRAMES 60
+#define RESOURCE_DEFAULT_BUDGET_MB 256
+#define RESOURCE_PATH_LENGTH 256
+
+typedef u4 RESOURCE_HANDLE;
+
+enum RESOURCE_TYPE
+{
+	RESOURCE_FREE,
+	RESOURCE_TEXTURE,
+	RESOURCE_MESH,
+};
+
+struct RESOURCE
+{
+	s4 type;
+	u2 generation;
+	b4 resident;
+	b4 pinned; // never evicted
+	u8 bytes;
+	u4 last_used_frame;
+
+	// texture
+	gu texture;
+	char path[RESOURCE_PATH_LENGTH];
+	s4 channels; // forced channel count when loading, 3 or 4
+	b4 hdr;      // float source, stored as RGBA16F / R11F_G11F_B10F
+	const void* pixels; // already decoded, e.g. in the scene snapshot, uploaded instead of loading path
+	s4 width;
+	s4 height;
+
+	// mesh
+	PRIMITIVE* mesh;
+};
+
+struct RESOURCES
+{
+	RESOURCE slots[MAX_RESOURCES];
+	u8 budget;
+	u8 resident_bytes;
+	u4 frame;
+	u4 evictions;
+	u4 reloads;
+	b4 warned_over_budget;
+} resources;
+
+/*
+	Bytes per texel as the driver is likely to store it. Three channel
+	8 bit formats are padded to four by practically every implementation.
+*/
+u4 texture_format_bytes(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+		case GL_R8:               return 1;
+		case GL_RG8:              return 2;
+		case GL_RGB8:
+		case GL_RGB:
+		case GL_RGBA8:
+		case GL_RGBA:
+		case GL_R11F_G11F_B10F:
+		case GL_DEPTH24_STENCIL8: return 4;
+		case GL_RGBA16F:          return 8;
+		case GL_RGB32F:           return 12;
+		case GL_RGBA32F:          return 16;
+		default:                  return 4;
+	}
+}
+
+/*
+	Smallest internal format that keeps what the source has.
+*/
+GLenum choose_texture_format(s4 channels, b4 hdr)
+{
+	if (hdr) return channels == 4 ? GL_RGBA16F : GL_R11F_G11F_B10F;
+	return channels == 4 ? GL_RGBA8 : GL_RGB8;
+}
+
+u8 render_target_bytes()
+{
+	u8 bytes = 0;
+	for (s4 i = 0; i < MAX_RENDER_TARGETS; i++)
+	{
+		RENDER_TARGET &rt = rt_pool.targets[i];
+		if (!rt.allocated) continue;
+		u8 pixels = (u8)rt.desc.width * rt.desc.height;
+		s4 samples = rt.desc.samples > 1 ? rt.desc.samples : 1;
+		bytes += pixels * texture_format_bytes(rt.desc.color_format);
+		if (samples > 1) bytes += pixels * samples * texture_format_bytes(rt.desc.color_format);
+		if (rt.desc.depth_stencil) bytes += pixels * samples * texture_format_bytes(GL_DEPTH24_STENCIL8);
+	}
+	return bytes;
+}
+
+u8 primitive_bytes(const PRIMITIVE &p)
+{
+	u8 bytes = p.vertex_count * 3 * sizeof(GLfloat);
+	if (p.cpu_colors) bytes += p.vertex_count * 3 * sizeof(GLfloat);
+	if (p.cpu_uvs) bytes += p.vertex_count * 2 * sizeof(GLfloat);
+	for (s4 level = 0; level < p.lod_count; level++)
+	{
+		bytes += p.lod_index_count[level] * sizeof(GLushort);
+	}
+	return bytes;
+}
+
+void init_resources(u8 budget_mb)
+{
+	memset(&resources, 0, sizeof(resources));
+	resources.budget = (budget_mb ? budget_mb : RESOURCE_DEFAULT_BUDGET_MB) * 1024 * 1024;
+	for (s4 i = 0; i < MAX_RESOURCES; i++)
+	{
+		resources.slots[i].generation = 1;
+	}
+}
+
+inline RESOURCE_HANDLE make_resource_handle(s4 index)
+{
+	return ((u4)resources.slots[index].generation << 16) | (u4)index;
+}
+
+/*
+	Slot behind handle, or 0 when the handle is stale or invalid.
+*/
+RESOURCE* get_resource(RESOURCE_HANDLE handle)
+{
+	u4 index = handle & 0xFFFF;
+	u2 generation = (u2)(handle >> 16);
+	if (!handle || index >= MAX_RESOURCES) return 0;
+	RESOURCE &r = resources.slots[index];
+	if (r.type == RESOURCE_FREE || r.generation != generation) return 0;
+	return &r;
+}
+
+s4 allocate_resource_slot(s4 type)
+{
+	for (s4 i = 0; i < MAX_RESOURCES; i++)
+	{
+		if (resources.slots[i].type != RESOURCE_FREE) continue;
+		RESOURCE &r = resources.slots[i];
+		u2 generation = r.generation;
+		memset(&r, 0, sizeof(r));
+		r.generation = generation;
+		r.type = type;
+		return i;
+	}
+	cout << "ERROR: out of resource slots" << endl;
+	return -1;
+}
+
+b4 load_texture_resource(RESOURCE &r)
+{
+	s4 width = r.width, height = r.height, n;
+	void* pixels = (void*)r.pixels;
+	if (!pixels)
+	{
+		if (r.hdr) pixels = asset_load_imagef(r.path, &width, &height, &n, r.channels);
+		else pixels = asset_load_image(r.path, &width, &height, &n, r.channels);
+	}
+	if (!pixels)
+	{
+		cerr << "ERROR: could not load texture " << r.path << endl;
+		return false;
+	}
+
+	GLenum internal_format = choose_texture_format(r.channels, r.hdr);
+	GLenum format = r.channels == 4 ? GL_RGBA : GL_RGB;
+	glGenTextures(1, &r.texture);
+	glBindTexture(GL_TEXTURE_2D, r.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// rows of a 3 channel image are not 4 byte aligned for every width
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format,
+		r.hdr ? GL_FLOAT : GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (!r.pixels) stbi_image_free(pixels);
+
+	r.bytes = (u8)width * height * texture_format_bytes(internal_format);
+	return true;
+}
+
+void make_resident(RESOURCE &r)
+{
+	if (r.resident) return;
+	if (r.type == RESOURCE_TEXTURE)
+	{
+		if (!load_texture_resource(r)) return;
+	}
+	else
+	{
+		// the LOD levels were simplified once and kept, only upload them
+		upload_primitive(*r.mesh);
+		upload_mesh_lods(*r.mesh);
+		r.bytes = primitive_bytes(*r.mesh);
+	}
+	r.resident = true;
+	resources.resident_bytes += r.bytes;
+}
+
+void evict_resource(RESOURCE &r)
+{
+	if (!r.resident) return;
+	if (r.type == RESOURCE_TEXTURE)
+	{
+		glDeleteTextures(1, &r.texture);
+		r.texture = 0;
+	}
+	else
+	{
+		PRIMITIVE &p = *r.mesh;
+		unload_mesh_lods(p);
+		glDeleteBuffers(1, &p.verts);
+		glDeleteBuffers(1, &p.colors);
+		glDeleteBuffers(1, &p.uv_coords);
+		glDeleteBuffers(1, &p.indices);
+		p.verts = p.colors = p.uv_coords = p.indices = 0;
+		p.lod_indices[0] = 0;
+	}
+	r.resident = false;
+	resources.resident_bytes -= r.bytes;
+}
+
+/*
+	Register an image file. channels is 3 or 4, hdr loads it as float.
+	The texture is created right away and again after every eviction.
+*/
+RESOURCE_HANDLE load_texture(const char* path, s4 channels, b4 hdr = false)
+{
+	s4 index = allocate_resource_slot(RESOURCE_TEXTURE);
+	if (index < 0) return 0;
+	RESOURCE &r = resources.slots[index];
+	strncpy(r.path, path, RESOURCE_PATH_LENGTH - 1);
+	r.channels = channels;
+	r.hdr = hdr;
+	r.last_used_frame = resources.frame;
+	make_resident(r);
+	return make_resource_handle(index);
+}
+
+/*
+	Register an image decoded to channels, floats when hdr. pixels are not
+	copied and must stay valid until the resource is freed.
+*/
+RESOURCE_HANDLE load_texture_pixels(const char* path, s4 channels, b4 hdr, s4 width, s4 height, const void* pixels)
+{
+	s4 index = allocate_resource_slot(RESOURCE_TEXTURE);
+	if (index < 0) return 0;
+	RESOURCE &r = resources.slots[index];
+	strncpy(r.path, path, RESOURCE_PATH_LENGTH - 1);
+	r.channels = channels;
+	r.hdr = hdr;
+	r.pixels = pixels;
+	r.width = width;
+	r.height = height;
+	r.last_used_frame = resources.frame;
+	make_resident(r);
+	return make_resource_handle(index);
+}
+
+/*
+	Register a primitive whose GL buffers were created by create_*().
+*/
+RESOURCE_HANDLE register_mesh(PRIMITIVE &p, b4 pinned = false)
+{
+	s4 index = allocate_resource_slot(RESOURCE_MESH);
+	if (index < 0) return 0;
+	RESOURCE &r = resources.slots[index];
+	r.mesh = &p;
+	r.pinned = pinned;
+	r.resident = true;
+	r.bytes = primitive_bytes(p);
+	r.last_used_frame = resources.frame;
+	resources.resident_bytes += r.bytes;
+	return make_resource_handle(index);
+}
+
+void free_resource(RESOURCE_HANDLE handle)
+{
+	RESOURCE* r = get_resource(handle);
+	if (!r) return;
+	evict_resource(*r);
+	r->type = RESOURCE_FREE;
+	r->generation++;
+	if (r->generation == 0) r->generation = 1;
+}
+
+/*
+	GL texture for handle, reloading it if it was evicted. 0 on failure.
+*/
+gu acquire_texture(RESOURCE_HANDLE handle)
+{
+	RESOURCE* r = get_resource(handle);
+	if (!r || r->type != RESOURCE_TEXTURE) return 0;
+	if (!r->resident)
+	{
+		make_resident(*r);
+		resources.reloads++;
+	}
+	r->last_used_frame = resources.frame;
+	return r->texture;
+}
+
+PRIMITIVE* acquire_mesh(RESOURCE_HANDLE handle)
+{
+	RESOURCE* r = get_resource(handle);
+	if (!r || r->type != RESOURCE_MESH) return 0;
+	if (!r->resident)
+	{
+		make_resident(*r);
+		resources.reloads++;
+	}
+	r->last_used_frame = resources.frame;
+	return r->mesh;
+}
+
+void begin_resource_frame()
+{
+	resources.frame++;
+}
+
+/*
+	Evict least recently used resources until everything fits the budget.
+*/
+void enforce_resource_budget()
+{
+	u8 fixed = render_target_bytes();
+	while (resources.resident_bytes + fixed > resources.budget)
+	{
+		RESOURCE* oldest = 0;
+		for (s4 i = 0; i < MAX_RESOURCES; i++)
+		{
+			RESOURCE &r = resources.slots[i];
+			if (r.type == RESOURCE_FREE || !r.resident || r.pinned) continue;
+			if (resources.frame - r.last_used_frame < RESOURCE_MIN_IDLE_FRAMES) continue;
+			if (!oldest || r.last_used_frame < oldest->last_used_frame) oldest = &r;
+		}
+		if (!oldest)
+		{
+			if (!resources.warned_over_budget)
+			{
+				cerr << "WARNING: " << (resources.resident_bytes + fixed) / (1024 * 1024)
+					 << " MB of GPU memory in use this frame, over the "
+					 << resources.budget / (1024 * 1024) << " MB budget" << endl;
+				resources.warned_over_budget = true;
+			}
+			return;
+		}
+		evict_resource(*oldest);
+		resources.evictions++;
+	}
+	resources.warned_over_budget = false;
+}
+
+void destroy_resources()
+{
+	for (s4 i = 0; i < MAX_RESOURCES; i++)
+	{
+		RESOURCE &r = resources.slots[i];
+		if (r.type == RESOURCE_FREE) continue;
+		free_resource(make_resource_handle(i));
+	}
+}
@@ -0,0 +1,626 @@
+/*
+	Scene snapshot.
+
+	A snapshot is the loaded scene saved as one flat file, so the next
+	start maps it instead of building the meshes and their LODs, decoding
+	the images and compiling the shaders:
+
+		SNAPSHOT_HEADER
+		blobs                vertex and index arrays, decoded pixels, program binaries
+		SNAPSHOT_MESH[mesh_count]
+		SNAPSHOT_TEXTURE[texture_count]
+		MATERIAL_BLOCK[material_count]
+		SNAPSHOT_OBJECT[object_count]
+		SNAPSHOT_SHADER[shader_count]
+
+	Everything refers to everything else by offset from the start of the
+	file, so the file can be mapped anywhere and is used in place. Blobs
+	sit at multiples of SCENE_SNAPSHOT_ALIGNMENT. The PRIMITIVE CPU copies
+	point into the mapping and the GL buffers and textures are uploaded
+	straight from it; textures evicted by resources.cpp are uploaded from
+	it again. Nothing is copied on the CPU.
+
+	input_hash covers everything the scene is built from: the version, the
+	driver (program binaries only load on the one that made them), the
+	shader defines that depend on the context, and the size and time of
+	every input asset, or its pack entry when it is packed. A snapshot
+	whose hash differs is ignored, the scene is rebuilt and the snapshot
+	written again after the first frame. Bump SCENE_SNAPSHOT_VERSION when
+	create_*(), the LOD settings or the demo scene change, they are code
+	and not covered by the hash. A shader binary the driver rejects anyway
+	is compiled from source like any variant missing from the cache.
+
+	Snapshots are written to a temporary file and renamed over the old one,
+	so a crash never leaves a truncated snapshot behind.
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SCENE_SNAPSHOT_MAGIC 0x504E5353 // "SSNP"
+#define SCENE_SNAPSHOT_VERSION 1
+#define SCENE_SNAPSHOT_ALIGNMENT 64
+#define SNAPSHOT_NAME_LENGTH 32
+
+struct SNAPSHOT_HEADER
+{
+	u4 magic;
+	u4 version;
+	u8 input_hash;
+	u8 size; // of the whole file, catches truncation
+	u4 mesh_count;
+	u4 texture_count;
+	u4 material_count;
+	u4 object_count;
+	u4 shader_count;
+	u4 pad;
+	u8 meshes; // table offsets
+	u8 textures;
+	u8 materials;
+	u8 objects;
+	u8 shaders;
+};
+
+struct SNAPSHOT_MESH
+{
+	char name[SNAPSHOT_NAME_LENGTH]; // one of scene_meshes
+	s4 vertex_count;
+	s4 index_count;
+	f4 radius;
+	b4 pinned;
+	u8 verts; // offsets, 0 when the mesh has none
+	u8 colors;
+	u8 uvs;
+	s4 lod_count;
+	s4 lod_index_count[MAX_LODS];
+	u8 lod_indices[MAX_LODS]; // level 0 is the base index array
+};
+
+struct SNAPSHOT_TEXTURE
+{
+	char path[RESOURCE_PATH_LENGTH];
+	s4 width;
+	s4 height;
+	s4 channels;
+	b4 hdr;
+	u8 pixels;
+	u8 size;
+};
+
+struct SNAPSHOT_OBJECT
+{
+	s4 mesh;    // index into the mesh table
+	s4 texture; // index into the texture table, -1 for none
+	s4 material;
+	b4 occluder;
+	f4 position[3];
+};
+
+struct SNAPSHOT_SHADER
+{
+	u4 key; // SHADER_KEY bits
+	u4 format; // from glGetProgramBinary()
+	u8 binary;
+	u8 size;
+};
+
+struct SCENE_MESH
+{
+	const char* name;
+	PRIMITIVE* mesh;
+};
+
+// every PRIMITIVE a snapshot can fill, by name so the order can change
+SCENE_MESH scene_meshes[] = {
+	{ "plane",   &plane },
+	{ "cube",    &cube },
+	{ "pyramid", &pyramid },
+};
+const s4 SCENE_MESH_COUNT = sizeof(scene_meshes) / sizeof(scene_meshes[0]);
+
+struct SCENE_SNAPSHOT
+{
+	s4 fd;
+	u1* base;
+	u8 size;
+	const SNAPSHOT_HEADER* header;
+} snapshot;
+
+u8 snapshot_hash(u8 hash, const void* data, u8 size)
+{
+	const u1* bytes = (const u1*)data;
+	for (u8 i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+inline u8 snapshot_hash_string(u8 hash, const char* s)
+{
+	return snapshot_hash(hash, s, s ? strlen(s) + 1 : 0);
+}
+
+/*
+	See the top of the file. Only stats the inputs, nothing is read.
+*/
+u8 snapshot_input_hash(const char* const* inputs, s4 count)
+{
+	u8 hash = 14695981039346656037ULL;
+	u4 version = SCENE_SNAPSHOT_VERSION;
+	hash = snapshot_hash(hash, &version, sizeof(version));
+	hash = snapshot_hash_string(hash, (const char*)glGetString(GL_VENDOR));
+	hash = snapshot_hash_string(hash, (const char*)glGetString(GL_RENDERER));
+	hash = snapshot_hash_string(hash, (const char*)glGetString(GL_VERSION));
+	b4 context[2] = { uniform_blocks.enabled, lighting.enabled };
+	hash = snapshot_hash(hash, context, sizeof(context));
+
+	struct stat pack_stat;
+	memset(&pack_stat, 0, sizeof(pack_stat));
+	if (asset_pack.header) fstat(asset_pack.fd, &pack_stat);
+	for (s4 i = 0; i < count; i++)
+	{
+		hash = snapshot_hash_string(hash, inputs[i]);
+		u8 stamp[2] = { 0, 0 }; // size, modification time
+		s4 index = find_asset(inputs[i]);
+		if (index >= 0)
+		{
+			const ASSET_PACK_ENTRY &e = asset_pack.entries[index];
+			hash = snapshot_hash(hash, &e, sizeof(e));
+			stamp[0] = pack_stat.st_size;
+			stamp[1] = pack_stat.st_mtime;
+		}
+		else
+		{
+			struct stat st;
+			if (stat(inputs[i], &st) == 0)
+			{
+				stamp[0] = st.st_size;
+				stamp[1] = st.st_mtime;
+			}
+		}
+		hash = snapshot_hash(hash, stamp, sizeof(stamp));
+	}
+	return hash;
+}
+
+inline b4 snapshot_range(u8 offset, u8 size)
+{
+	return offset <= snapshot.size && size <= snapshot.size - offset;
+}
+
+// optional arrays have offset 0
+inline b4 snapshot_optional_range(u8 offset, u8 size)
+{
+	return !offset || snapshot_range(offset, size);
+}
+
+inline const u1* snapshot_data(u8 offset)
+{
+	return offset ? snapshot.base + offset : 0;
+}
+
+PRIMITIVE* find_scene_mesh(const char* name)
+{
+	for (s4 i = 0; i < SCENE_MESH_COUNT; i++)
+	{
+		if (!strncmp(scene_meshes[i].name, name, SNAPSHOT_NAME_LENGTH)) return scene_meshes[i].mesh;
+	}
+	return 0;
+}
+
+/*
+	Every offset in the tables points inside the file and every index
+	inside its table, so loading cannot fail halfway.
+*/
+b4 validate_scene_snapshot()
+{
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	if (h->size != snapshot.size ||
+		!snapshot_range(h->meshes, (u8)h->mesh_count * sizeof(SNAPSHOT_MESH)) ||
+		!snapshot_range(h->textures, (u8)h->texture_count * sizeof(SNAPSHOT_TEXTURE)) ||
+		!snapshot_range(h->materials, (u8)h->material_count * sizeof(MATERIAL_BLOCK)) ||
+		!snapshot_range(h->objects, (u8)h->object_count * sizeof(SNAPSHOT_OBJECT)) ||
+		!snapshot_range(h->shaders, (u8)h->shader_count * sizeof(SNAPSHOT_SHADER)))
+	{
+		return false;
+	}
+
+	const SNAPSHOT_MESH* meshes = (const SNAPSHOT_MESH*)snapshot_data(h->meshes);
+	for (u4 i = 0; i < h->mesh_count; i++)
+	{
+		const SNAPSHOT_MESH &m = meshes[i];
+		if (!memchr(m.name, 0, SNAPSHOT_NAME_LENGTH) || !find_scene_mesh(m.name) ||
+			m.lod_count < 1 || m.lod_count > MAX_LODS || m.index_count != m.lod_index_count[0] ||
+			!m.verts || !m.lod_indices[0] ||
+			!snapshot_range(m.verts, (u8)m.vertex_count * 3 * sizeof(GLfloat)) ||
+			!snapshot_optional_range(m.colors, (u8)m.vertex_count * 3 * sizeof(GLfloat)) ||
+			!snapshot_optional_range(m.uvs, (u8)m.vertex_count * 2 * sizeof(GLfloat)))
+		{
+			return false;
+		}
+		for (s4 level = 0; level < m.lod_count; level++)
+		{
+			if (!snapshot_range(m.lod_indices[level], (u8)m.lod_index_count[level] * sizeof(GLushort))) return false;
+		}
+	}
+	const SNAPSHOT_TEXTURE* textures = (const SNAPSHOT_TEXTURE*)snapshot_data(h->textures);
+	for (u4 i = 0; i < h->texture_count; i++)
+	{
+		const SNAPSHOT_TEXTURE &t = textures[i];
+		u8 size = (u8)t.width * t.height * t.channels * (t.hdr ? sizeof(f4) : 1);
+		if (!memchr(t.path, 0, RESOURCE_PATH_LENGTH) || t.size != size || !snapshot_range(t.pixels, t.size)) return false;
+	}
+	const SNAPSHOT_OBJECT* objects = (const SNAPSHOT_OBJECT*)snapshot_data(h->objects);
+	for (u4 i = 0; i < h->object_count; i++)
+	{
+		const SNAPSHOT_OBJECT &o = objects[i];
+		if (o.mesh < 0 || (u4)o.mesh >= h->mesh_count || o.texture >= (s4)h->texture_count ||
+			o.material < 0 || (u4)o.material >= h->material_count)
+		{
+			return false;
+		}
+	}
+	const SNAPSHOT_SHADER* shaders = (const SNAPSHOT_SHADER*)snapshot_data(h->shaders);
+	for (u4 i = 0; i < h->shader_count; i++)
+	{
+		if (!snapshot_range(shaders[i].binary, shaders[i].size)) return false;
+	}
+	return true;
+}
+
+void close_scene_snapshot()
+{
+	if (!snapshot.base) return;
+	munmap(snapshot.base, snapshot.size);
+	close(snapshot.fd);
+	memset(&snapshot, 0, sizeof(snapshot));
+}
+
+/*
+	Map the snapshot at path if it was made from the current inputs. Call
+	after init_uniform_blocks() and init_lighting(), their outcome is part
+	of the hash. Returns false when the scene has to be rebuilt.
+*/
+b4 open_scene_snapshot(const char* path, const char* const* inputs, s4 count)
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (snapshot.fd < 0)
+	{
+		cout << "scene snapshot: " << path << " not found, rebuilding" << endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(snapshot.fd, &st) != 0 || (u8)st.st_size < sizeof(SNAPSHOT_HEADER))
+	{
+		cerr << "ERROR: " << path << " is not a scene snapshot" << endl;
+		close(snapshot.fd);
+		return false;
+	}
+	snapshot.size = st.st_size;
+	void* base = mmap(0, snapshot.size, PROT_READ, MAP_PRIVATE, snapshot.fd, 0);
+	if (base == MAP_FAILED)
+	{
+		cerr << "ERROR: could not map " << path << endl;
+		close(snapshot.fd);
+		return false;
+	}
+	snapshot.base = (u1*)base;
+	snapshot.header = (const SNAPSHOT_HEADER*)snapshot.base;
+
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	if (h->magic != SCENE_SNAPSHOT_MAGIC || !validate_scene_snapshot())
+	{
+		cerr << "ERROR: " << path << " is not a valid scene snapshot, rebuilding" << endl;
+		close_scene_snapshot();
+		return false;
+	}
+	if (h->version != SCENE_SNAPSHOT_VERSION || h->input_hash != snapshot_input_hash(inputs, count))
+	{
+		cout << "scene snapshot: " << path << " is out of date, rebuilding" << endl;
+		close_scene_snapshot();
+		return false;
+	}
+	// everything is uploaded right away, read it ahead instead of faulting page by page
+	madvise(snapshot.base, snapshot.size, MADV_WILLNEED);
+	return true;
+}
+
+/*
+	Cache every program binary as a shader variant. Call before the
+	shaders are created, variants found in the cache are not compiled.
+*/
+void load_snapshot_shaders()
+{
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	if (!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) return;
+	const SNAPSHOT_SHADER* shaders = (const SNAPSHOT_SHADER*)snapshot_data(h->shaders);
+	for (u4 i = 0; i < h->shader_count; i++)
+	{
+		const SNAPSHOT_SHADER &s = shaders[i];
+		if (find_shader_variant(SHADER_KEY(s.key)) >= 0) continue;
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, s.format, snapshot_data(s.binary), (GLsizei)s.size);
+		GLint link_ok = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+		if (!link_ok)
+		{
+			glDeleteProgram(program);
+			continue;
+		}
+		add_shader_variant(SHADER_KEY(s.key), program);
+	}
+}
+
+/*
+	Point the primitives at their arrays in the snapshot and upload them,
+	LODs included. Replaces create_*() and create_mesh_lods().
+*/
+void load_snapshot_meshes()
+{
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	const SNAPSHOT_MESH* meshes = (const SNAPSHOT_MESH*)snapshot_data(h->meshes);
+	for (u4 i = 0; i < h->mesh_count; i++)
+	{
+		const SNAPSHOT_MESH &m = meshes[i];
+		PRIMITIVE* p = find_scene_mesh(m.name);
+		memset(p, 0, sizeof(*p));
+		p->cpu_verts = (const GLfloat*)snapshot_data(m.verts);
+		p->cpu_colors = (const GLfloat*)snapshot_data(m.colors);
+		p->cpu_uvs = (const GLfloat*)snapshot_data(m.uvs);
+		p->cpu_indices = (const GLushort*)snapshot_data(m.lod_indices[0]);
+		p->vertex_count = m.vertex_count;
+		p->index_count = m.index_count;
+		p->radius = m.radius;
+		upload_primitive(*p);
+		// the levels stay in the mapping, so reloads after eviction upload
+		// them from there too
+		p->lod_count = m.lod_count;
+		for (s4 level = 0; level < m.lod_count; level++)
+		{
+			p->cpu_lod_indices[level] = (const GLushort*)snapshot_data(m.lod_indices[level]);
+			p->lod_index_count[level] = m.lod_index_count[level];
+		}
+		upload_mesh_lods(*p);
+	}
+}
+
+void load_snapshot_materials()
+{
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	const MATERIAL_BLOCK* materials = (const MATERIAL_BLOCK*)snapshot_data(h->materials);
+	for (u4 i = 0; i < h->material_count; i++)
+	{
+		create_material(materials[i].color);
+	}
+}
+
+/*
+	Register the meshes and the textures with resources.cpp and add the
+	objects. Call after init_resources().
+*/
+void load_snapshot_objects()
+{
+	const SNAPSHOT_HEADER* h = snapshot.header;
+	const SNAPSHOT_MESH* meshes = (const SNAPSHOT_MESH*)snapshot_data(h->meshes);
+	const SNAPSHOT_TEXTURE* textures = (const SNAPSHOT_TEXTURE*)snapshot_data(h->textures);
+	const SNAPSHOT_OBJECT* snapshot_objects = (const SNAPSHOT_OBJECT*)snapshot_data(h->objects);
+
+	std::vector<RESOURCE_HANDLE> mesh_handles(h->mesh_count);
+	for (u4 i = 0; i < h->mesh_count; i++)
+	{
+		mesh_handles[i] = register_mesh(*find_scene_mesh(meshes[i].name), meshes[i].pinned);
+	}
+	std::vector<RESOURCE_HANDLE> texture_handles(h->texture_count);
+	for (u4 i = 0; i < h->texture_count; i++)
+	{
+		const SNAPSHOT_TEXTURE &t = textures[i];
+		texture_handles[i] = load_texture_pixels(t.path, t.channels, t.hdr, t.width, t.height, snapshot_data(t.pixels));
+	}
+
+	for (u4 i = 0; i < h->object_count && object_count < MAX_OBJECTS; i++)
+	{
+		const SNAPSHOT_OBJECT &s = snapshot_objects[i];
+		RENDER_OBJECT &o = objects[object_count++];
+		o.mesh = find_scene_mesh(meshes[s.mesh].name);
+		o.mesh_resource = mesh_handles[s.mesh];
+		o.texture_resource = s.texture >= 0 ? texture_handles[s.texture] : 0;
+		o.texture = 0;
+		o.material = s.material;
+		o.image = 0; // only the software rasterizer reads images, it never uses a snapshot
+		o.position = glm::vec3(s.position[0], s.position[1], s.position[2]);
+		o.lod = 0;
+		o.occluder = s.occluder;
+	}
+	cout << "scene snapshot: " << h->mesh_count << " meshes, " << h->texture_count << " textures, "
+		 << h->shader_count << " shaders, " << snapshot.size / 1024 << " KB mapped" << endl;
+}
+
+struct SNAPSHOT_WRITER
+{
+	FILE* file;
+	u8 offset;
+	b4 ok;
+};
+
+/*
+	Append data at the next aligned offset and return that offset.
+*/
+u8 write_snapshot_blob(SNAPSHOT_WRITER &w, const void* data, u8 size)
+{
+	static const u1 zeros[SCENE_SNAPSHOT_ALIGNMENT] = {};
+	u8 padding = (SCENE_SNAPSHOT_ALIGNMENT - w.offset % SCENE_SNAPSHOT_ALIGNMENT) % SCENE_SNAPSHOT_ALIGNMENT;
+	if (padding && fwrite(zeros, 1, padding, w.file) != padding) w.ok = false;
+	u8 offset = w.offset + padding;
+	if (size && fwrite(data, 1, size, w.file) != size) w.ok = false;
+	w.offset = offset + size;
+	return offset;
+}
+
+RESOURCE* find_mesh_resource(PRIMITIVE* mesh)
+{
+	for (s4 i = 0; i < MAX_RESOURCES; i++)
+	{
+		RESOURCE &r = resources.slots[i];
+		if (r.type == RESOURCE_MESH && r.mesh == mesh) return &r;
+	}
+	return 0;
+}
+
+/*
+	Save the scene as it is now. The LOD index arrays only exist in GL
+	buffers and are read back from there, the images are decoded once more.
+*/
+b4 write_scene_snapshot(const char* path, const char* const* inputs, s4 count)
+{
+	std::string temp_path = std::string(path) + ".tmp";
+	SNAPSHOT_WRITER w;
+	w.file = fopen(temp_path.c_str(), "wb");
+	if (!w.file)
+	{
+		cerr << "ERROR: could not write " << temp_path << endl;
+		return false;
+	}
+	w.offset = 0;
+	w.ok = true;
+
+	SNAPSHOT_HEADER h;
+	memset(&h, 0, sizeof(h));
+	write_snapshot_blob(w, &h, sizeof(h)); // filled in at the end
+
+	std::vector<SNAPSHOT_MESH> meshes;
+	for (s4 i = 0; i < SCENE_MESH_COUNT; i++)
+	{
+		PRIMITIVE &p = *scene_meshes[i].mesh;
+		if (!p.cpu_verts) continue;
+		SNAPSHOT_MESH m;
+		memset(&m, 0, sizeof(m));
+		strncpy(m.name, scene_meshes[i].name, SNAPSHOT_NAME_LENGTH - 1);
+		m.vertex_count = p.vertex_count;
+		m.index_count = p.index_count;
+		m.radius = p.radius;
+		RESOURCE* r = find_mesh_resource(&p);
+		m.pinned = r && r->pinned;
+		m.verts = write_snapshot_blob(w, p.cpu_verts, (u8)p.vertex_count * 3 * sizeof(GLfloat));
+		if (p.cpu_colors) m.colors = write_snapshot_blob(w, p.cpu_colors, (u8)p.vertex_count * 3 * sizeof(GLfloat));
+		if (p.cpu_uvs) m.uvs = write_snapshot_blob(w, p.cpu_uvs, (u8)p.vertex_count * 2 * sizeof(GLfloat));
+		m.lod_indices[0] = write_snapshot_blob(w, p.cpu_indices, (u8)p.index_count * sizeof(GLushort));
+		m.lod_index_count[0] = p.index_count;
+		m.lod_count = 1;
+		// the levels are kept on the CPU, evicted or not
+		for (s4 level = 1; level < p.lod_count; level++)
+		{
+			m.lod_indices[level] = write_snapshot_blob(w, p.cpu_lod_indices[level],
+				(u8)p.lod_index_count[level] * sizeof(GLushort));
+			m.lod_index_count[level] = p.lod_index_count[level];
+			m.lod_count++;
+		}
+		meshes.push_back(m);
+	}
+
+	std::vector<SNAPSHOT_TEXTURE> textures;
+	std::vector<RESOURCE_HANDLE> texture_handles;
+	std::vector<SNAPSHOT_OBJECT> scene_objects;
+	for (s4 i = 0; i < object_count; i++)
+	{
+		RENDER_OBJECT &o = objects[i];
+		SNAPSHOT_OBJECT s;
+		memset(&s, 0, sizeof(s));
+		s.mesh = -1;
+		for (size_t m = 0; m < meshes.size(); m++)
+		{
+			if (find_scene_mesh(meshes[m].name) == o.mesh) s.mesh = (s4)m;
+		}
+		if (s.mesh < 0) continue; // not a scene mesh, nothing to refer to
+		s.texture = -1;
+		RESOURCE* r = get_resource(o.texture_resource);
+		if (r && r->type == RESOURCE_TEXTURE)
+		{
+			size_t t = std::find(texture_handles.begin(), texture_handles.end(), o.texture_resource) - texture_handles.begin();
+			if (t == texture_handles.size())
+			{
+				SNAPSHOT_TEXTURE st;
+				memset(&st, 0, sizeof(st));
+				strncpy(st.path, r->path, RESOURCE_PATH_LENGTH - 1);
+				st.channels = r->channels;
+				st.hdr = r->hdr;
+				s4 n;
+				void* pixels;
+				if (r->hdr) pixels = asset_load_imagef(r->path, &st.width, &st.height, &n, r->channels);
+				else pixels = asset_load_image(r->path, &st.width, &st.height, &n, r->channels);
+				if (!pixels)
+				{
+					cerr << "ERROR: could not load texture " << r->path << " for the scene snapshot" << endl;
+					w.ok = false;
+					break;
+				}
+				st.size = (u8)st.width * st.height * st.channels * (st.hdr ? sizeof(f4) : 1);
+				st.pixels = write_snapshot_blob(w, pixels, st.size);
+				stbi_image_free(pixels);
+				textures.push_back(st);
+				texture_handles.push_back(o.texture_resource);
+			}
+			s.texture = (s4)t;
+		}
+		s.material = o.material;
+		s.occluder = o.occluder;
+		s.position[0] = o.position.x;
+		s.position[1] = o.position.y;
+		s.position[2] = o.position.z;
+		scene_objects.push_back(s);
+	}
+
+	std::vector<SNAPSHOT_SHADER> shaders;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+	{
+		std::vector<u1> binary;
+		for (s4 i = 0; i < shader_variants.count; i++)
+		{
+			GLint length = 0;
+			glGetProgramiv(shader_variants.variants[i].program, GL_PROGRAM_BINARY_LENGTH, &length);
+			if (length <= 0) continue;
+			binary.resize(length);
+			GLenum format = 0;
+			GLsizei written = 0;
+			glGetProgramBinary(shader_variants.variants[i].program, length, &written, &format, binary.data());
+			if (written <= 0) continue;
+			SNAPSHOT_SHADER s;
+			s.key = shader_variants.variants[i].key.bits;
+			s.format = format;
+			s.size = written;
+			s.binary = write_snapshot_blob(w, binary.data(), written);
+			shaders.push_back(s);
+		}
+	}
+
+	h.magic = SCENE_SNAPSHOT_MAGIC;
+	h.version = SCENE_SNAPSHOT_VERSION;
+	h.input_hash = snapshot_input_hash(inputs, count);
+	h.mesh_count = meshes.size();
+	h.texture_count = textures.size();
+	h.material_count = uniform_blocks.material_count;
+	h.object_count = scene_objects.size();
+	h.shader_count = shaders.size();
+	h.meshes = write_snapshot_blob(w, meshes.data(), meshes.size() * sizeof(SNAPSHOT_MESH));
+	h.textures = write_snapshot_blob(w, textures.data(), textures.size() * sizeof(SNAPSHOT_TEXTURE));
+	h.materials = write_snapshot_blob(w, uniform_blocks.materials, (u8)h.material_count * sizeof(MATERIAL_BLOCK));
+	h.objects = write_snapshot_blob(w, scene_objects.data(), scene_objects.size() * sizeof(SNAPSHOT_OBJECT));
+	h.shaders = write_snapshot_blob(w, shaders.data(), shaders.size() * sizeof(SNAPSHOT_SHADER));
+	h.size = w.offset;
+	if (fseek(w.file, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w.file) != 1) w.ok = false;
+	if (fclose(w.file) != 0) w.ok = false;
+
+	if (!w.ok || rename(temp_path.c_str(), path) != 0)
+	{
+		cerr << "ERROR: could not write scene snapshot " << path << endl;
+		remove(temp_path.c_str());
+		return false;
+	}
+	cout << "scene snapshot: wrote " << path << ", " << h.mesh_count << " meshes, " << h.texture_count << " textures, "
+		 << h.shader_count << " shaders, " << h.size / 1024 << " KB" << endl;
+	return true;
+}
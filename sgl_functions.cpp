@@ -6,7 +6,8 @@
 
 char* file_read(const char* filename, int* size);
 void print_log(GLuint object);
-GLuint create_shader(const char* filename, GLenum type);
+GLuint begin_shader(const char* filename, GLenum type, const char* defines = 0);
+GLuint create_shader(const char* filename, GLenum type, const char* defines = 0);
 GLuint create_program(const char* vertexfile, const char *fragmentfile);
 GLint get_attrib(GLuint program, const char *name);
 GLint get_uniform(GLuint program, const char *name);
@@ -69,11 +70,14 @@ void print_log(GLuint object) {
 }
 
 /**
- * Compile the shader from file 'filename', with error handling
+ * Submit the shader from file 'filename' for compilation without waiting
+ * on the result, so drivers that compile in the background are not stalled.
+ * The source comes from the asset pack when it has it, see asset_pack.cpp.
+ * 'defines' (may be 0) is inserted after the version line, see shader_variants.cpp
  */
-GLuint create_shader(const char* filename, GLenum type) {
-	const GLchar* source = file_read(filename, NULL);
-	if (source == NULL) {
+GLuint begin_shader(const char* filename, GLenum type, const char* defines) {
+	ASSET_DATA asset;
+	if (!asset_load(filename, asset)) {
 		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
 					   "Error opening %s: %s", filename, SDL_GetError());
 		return 0;
@@ -107,13 +111,25 @@ GLuint create_shader(const char* filename, GLenum type) {
 
 	const GLchar* sources[] = {
 		version,
+		defines ? defines : "",
 		precision,
-		source
+		(const GLchar*)asset.data
 	};
-	glShaderSource(res, 3, sources, NULL);
-	free((void*)source);
+	glShaderSource(res, 4, sources, NULL);
+	asset_release(asset);
 	
 	glCompileShader(res);
+	return res;
+}
+
+/**
+ * Compile the shader from file 'filename', with error handling
+ */
+GLuint create_shader(const char* filename, GLenum type, const char* defines) {
+	GLuint res = begin_shader(filename, type, defines);
+	if (res == 0)
+		return 0;
+
 	GLint compile_ok = GL_FALSE;
 	glGetShaderiv(res, GL_COMPILE_STATUS, &compile_ok);
 	if (compile_ok == GL_FALSE) {
@@ -198,11 +214,16 @@ b4 create_sgl()
 	sgl.window = SDL_CreateWindow("Chess",
 		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
 		sgl.width, sgl.height,
-		SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
+		SDL_WINDOW_RESIZABLE | (sgl.software ? 0 : SDL_WINDOW_OPENGL));
 	if (sgl.window == NULL) {
+		if (sgl.software) {
+			cout << "No window (" << SDL_GetError() << "), rendering headless" << endl;
+			return true;
+		}
 		cerr << "Error: can't create window: " << SDL_GetError() << endl;
 		return false;
 	}
+	if (sgl.software) return true;
 
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
 	// SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
@@ -232,8 +253,57 @@ b4 create_sgl()
 	return true;
 }
 
+/*
+	Keep the mesh's static arrays around for CPU side processing and
+	compute its bounding radius. Counts are in floats / indices, colors
+	and uvs follow the vertex count and may be 0.
+*/
+void set_primitive_cpu_data(PRIMITIVE &p, const GLfloat* verts, s4 float_count,
+	const GLfloat* colors, const GLfloat* uvs, const GLushort* indices, s4 index_count)
+{
+	p.cpu_verts = verts;
+	p.cpu_colors = colors;
+	p.cpu_uvs = uvs;
+	p.cpu_indices = indices;
+	p.vertex_count = float_count / 3;
+	p.index_count = index_count;
+	p.radius = 0.0f;
+	for (s4 i = 0; i < p.vertex_count; i++)
+	{
+		glm::vec3 v(verts[i*3+0], verts[i*3+1], verts[i*3+2]);
+		f4 r = glm::length(v);
+		if (r > p.radius) p.radius = r;
+	}
+	p.lod_count = 1;
+	p.lod_index_count[0] = index_count;
+	p.cpu_lod_indices[0] = indices;
+}
+
+GLuint upload_buffer(GLenum target, const void* data, s4 size)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(target, buffer);
+	glBufferData(target, size, data, GL_STATIC_DRAW);
+	return buffer;
+}
+
+/*
+	Create the GL buffers from the CPU copies. Does nothing on the software
+	rasterizer, which reads the CPU copies directly.
+*/
+void upload_primitive(PRIMITIVE &p)
+{
+	if (sgl.software) return;
+	p.verts = upload_buffer(GL_ARRAY_BUFFER, p.cpu_verts, p.vertex_count * 3 * sizeof(GLfloat));
+	if (p.cpu_colors) p.colors = upload_buffer(GL_ARRAY_BUFFER, p.cpu_colors, p.vertex_count * 3 * sizeof(GLfloat));
+	if (p.cpu_uvs) p.uv_coords = upload_buffer(GL_ARRAY_BUFFER, p.cpu_uvs, p.vertex_count * 2 * sizeof(GLfloat));
+	p.indices = upload_buffer(GL_ELEMENT_ARRAY_BUFFER, p.cpu_indices, p.index_count * sizeof(GLushort));
+	p.lod_indices[0] = p.indices;
+}
+
 void create_cube() {
-	GLfloat cube_vertices[] = {
+	static GLfloat cube_vertices[] = {
 		 -1.0f, -1.0f, 1.0f,//VO - 0
     1.0f, -1.0f, 1.0f,//V1 - 1
     -1.0f, 1.0f, 1.0f,//V2 - 2
@@ -264,11 +334,8 @@ void create_cube() {
     1.0f, -1.0f, -1.0f,//V5 - 22
     1.0f, 1.0f, -1.0f,//V7 - 23
 	};
-	glGenBuffers(1, &cube.verts);
-	glBindBuffer(GL_ARRAY_BUFFER, cube.verts);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
 	
-	GLfloat cube_colors_black[] = {
+	static GLfloat cube_colors_black[] = {
 		// top colors
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15,
@@ -299,11 +366,8 @@ void create_cube() {
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15, };
-	glGenBuffers(1, &cube.colors);
-	glBindBuffer(GL_ARRAY_BUFFER, cube.colors);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_colors_black), cube_colors_black, GL_STATIC_DRAW);
 	
-	GLushort cube_elements[] = {
+	static GLushort cube_elements[] = {
     0,1,2, 1,3,2,
     6,7,5, 6,5,4,
     8,9,10, 9,10,11,
@@ -311,11 +375,8 @@ void create_cube() {
     17,16,18, 17,18,19,
     20,21,22, 21,22,23
 	};
-	glGenBuffers(1, &cube.indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_elements), cube_elements, GL_STATIC_DRAW);
 
-	GLfloat cube_uv[] = {
+	static GLfloat cube_uv[] = {
 		    0.0f, 1.0f,//0
     1.0f, 1.0f,//1
     0.0f, 0.0f,//2
@@ -346,54 +407,51 @@ void create_cube() {
     0.0f, 0.0f,//2
     1.0f, 0.0f,//3
 	};
-	glGenBuffers(1, &cube.uv_coords);
-	glBindBuffer(GL_ARRAY_BUFFER, cube.uv_coords);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_uv), cube_uv, GL_STATIC_DRAW);
+
+	set_primitive_cpu_data(cube,
+		cube_vertices, sizeof(cube_vertices)/sizeof(GLfloat),
+		cube_colors_black, cube_uv,
+		cube_elements, sizeof(cube_elements)/sizeof(GLushort));
+	upload_primitive(cube);
 }
 
 void create_plane() {
-	GLfloat plane_vertices[] = {
+	static GLfloat plane_vertices[] = {
 		 -1.0f, -1.0f, 1.0f,//VO - 0
 	    1.0f, -1.0f, 1.0f,//V1 - 1
 	    -1.0f, 1.0f, 1.0f,//V2 - 2
 	    1.0f, 1.0f, 1.0f,//V3 - 3
 	};
-	glGenBuffers(1, &plane.verts);
-	glBindBuffer(GL_ARRAY_BUFFER, plane.verts);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(plane_vertices), plane_vertices, GL_STATIC_DRAW);
 	
-	GLfloat plane_colors_black[] = {
+	static GLfloat plane_colors_black[] = {
 		// top colors
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15,
 		0.06, 0.52, 0.15,
 	};
-	glGenBuffers(1, &plane.colors);
-	glBindBuffer(GL_ARRAY_BUFFER, plane.colors);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(plane_colors_black), plane_colors_black, GL_STATIC_DRAW);
 	
-	GLushort plane_elements[] = {
+	static GLushort plane_elements[] = {
     	0,1,2, 1,3,2,
 	};
-	glGenBuffers(1, &plane.indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, plane.indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(plane_elements), plane_elements, GL_STATIC_DRAW);
 
-	GLfloat plane_uv[] = {
+	static GLfloat plane_uv[] = {
 		0.0f, 1.0f,//0
     	1.0f, 1.0f,//1
     	0.0f, 0.0f,//2
     	1.0f, 0.0f,//3
 	};
-	glGenBuffers(1, &plane.uv_coords);
-	glBindBuffer(GL_ARRAY_BUFFER, plane.uv_coords);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(plane_uv), plane_uv, GL_STATIC_DRAW);
+
+	set_primitive_cpu_data(plane,
+		plane_vertices, sizeof(plane_vertices)/sizeof(GLfloat),
+		plane_colors_black, plane_uv,
+		plane_elements, sizeof(plane_elements)/sizeof(GLushort));
+	upload_primitive(plane);
 }
 
 void create_pyramid()
 {
-	GLfloat pyramid_vertices[] = {
+	static GLfloat pyramid_vertices[] = {
 		// top
 		-1.0, -1.0,  1.0,
 		1.0, -1.0,  1.0,
@@ -406,11 +464,8 @@ void create_pyramid()
 		-0.1,  0.1, -1.0,
 	};
 
-	glGenBuffers(1, &pyramid.verts);
-	glBindBuffer(GL_ARRAY_BUFFER, pyramid.verts);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(pyramid_vertices), pyramid_vertices, GL_STATIC_DRAW);
 	
-	GLfloat pyramid_colors[] = {
+	static GLfloat pyramid_colors[] = {
 		// top colors
 		0.1, 0.85, 0.815,
 		0.1, 0.85, 0.815,
@@ -421,11 +476,8 @@ void create_pyramid()
 		0.6, 0.99, 0.95,
 		0.6, 0.99, 0.95,
 		0.6, 0.99, 0.95 };
-	glGenBuffers(1, &pyramid.colors);
-	glBindBuffer(GL_ARRAY_BUFFER, pyramid.colors);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(pyramid_colors), pyramid_colors, GL_STATIC_DRAW);
 	
-	GLushort pyramid_elements[] = {
+	static GLushort pyramid_elements[] = {
 		// front
 		0, 1, 2,
 		2, 3, 0,
@@ -445,9 +497,6 @@ void create_pyramid()
 		3, 2, 6,
 		6, 7, 3,
 	};
-	glGenBuffers(1, &pyramid.indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pyramid.indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(pyramid_elements), pyramid_elements, GL_STATIC_DRAW);
 
 	// GLfloat pyramid_uv[] = {
 
@@ -455,128 +504,144 @@ void create_pyramid()
 	// glGenBuffers(1, &pyramid.uv_coords);
 	// glBindBuffer(GL_ARRAY_BUFFER, pyramid.uv_coords);
 	// glBufferData(GL_ARRAY_BUFFER, sizeof(pyramid_uv), pyramid_uv, GL_STATIC_DRAW);
+
+	set_primitive_cpu_data(pyramid,
+		pyramid_vertices, sizeof(pyramid_vertices)/sizeof(GLfloat),
+		pyramid_colors, 0,
+		pyramid_elements, sizeof(pyramid_elements)/sizeof(GLushort));
+	upload_primitive(pyramid);
 }
 
-b4 create_basic_shader()
+b4 link_shader_program(const char* vertexfile, const char* fragmentfile, GLuint &program, const char* defines = 0)
 {
 	GLint link_ok = GL_FALSE;
-	
+
 	GLuint vs, fs;
-	if ((vs = create_shader("basic.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader("basic.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	basic.program = glCreateProgram();
-	glAttachShader(basic.program, vs);
-	glAttachShader(basic.program, fs);
-	glLinkProgram(basic.program);
-	glGetProgramiv(basic.program, GL_LINK_STATUS, &link_ok);
+	if ((vs = create_shader(vertexfile, GL_VERTEX_SHADER, defines))   == 0) return false;
+	if ((fs = create_shader(fragmentfile, GL_FRAGMENT_SHADER, defines)) == 0) { glDeleteShader(vs); return false; }
+
+	program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	// without the hint a driver may not keep the binary scene_snapshot.cpp saves
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	glDetachShader(program, vs);
+	glDetachShader(program, fs);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
 	if (!link_ok) {
 		cerr << "glLinkProgram:";
-		print_log(basic.program);
+		print_log(program);
+		glDeleteProgram(program);
+		program = 0;
 		return false;
 	}
-	
-	basic.attribute_coord3d = get_attrib(basic.program, "coord3d"); 
-	
-	basic.uniform_scale = get_uniform(basic.program, "scale");
-	basic.uniform_model = get_uniform(basic.program, "model");
-	basic.uniform_view = get_uniform(basic.program, "view");
-	basic.uniform_proj = get_uniform(basic.program, "proj");
-	basic.uniform_color = get_uniform(basic.program, "in_color");
-	basic.uniform_alpha = get_uniform(basic.program, "in_alpha");
-	
 	return true;
 }
 
-b4 create_basic_texture_shader()
+/*
+	view and proj are members of camera_block when uniform blocks are on
+	and have no location of their own.
+*/
+void get_camera_uniforms(GLuint program, gi &view, gi &proj)
 {
-	GLint link_ok = GL_FALSE;
-	
-	GLuint vs, fs;
-	if ((vs = create_shader("basic_texture.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader("basic_texture.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	basic_texture.program = glCreateProgram();
-	glAttachShader(basic_texture.program, vs);
-	glAttachShader(basic_texture.program, fs);
-	glLinkProgram(basic_texture.program);
-	glGetProgramiv(basic_texture.program, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		cerr << "glLinkProgram:";
-		print_log(basic_texture.program);
-		return false;
-	}
-	
-	basic_texture.attribute_coord3d = get_attrib(basic_texture.program, "coord3d"); 
-	basic_texture.attribute_tex_coord2d = get_attrib(basic_texture.program, "tex_coord2d"); 
-	
-	basic_texture.uniform_scale = get_uniform(basic_texture.program, "scale");
-	basic_texture.uniform_model = get_uniform(basic_texture.program, "model");
-	basic_texture.uniform_view = get_uniform(basic_texture.program, "view");
-	basic_texture.uniform_proj = get_uniform(basic_texture.program, "proj");
-	basic_texture.uniform_tex_source = get_uniform(basic_texture.program, "tex_source");
-	
+	view = proj = -1;
+	if (uniform_blocks.enabled) return;
+	view = get_uniform(program, "view");
+	proj = get_uniform(program, "proj");
+}
+
+/*
+	The bind_*_shader functions look up every location on a freshly linked
+	program and then replace the global shader struct in one assignment, so
+	the renderer never sees a new program paired with stale locations.
+	Programs are owned by the variant cache in shader_variants.cpp.
+*/
+b4 bind_basic_shader(GLuint program)
+{
+	BASIC_SHADER s;
+	s.program = program;
+
+	s.attribute_coord3d = get_attrib(program, "coord3d"); 
 	
+	s.uniform_scale = get_uniform(program, "scale");
+	s.uniform_model = get_uniform(program, "model");
+	get_camera_uniforms(program, s.uniform_view, s.uniform_proj);
+	s.uniform_color = get_uniform(program, "in_color");
+	s.uniform_alpha = get_uniform(program, "in_alpha");
+
+	basic = s;
 	return true;
 }
 
-b4 create_color_verts_shader()
+b4 bind_basic_texture_shader(GLuint program)
 {
-	GLint link_ok = GL_FALSE;
-	
-	GLuint vs, fs;
-	if ((vs = create_shader("color_verts.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader("color_verts.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	color_verts.program = glCreateProgram();
-	glAttachShader(color_verts.program, vs);
-	glAttachShader(color_verts.program, fs);
-	glLinkProgram(color_verts.program);
-	glGetProgramiv(color_verts.program, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		cerr << "glLinkProgram:";
-		print_log(color_verts.program);
-		return false;
-	}
-	
-	color_verts.attribute_coord3d = get_attrib(color_verts.program, "coord3d"); 
-	color_verts.attribute_v_color = get_attrib(color_verts.program, "v_color"); 
-	
-	color_verts.uniform_scale = get_uniform(color_verts.program, "scale");
-	color_verts.uniform_model = get_uniform(color_verts.program, "model");
-	color_verts.uniform_view = get_uniform(color_verts.program, "view");
-	color_verts.uniform_proj = get_uniform(color_verts.program, "proj");
+	BASIC_TEXTURE_SHADER s;
+	s.program = program;
+
+	s.attribute_coord3d = get_attrib(program, "coord3d"); 
+	s.attribute_tex_coord2d = get_attrib(program, "tex_coord2d"); 
 	
+	s.uniform_scale = get_uniform(program, "scale");
+	s.uniform_model = get_uniform(program, "model");
+	get_camera_uniforms(program, s.uniform_view, s.uniform_proj);
+	s.uniform_tex_source = get_uniform(program, "tex_source");
+	s.uniform_material = uniform_blocks.enabled ? -1 : get_uniform(program, "material_color");
+
+	basic_texture = s;
 	return true;
 }
 
-b4 create_offscreen_shader()
+b4 bind_color_verts_shader(GLuint program)
 {
-	GLint link_ok = GL_FALSE;
-	
-	GLuint vs, fs;
-	if ((vs = create_shader("offscreen.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader("offscreen.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	offscreen.program = glCreateProgram();
-	glAttachShader(offscreen.program, vs);
-	glAttachShader(offscreen.program, fs);
-	glLinkProgram(offscreen.program);
-	glGetProgramiv(offscreen.program, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		cerr << "glLinkProgram:";
-		print_log(offscreen.program);
-		return false;
-	}
-	
-	offscreen.attribute_coord3d = get_attrib(offscreen.program, "coord3d"); 
+	COLOR_VERTS_SHADER s;
+	s.program = program;
+
+	s.attribute_coord3d = get_attrib(program, "coord3d"); 
+	s.attribute_v_color = get_attrib(program, "v_color"); 
 	
-	offscreen.uniform_scale = get_uniform(offscreen.program, "scale");
-	offscreen.uniform_model = get_uniform(offscreen.program, "model");
-	offscreen.uniform_view = get_uniform(offscreen.program, "view");
-	offscreen.uniform_proj = get_uniform(offscreen.program, "proj");
-	offscreen.uniform_color = get_uniform(offscreen.program, "in_color");
+	s.uniform_scale = get_uniform(program, "scale");
+	s.uniform_model = get_uniform(program, "model");
+	get_camera_uniforms(program, s.uniform_view, s.uniform_proj);
+	s.uniform_material = uniform_blocks.enabled ? -1 : get_uniform(program, "material_color");
+
+	color_verts = s;
+	return true;
+}
+
+b4 bind_offscreen_shader(GLuint program)
+{
+	OFFSCREEN_SHADER s;
+	s.program = program;
+
+	s.attribute_coord3d = get_attrib(program, "coord3d"); 
 	
+	s.uniform_scale = get_uniform(program, "scale");
+	s.uniform_model = get_uniform(program, "model");
+	get_camera_uniforms(program, s.uniform_view, s.uniform_proj);
+	s.uniform_color = get_uniform(program, "in_color");
+
+	offscreen = s;
+	return true;
+}
+
+b4 bind_point_sprite_shader(GLuint program)
+{
+	POINT_SPRITE_SHADER s;
+	s.program = program;
+
+	s.attribute_coord3d = get_attrib(program, "coord3d");
+	s.attribute_point_size = get_attrib(program, "point_size");
+	s.attribute_point_color = get_attrib(program, "point_color");
+
+	s.uniform_scale = get_uniform(program, "scale");
+	s.uniform_model = get_uniform(program, "model");
+	get_camera_uniforms(program, s.uniform_view, s.uniform_proj);
+	s.uniform_viewport_height = get_uniform(program, "viewport_height");
+
+	point_sprite = s;
 	return true;
 }
 
@@ -607,11 +672,12 @@ GLuint my_create_texture(s4 sw, s4 sh, b4 alpha, unsigned char* image_data = 0,
 	// Give the image to OpenGL
 	if (image_data == 0)
 	{
+		// half float / packed float instead of 32 bit floats, 8 and 4 bytes per texel instead of 16 and 12
 		if (alpha) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, 0);
 		}
 		else { 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, 0); // TODO: test if necessary
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, width, height, 0, GL_RGB, GL_FLOAT, 0);
 		}
 	}
 	else
@@ -628,41 +694,17 @@ GLuint my_create_texture(s4 sw, s4 sh, b4 alpha, unsigned char* image_data = 0,
 
 b4 create_offscreen_texture()
 {
-	offscreen_texture = 0;
-	offscreen_texture = my_create_texture(sgl.width, sgl.height, false, 0, true);
-	if (offscreen_texture == 0)
+	init_render_targets();
+
+	offscreen_target = acquire_window_render_target(GL_RGB8, true, 1);
+	if (offscreen_target == 0)
 	{
-		std::cout << "ERROR: Could not load offscreen_texture." << std::endl;
+		std::cout << "ERROR: Could not create offscreen render target." << std::endl;
 		return false;
 	}
-
-	// int w, h;
-	// int miplevel = 0;
-	// glGetTexLevelParameteriv(GL_TEXTURE_2D, miplevel, GL_TEXTURE_WIDTH, &w);
-	// glGetTexLevelParameteriv(GL_TEXTURE_2D, miplevel, GL_TEXTURE_HEIGHT, &h);
-
-	// generate a framebuffer 
-	glGenFramebuffers(1, &FBO);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
-	
-	// Set "renderedTexture" as our colour attachement #0
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, offscreen_texture, 0);
-	// Set the list of draw buffers.
-
-	// glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	// GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-	// glDrawBuffers(1, DrawBuffers);
-	
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		cout << "glCheckFramebufferStatus() ERROR: " << glGetError() << " and " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << endl;
-	}
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Set the list of draw buffers.
-	// GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-	// glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-
+	// the names stay valid across resizes, only their storage changes
+	offscreen_texture = offscreen_target->color_texture;
+	FBO = offscreen_target->fbo;
 
 	return true;
 }
@@ -670,30 +712,36 @@ b4 create_offscreen_texture()
 void onResize(int width, int height) {
 	sgl.width = width;
 	sgl.height = height;
-	glViewport(0, 0, sgl.width, sgl.height);
+	// the software rasterizer has no GL context, it reads sgl.width/height itself
+	if (!sgl.software)
+	{
+		glViewport(0, 0, sgl.width, sgl.height);
+		resize_render_targets(sgl.width, sgl.height);
+	}
 }
 
 void empty_program()
 {
-	glDeleteTextures(1,&offscreen_texture);
-	glDeleteTextures(1,&texture_2);
-	glDeleteTextures(1,&texture_apple);
-	glDeleteProgram(basic.program);
-	glDeleteProgram(basic_texture.program);
-	glDeleteProgram(color_verts.program);
-	glDeleteProgram(offscreen.program);
-	glDeleteBuffers(1, &cube.verts);
-	glDeleteBuffers(1, &cube.colors);
-	glDeleteBuffers(1, &cube.indices);
-	glDeleteBuffers(1, &cube.uv_coords);
-	glDeleteBuffers(1, &plane.verts);
-	glDeleteBuffers(1, &plane.colors);
-	glDeleteBuffers(1, &plane.indices);
-	glDeleteBuffers(1, &plane.uv_coords);
-	glDeleteBuffers(1, &pyramid.verts);
-	glDeleteBuffers(1, &pyramid.colors);
-	glDeleteBuffers(1, &pyramid.indices);
-	// glDeleteBuffers(1, &pyramid.uv_coords);
+	// the software rasterizer never created any GL objects
+	if (!sgl.software)
+	{
+		destroy_render_targets();
+		glDeleteBuffers(1, &cube.verts);
+		glDeleteBuffers(1, &cube.colors);
+		glDeleteBuffers(1, &cube.indices);
+		glDeleteBuffers(1, &cube.uv_coords);
+		glDeleteBuffers(1, &plane.verts);
+		glDeleteBuffers(1, &plane.colors);
+		glDeleteBuffers(1, &plane.indices);
+		glDeleteBuffers(1, &plane.uv_coords);
+		glDeleteBuffers(1, &pyramid.verts);
+		glDeleteBuffers(1, &pyramid.colors);
+		glDeleteBuffers(1, &pyramid.indices);
+		destroy_mesh_lods(cube);
+		destroy_mesh_lods(plane);
+		destroy_mesh_lods(pyramid);
+		// glDeleteBuffers(1, &pyramid.uv_coords);
+	}
 	SDL_DestroyWindow( sgl.window );
 	SDL_Quit();
 
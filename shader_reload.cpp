@@ -0,0 +1,211 @@
+/*
+	Shader hot-reload.
+
+	A watcher thread blocks on inotify for the working directory and marks
+	every cached shader variant when the uber sources are rewritten. The GL
+	thread picks the marks up once per frame in update_shader_reload(),
+	submits the compile and link, and only swaps the program into its
+	shader struct after the link has finished. With
+	GL_KHR_parallel_shader_compile the driver compiles on its own threads
+	and we poll GL_COMPLETION_STATUS_KHR, so a frame never waits on the
+	compiler. Without it the link is checked immediately, which costs one
+	hitch per edit but nothing otherwise.
+
+	A failed compile or link logs the error and keeps the old program.
+*/
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+
+struct PENDING_PROGRAM
+{
+	GLuint program;
+	GLuint vs;
+	GLuint fs;
+	b4 active;
+};
+
+struct SHADER_RELOAD
+{
+	s4 inotify_fd;
+	std::thread watcher;
+	std::atomic<u4> dirty_mask; // one bit per shader_variants entry
+	std::atomic<bool> running;
+	b4 parallel_compile;
+	PENDING_PROGRAM pending[MAX_SHADER_VARIANTS];
+} shader_reload;
+
+void shader_reload_watch()
+{
+	// inotify events are variable length, align the buffer for the header
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	pollfd pfd;
+	pfd.fd = shader_reload.inotify_fd;
+	pfd.events = POLLIN;
+
+	while (shader_reload.running)
+	{
+		// wake up periodically so stop_shader_reload() can join us
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		ssize_t length = read(shader_reload.inotify_fd, buffer, sizeof(buffer));
+		if (length <= 0) continue;
+
+		for (char* p = buffer; p < buffer + length; )
+		{
+			inotify_event* event = (inotify_event*)p;
+			if (event->len > 0 &&
+				(strcmp(event->name, UBER_VERTEX_FILE) == 0 || strcmp(event->name, UBER_FRAGMENT_FILE) == 0))
+			{
+				// every variant is built from the same sources
+				shader_reload.dirty_mask.fetch_or(0xFFFFFFFF);
+			}
+			p += sizeof(inotify_event) + event->len;
+		}
+	}
+}
+
+b4 start_shader_reload()
+{
+	shader_reload.dirty_mask = 0;
+	shader_reload.parallel_compile = false;
+#ifdef GL_KHR_parallel_shader_compile
+	if (GLEW_KHR_parallel_shader_compile)
+	{
+		// let the driver pick as many compiler threads as it wants
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		shader_reload.parallel_compile = true;
+	}
+#endif
+
+	shader_reload.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (shader_reload.inotify_fd < 0)
+	{
+		cerr << "Error: inotify_init1: " << strerror(errno) << endl;
+		return false;
+	}
+	// editors either rewrite in place or write a temp file and rename it over
+	if (inotify_add_watch(shader_reload.inotify_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		cerr << "Error: inotify_add_watch: " << strerror(errno) << endl;
+		close(shader_reload.inotify_fd);
+		shader_reload.inotify_fd = -1;
+		return false;
+	}
+
+	shader_reload.running = true;
+	shader_reload.watcher = std::thread(shader_reload_watch);
+	return true;
+}
+
+void discard_pending_program(PENDING_PROGRAM &p)
+{
+	if (p.program) glDeleteProgram(p.program);
+	if (p.vs) glDeleteShader(p.vs);
+	if (p.fs) glDeleteShader(p.fs);
+	p.program = p.vs = p.fs = 0;
+	p.active = false;
+}
+
+void begin_pending_program(s4 index)
+{
+	PENDING_PROGRAM &p = shader_reload.pending[index];
+	discard_pending_program(p);
+
+	char defines[512];
+	shader_variant_defines(shader_variants.variants[index].key, defines, sizeof(defines));
+	p.vs = begin_shader(UBER_VERTEX_FILE, GL_VERTEX_SHADER, defines);
+	p.fs = begin_shader(UBER_FRAGMENT_FILE, GL_FRAGMENT_SHADER, defines);
+	if (p.vs == 0 || p.fs == 0)
+	{
+		discard_pending_program(p);
+		return;
+	}
+	p.program = glCreateProgram();
+	glAttachShader(p.program, p.vs);
+	glAttachShader(p.program, p.fs);
+	glLinkProgram(p.program);
+	p.active = true;
+}
+
+void finish_pending_program(s4 index)
+{
+	PENDING_PROGRAM &p = shader_reload.pending[index];
+
+	GLint link_ok = GL_FALSE;
+	glGetProgramiv(p.program, GL_LINK_STATUS, &link_ok);
+	if (!link_ok)
+	{
+		GLint compile_ok = GL_FALSE;
+		glGetShaderiv(p.vs, GL_COMPILE_STATUS, &compile_ok);
+		if (!compile_ok) { cerr << UBER_VERTEX_FILE << ":" << endl; print_log(p.vs); }
+		glGetShaderiv(p.fs, GL_COMPILE_STATUS, &compile_ok);
+		if (!compile_ok) { cerr << UBER_FRAGMENT_FILE << ":" << endl; print_log(p.fs); }
+		cerr << "glLinkProgram:";
+		print_log(p.program);
+		cerr << "shader reload: keeping previous program" << endl;
+		discard_pending_program(p);
+		return;
+	}
+
+	glDetachShader(p.program, p.vs);
+	glDetachShader(p.program, p.fs);
+	GLuint program = p.program;
+	p.program = 0;
+	discard_pending_program(p);
+
+	replace_shader_variant(index, program);
+	cout << "shader reload: variant 0x" << std::hex << shader_variants.variants[index].key.bits << std::dec << endl;
+}
+
+/*
+	Call once per frame on the GL thread, before drawing.
+*/
+void update_shader_reload()
+{
+	u4 dirty = shader_reload.dirty_mask.exchange(0);
+	if (dirty)
+	{
+		// the saved files are newer than anything in the asset pack
+		asset_shadow(UBER_VERTEX_FILE);
+		asset_shadow(UBER_FRAGMENT_FILE);
+	}
+	for (s4 i = 0; i < shader_variants.count; i++)
+	{
+		if (dirty & (1u << i))
+		{
+			// a newer save restarts any compile still in flight
+			begin_pending_program(i);
+		}
+
+		PENDING_PROGRAM &p = shader_reload.pending[i];
+		if (!p.active) continue;
+
+#ifdef GL_KHR_parallel_shader_compile
+		if (shader_reload.parallel_compile)
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &done);
+			if (!done) continue;
+		}
+#endif
+		finish_pending_program(i);
+	}
+}
+
+void stop_shader_reload()
+{
+	if (!shader_reload.running) return;
+	shader_reload.running = false;
+	shader_reload.watcher.join();
+	close(shader_reload.inotify_fd);
+	shader_reload.inotify_fd = -1;
+	for (s4 i = 0; i < MAX_SHADER_VARIANTS; i++)
+	{
+		discard_pending_program(shader_reload.pending[i]);
+	}
+}
@@ -0,0 +1,269 @@
+/*
+	Shader permutations.
+
+	All scene shaders are variants of one source pair, uber.v.glsl and
+	uber.f.glsl. Optional parts are selected with #ifdef on the feature
+	names below. A variant is identified by SHADER_KEY, a bitmask of
+	SHADER_FEATURE values. The keys for the fixed shaders are constexpr, so
+	they are computed at compile time.
+
+	get_shader_program() compiles a variant the first time its key is
+	asked for and caches the program. precompile_shader_variants() warms
+	the cache with a known list at load. It submits every compile and
+	link before checking any of them, so drivers that compile in the
+	background can work on them all at once. The cache owns every
+	program. The bind_*_shader functions only look up locations.
+*/
+
+#define UBER_VERTEX_FILE "uber.v.glsl"
+#define UBER_FRAGMENT_FILE "uber.f.glsl"
+#define MAX_SHADER_VARIANTS 32 // shader_reload.cpp keeps one dirty bit per variant
+
+enum SHADER_FEATURE
+{
+	SHADER_TEXTURE       = 1 << 0, // tex_coord2d attribute sampled from tex_source
+	SHADER_VERTEX_COLOR  = 1 << 1, // v_color attribute
+	SHADER_UNIFORM_COLOR = 1 << 2, // vec3 in_color uniform
+	SHADER_ALPHA         = 1 << 3, // float in_alpha uniform, opaque otherwise
+	SHADER_GRAY          = 1 << 4, // float in_color uniform written to r, g and b
+	SHADER_INSTANCED     = 1 << 5, // per instance instance_position attribute
+	SHADER_MATERIAL      = 1 << 6, // color multiplied by the material, see uniform_blocks.cpp
+	SHADER_LIGHTS        = 1 << 7, // clustered lights, see lighting.cpp
+	SHADER_POINT_SPRITE  = 1 << 8, // point_size / point_color attributes drawn as round points, see particles.cpp
+};
+const s4 SHADER_FEATURE_COUNT = 9;
+
+const char* SHADER_FEATURE_NAMES[SHADER_FEATURE_COUNT] = {
+	"SHADER_TEXTURE",
+	"SHADER_VERTEX_COLOR",
+	"SHADER_UNIFORM_COLOR",
+	"SHADER_ALPHA",
+	"SHADER_GRAY",
+	"SHADER_INSTANCED",
+	"SHADER_MATERIAL",
+	"SHADER_LIGHTS",
+	"SHADER_POINT_SPRITE",
+};
+
+struct SHADER_KEY
+{
+	u4 bits;
+	constexpr SHADER_KEY(u4 bits = 0) : bits(bits) {}
+	constexpr SHADER_KEY operator|(SHADER_KEY other) const { return SHADER_KEY(bits | other.bits); }
+	constexpr b4 operator==(SHADER_KEY other) const { return bits == other.bits; }
+	constexpr b4 has(SHADER_FEATURE feature) const { return (bits & feature) != 0; }
+};
+
+constexpr SHADER_KEY operator|(SHADER_FEATURE a, SHADER_FEATURE b) { return SHADER_KEY((u4)a | (u4)b); }
+
+constexpr SHADER_KEY BASIC_SHADER_KEY         = SHADER_UNIFORM_COLOR | SHADER_ALPHA;
+constexpr SHADER_KEY BASIC_TEXTURE_SHADER_KEY = SHADER_TEXTURE | SHADER_MATERIAL | SHADER_LIGHTS;
+constexpr SHADER_KEY COLOR_VERTS_SHADER_KEY   = SHADER_VERTEX_COLOR | SHADER_MATERIAL | SHADER_LIGHTS;
+constexpr SHADER_KEY OFFSCREEN_SHADER_KEY     = SHADER_GRAY;
+constexpr SHADER_KEY POINT_SPRITE_SHADER_KEY  = SHADER_KEY(SHADER_POINT_SPRITE);
+
+struct SHADER_VARIANT
+{
+	SHADER_KEY key;
+	GLuint program;
+};
+
+struct SHADER_VARIANTS
+{
+	SHADER_VARIANT variants[MAX_SHADER_VARIANTS];
+	s4 count;
+} shader_variants;
+
+// global shader structs filled from a variant, rebound when it is recompiled
+struct SHADER_BINDING
+{
+	SHADER_KEY key;
+	b4 (*bind)(GLuint program);
+};
+
+SHADER_BINDING shader_bindings[] = {
+	{ BASIC_SHADER_KEY,         bind_basic_shader },
+	{ BASIC_TEXTURE_SHADER_KEY, bind_basic_texture_shader },
+	{ COLOR_VERTS_SHADER_KEY,   bind_color_verts_shader },
+	{ OFFSCREEN_SHADER_KEY,     bind_offscreen_shader },
+	{ POINT_SPRITE_SHADER_KEY,  bind_point_sprite_shader },
+};
+const s4 SHADER_BINDING_COUNT = sizeof(shader_bindings) / sizeof(shader_bindings[0]);
+
+/*
+	One #define line per feature in key, for begin_shader(). Uniform block
+	support is decided once for the whole context and is not part of the key.
+	SHADER_LIGHTS is dropped when the context cannot light, the variant is
+	then unlit.
+*/
+void shader_variant_defines(SHADER_KEY key, char* out, s4 size)
+{
+	s4 length = 0;
+	out[0] = 0;
+	if (uniform_blocks.enabled)
+	{
+		length += snprintf(out, size, "#extension GL_ARB_uniform_buffer_object : require\n#define SHADER_UBO\n");
+	}
+	for (s4 i = 0; i < SHADER_FEATURE_COUNT; i++)
+	{
+		if (!(key.bits & (1u << i))) continue;
+		if ((1u << i) == SHADER_LIGHTS && !lighting.enabled) continue;
+		length += snprintf(out + length, size - length, "#define %s\n", SHADER_FEATURE_NAMES[i]);
+		if (length >= size) break;
+	}
+}
+
+s4 find_shader_variant(SHADER_KEY key)
+{
+	for (s4 i = 0; i < shader_variants.count; i++)
+	{
+		if (shader_variants.variants[i].key == key) return i;
+	}
+	return -1;
+}
+
+s4 add_shader_variant(SHADER_KEY key, GLuint program)
+{
+	if (shader_variants.count >= MAX_SHADER_VARIANTS)
+	{
+		cerr << "ERROR: more than " << MAX_SHADER_VARIANTS << " shader variants" << endl;
+		glDeleteProgram(program);
+		return -1;
+	}
+	SHADER_VARIANT &v = shader_variants.variants[shader_variants.count];
+	v.key = key;
+	v.program = program;
+	bind_program_uniform_blocks(program);
+	bind_program_lights(program);
+	return shader_variants.count++;
+}
+
+/*
+	Program for key, compiled on first use. 0 if it does not compile.
+*/
+GLuint get_shader_program(SHADER_KEY key)
+{
+	s4 index = find_shader_variant(key);
+	if (index >= 0) return shader_variants.variants[index].program;
+
+	char defines[512];
+	shader_variant_defines(key, defines, sizeof(defines));
+	GLuint program;
+	if (!link_shader_program(UBER_VERTEX_FILE, UBER_FRAGMENT_FILE, program, defines))
+	{
+		cerr << "ERROR: shader variant 0x" << std::hex << key.bits << std::dec << " failed" << endl;
+		return 0;
+	}
+	index = add_shader_variant(key, program);
+	return index >= 0 ? program : 0;
+}
+
+/*
+	Compile and link every key not cached yet, submitting all of them
+	before waiting on any.
+*/
+void precompile_shader_variants(const SHADER_KEY* keys, s4 count)
+{
+	GLuint programs[MAX_SHADER_VARIANTS];
+	GLuint shaders[MAX_SHADER_VARIANTS][2];
+	SHADER_KEY submitted[MAX_SHADER_VARIANTS];
+	s4 submitted_count = 0;
+
+	for (s4 i = 0; i < count && submitted_count < MAX_SHADER_VARIANTS; i++)
+	{
+		if (find_shader_variant(keys[i]) >= 0) continue;
+		char defines[512];
+		shader_variant_defines(keys[i], defines, sizeof(defines));
+		GLuint vs = begin_shader(UBER_VERTEX_FILE, GL_VERTEX_SHADER, defines);
+		GLuint fs = begin_shader(UBER_FRAGMENT_FILE, GL_FRAGMENT_SHADER, defines);
+		GLuint program = glCreateProgram();
+		if (vs) glAttachShader(program, vs);
+		if (fs) glAttachShader(program, fs);
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+
+		programs[submitted_count] = program;
+		shaders[submitted_count][0] = vs;
+		shaders[submitted_count][1] = fs;
+		submitted[submitted_count] = keys[i];
+		submitted_count++;
+	}
+
+	for (s4 i = 0; i < submitted_count; i++)
+	{
+		GLint link_ok = GL_FALSE;
+		glGetProgramiv(programs[i], GL_LINK_STATUS, &link_ok);
+		for (s4 s = 0; s < 2; s++)
+		{
+			if (!shaders[i][s]) continue;
+			glDetachShader(programs[i], shaders[i][s]);
+			glDeleteShader(shaders[i][s]);
+		}
+		if (!link_ok)
+		{
+			// get_shader_program() will retry with the full error log on first use
+			glDeleteProgram(programs[i]);
+			continue;
+		}
+		add_shader_variant(submitted[i], programs[i]);
+	}
+}
+
+/*
+	Swap in a recompiled program for variant index and rebind every shader
+	struct built from it. Used by shader_reload.cpp.
+*/
+void replace_shader_variant(s4 index, GLuint program)
+{
+	SHADER_VARIANT &v = shader_variants.variants[index];
+	GLuint old = v.program;
+	v.program = program;
+	bind_program_uniform_blocks(program);
+	bind_program_lights(program);
+	for (s4 i = 0; i < SHADER_BINDING_COUNT; i++)
+	{
+		if (shader_bindings[i].key == v.key) shader_bindings[i].bind(program);
+	}
+	glDeleteProgram(old);
+}
+
+void destroy_shader_variants()
+{
+	for (s4 i = 0; i < shader_variants.count; i++)
+	{
+		glDeleteProgram(shader_variants.variants[i].program);
+	}
+	shader_variants.count = 0;
+}
+
+b4 create_shader_binding(SHADER_KEY key, b4 (*bind)(GLuint program))
+{
+	GLuint program = get_shader_program(key);
+	if (!program) return false;
+	return bind(program);
+}
+
+b4 create_basic_shader()
+{
+	return create_shader_binding(BASIC_SHADER_KEY, bind_basic_shader);
+}
+
+b4 create_basic_texture_shader()
+{
+	return create_shader_binding(BASIC_TEXTURE_SHADER_KEY, bind_basic_texture_shader);
+}
+
+b4 create_color_verts_shader()
+{
+	return create_shader_binding(COLOR_VERTS_SHADER_KEY, bind_color_verts_shader);
+}
+
+b4 create_offscreen_shader()
+{
+	return create_shader_binding(OFFSCREEN_SHADER_KEY, bind_offscreen_shader);
+}
+
+b4 create_point_sprite_shader()
+{
+	return create_shader_binding(POINT_SPRITE_SHADER_KEY, bind_point_sprite_shader);
+}
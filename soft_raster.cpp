@@ -0,0 +1,680 @@
+/*
+	Software rasterizer.
+
+	Selected with --software for machines without a usable GL driver. It
+	consumes the same PRIMITIVE CPU copies, object list and matrices as the
+	GL path and emulates the basic_texture and color_verts shaders, the
+	depth test and the GL_SRC_ALPHA blend set up in create_sgl().
+
+	soft_draw_object() transforms, near-clips and sets up triangles on the
+	calling thread and bins them into 64x64 tiles. soft_end_frame() then
+	rasterizes the tiles in parallel: each tile is owned by one thread, so
+	no locking is needed and triangles land in submission order. Inside a
+	tile work is done in 8x8 blocks. A block is skipped if it is entirely
+	outside an edge or if the triangle's nearest depth is behind the block's
+	farthest stored depth (a one level hierarchical depth buffer). Rows of a
+	block are shaded 8 pixels at a time with AVX2 when the CPU supports it,
+	with a scalar path otherwise.
+
+	The framebuffer is RGBA8, bottom row first, same layout as glReadPixels,
+	so frame_capture.cpp can consume it unchanged. Without a display the
+	renderer runs headless and frames can only be seen through capture.
+*/
+#include <immintrin.h>
+#include <cfloat>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_BLOCK_SIZE 8
+#define SOFT_MAX_TEXTURES 16
+
+struct SOFT_TEXTURE
+{
+	IMAGE* image;
+	u4* texels; // RGBA8, r in the low byte
+	s4 width;
+	s4 height;
+};
+
+struct SOFT_PLANE
+{
+	f4 a, b, c; // value = a*x + b*y + c
+};
+
+struct SOFT_TRIANGLE
+{
+	// edge functions, inside when >= bias (strictly > 0 for edges that are not top-left)
+	SOFT_PLANE edge[3];
+	f4 bias[3];
+	SOFT_PLANE z;
+	SOFT_PLANE inv_w;
+	SOFT_PLANE attr[3]; // uv or rgb, divided by w
+	SOFT_TEXTURE* texture; // 0 uses vertex colors
+	s4 min_x, min_y, max_x, max_y;
+	f4 min_z;
+};
+
+struct SOFT_RASTER
+{
+	s4 width;
+	s4 height;
+	s4 stride; // width rounded up to a whole block, in pixels
+	s4 rows;   // height rounded up to a whole block
+	u4* color;
+	f4* depth;
+	f4* block_max_z;
+	u4* present; // top row first copy for SDL
+	SDL_Surface* present_surface;
+	u4 clear_color;
+
+	s4 tiles_x;
+	s4 tiles_y;
+	std::vector<SOFT_TRIANGLE> triangles;
+	std::vector<std::vector<u4> > bins;
+
+	SOFT_TEXTURE textures[SOFT_MAX_TEXTURES];
+	s4 texture_count;
+
+	b4 use_avx2;
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	u4 generation;
+	std::atomic<s4> next_tile;
+	s4 tiles_left;
+	b4 running;
+} soft;
+
+inline u4 soft_pack_rgba(f4 r, f4 g, f4 b, f4 a)
+{
+	return (u4)(r * 255.0f + 0.5f) | ((u4)(g * 255.0f + 0.5f) << 8) |
+		((u4)(b * 255.0f + 0.5f) << 16) | ((u4)(a * 255.0f + 0.5f) << 24);
+}
+
+/*
+	Convert an IMAGE to RGBA8 texels the first time an object uses it.
+*/
+SOFT_TEXTURE* soft_texture(IMAGE* image)
+{
+	if (!image || !image->data) return 0;
+	for (s4 i = 0; i < soft.texture_count; i++)
+	{
+		if (soft.textures[i].image == image) return &soft.textures[i];
+	}
+	if (soft.texture_count >= SOFT_MAX_TEXTURES) return 0;
+
+	SOFT_TEXTURE &t = soft.textures[soft.texture_count++];
+	t.image = image;
+	t.width = image->x;
+	t.height = image->y;
+	t.texels = (u4*)malloc(t.width * t.height * sizeof(u4));
+	s4 channels = image->n;
+	for (s4 i = 0; i < t.width * t.height; i++)
+	{
+		const u1* p = image->data + i * channels;
+		u4 r = p[0];
+		u4 g = channels > 1 ? p[1] : r;
+		u4 b = channels > 2 ? p[2] : r;
+		u4 a = channels > 3 ? p[3] : 255;
+		t.texels[i] = r | (g << 8) | (b << 16) | (a << 24);
+	}
+	return &t;
+}
+
+/*
+	Shade and blend one pixel, the scalar twin of soft_raster_block_avx2().
+*/
+inline void soft_shade_pixel(const SOFT_TRIANGLE &t, f4 px, f4 py, s4 index, f4 z)
+{
+	f4 w = 1.0f / (t.inv_w.a * px + t.inv_w.b * py + t.inv_w.c);
+	f4 a0 = (t.attr[0].a * px + t.attr[0].b * py + t.attr[0].c) * w;
+	f4 a1 = (t.attr[1].a * px + t.attr[1].b * py + t.attr[1].c) * w;
+
+	u4 src;
+	if (t.texture)
+	{
+		// GL_NEAREST, GL_CLAMP_TO_EDGE
+		s4 tx = (s4)(a0 * t.texture->width);
+		s4 ty = (s4)(a1 * t.texture->height);
+		tx = tx < 0 ? 0 : (tx >= t.texture->width ? t.texture->width - 1 : tx);
+		ty = ty < 0 ? 0 : (ty >= t.texture->height ? t.texture->height - 1 : ty);
+		src = t.texture->texels[ty * t.texture->width + tx];
+	}
+	else
+	{
+		f4 a2 = (t.attr[2].a * px + t.attr[2].b * py + t.attr[2].c) * w;
+		src = soft_pack_rgba(glm::clamp(a0, 0.0f, 1.0f), glm::clamp(a1, 0.0f, 1.0f), glm::clamp(a2, 0.0f, 1.0f), 1.0f);
+	}
+
+	// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+	u4 alpha = src >> 24;
+	u4 out = src;
+	if (alpha != 255)
+	{
+		u4 dst = soft.color[index];
+		out = 0;
+		for (s4 c = 0; c < 32; c += 8)
+		{
+			u4 s = (src >> c) & 0xFF;
+			u4 d = (dst >> c) & 0xFF;
+			u4 v = (s * alpha + d * (255 - alpha) + 127) / 255;
+			out |= v << c;
+		}
+	}
+	soft.color[index] = out;
+	soft.depth[index] = z;
+}
+
+void soft_raster_block_scalar(const SOFT_TRIANGLE &t, s4 bx, s4 by)
+{
+	for (s4 y = by; y < by + SOFT_BLOCK_SIZE && y < soft.height; y++)
+	{
+		f4 py = y + 0.5f;
+		for (s4 x = bx; x < bx + SOFT_BLOCK_SIZE && x < soft.width; x++)
+		{
+			f4 px = x + 0.5f;
+			b4 inside = true;
+			for (s4 e = 0; e < 3; e++)
+			{
+				if (t.edge[e].a * px + t.edge[e].b * py + t.edge[e].c < t.bias[e]) inside = false;
+			}
+			if (!inside) continue;
+			f4 z = t.z.a * px + t.z.b * py + t.z.c;
+			s4 index = y * soft.stride + x;
+			if (z >= soft.depth[index]) continue; // GL_LESS
+			soft_shade_pixel(t, px, py, index, z);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+inline __m256 soft_plane8(const SOFT_PLANE &p, __m256 px, __m256 py)
+{
+	// same operation order as the scalar path, and no fma in the target so the
+	// compiler cannot fuse it, so both paths cover and sample the same pixels
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.a), px), _mm256_mul_ps(_mm256_set1_ps(p.b), py)), _mm256_set1_ps(p.c));
+}
+
+__attribute__((target("avx2")))
+void soft_raster_block_avx2(const SOFT_TRIANGLE &t, s4 bx, s4 by)
+{
+	const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256 px = _mm256_add_ps(_mm256_set1_ps((f4)bx), lane);
+	// lanes past the right edge of the screen stay masked, the padding in stride keeps loads in bounds
+	const __m256i in_screen = _mm256_cmpgt_epi32(_mm256_set1_epi32(soft.width - bx),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 c255 = _mm256_set1_ps(255.0f);
+	const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+
+	for (s4 y = by; y < by + SOFT_BLOCK_SIZE && y < soft.height; y++)
+	{
+		__m256 py = _mm256_set1_ps(y + 0.5f);
+		__m256 e0 = soft_plane8(t.edge[0], px, py);
+		__m256 e1 = soft_plane8(t.edge[1], px, py);
+		__m256 e2 = soft_plane8(t.edge[2], px, py);
+		__m256 inside = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(e0, _mm256_set1_ps(t.bias[0]), _CMP_GE_OQ),
+						  _mm256_cmp_ps(e1, _mm256_set1_ps(t.bias[1]), _CMP_GE_OQ)),
+			_mm256_cmp_ps(e2, _mm256_set1_ps(t.bias[2]), _CMP_GE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_castsi256_ps(in_screen));
+		if (_mm256_movemask_ps(inside) == 0) continue;
+
+		s4 index = y * soft.stride + bx;
+		__m256 z = soft_plane8(t.z, px, py);
+		__m256 stored = _mm256_loadu_ps(soft.depth + index);
+		__m256 mask = _mm256_and_ps(inside, _mm256_cmp_ps(z, stored, _CMP_LT_OQ));
+		if (_mm256_movemask_ps(mask) == 0) continue;
+		__m256i imask = _mm256_castps_si256(mask);
+
+		__m256 w = _mm256_div_ps(one, soft_plane8(t.inv_w, px, py));
+		__m256 a0 = _mm256_mul_ps(soft_plane8(t.attr[0], px, py), w);
+		__m256 a1 = _mm256_mul_ps(soft_plane8(t.attr[1], px, py), w);
+
+		__m256i src;
+		if (t.texture)
+		{
+			__m256i tw = _mm256_set1_epi32(t.texture->width);
+			__m256i th = _mm256_set1_epi32(t.texture->height);
+			__m256i tx = _mm256_cvttps_epi32(_mm256_mul_ps(a0, _mm256_cvtepi32_ps(tw)));
+			__m256i ty = _mm256_cvttps_epi32(_mm256_mul_ps(a1, _mm256_cvtepi32_ps(th)));
+			tx = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(tx, _mm256_sub_epi32(tw, _mm256_set1_epi32(1))));
+			ty = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(ty, _mm256_sub_epi32(th, _mm256_set1_epi32(1))));
+			__m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(ty, tw), tx);
+			src = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)t.texture->texels, offset, imask, 4);
+		}
+		else
+		{
+			__m256 a2 = _mm256_mul_ps(soft_plane8(t.attr[2], px, py), w);
+			__m256 zero = _mm256_setzero_ps();
+			__m256 half = _mm256_set1_ps(0.5f);
+			__m256i r = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(a0, zero), one), c255), half));
+			__m256i g = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(a1, zero), one), c255), half));
+			__m256i b = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(a2, zero), one), c255), half));
+			src = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+				_mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_set1_epi32((s4)0xFF000000)));
+		}
+
+		// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA), skipped when every lane is opaque
+		__m256i alpha = _mm256_srli_epi32(src, 24);
+		__m256i opaque = _mm256_cmpeq_epi32(alpha, byte_mask);
+		if ((_mm256_movemask_epi8(_mm256_or_si256(opaque, _mm256_xor_si256(imask, _mm256_set1_epi32(-1)))) != -1))
+		{
+			__m256i dst = _mm256_loadu_si256((const __m256i*)(soft.color + index));
+			__m256i ia = _mm256_sub_epi32(byte_mask, alpha);
+			__m256i out = _mm256_setzero_si256();
+			for (s4 c = 0; c < 32; c += 8)
+			{
+				__m256i s = _mm256_and_si256(_mm256_srli_epi32(src, c), byte_mask);
+				__m256i d = _mm256_and_si256(_mm256_srli_epi32(dst, c), byte_mask);
+				__m256i v = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(s, alpha), _mm256_mullo_epi32(d, ia)), _mm256_set1_epi32(127));
+				// divide by 255: (v + 1 + (v >> 8)) >> 8 is exact for v < 65536
+				v = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(v, _mm256_set1_epi32(1)), _mm256_srli_epi32(v, 8)), 8);
+				out = _mm256_or_si256(out, _mm256_slli_epi32(v, c));
+			}
+			src = out;
+		}
+
+		_mm256_maskstore_epi32((int*)(soft.color + index), imask, src);
+		_mm256_maskstore_ps(soft.depth + index, imask, z);
+	}
+}
+
+__attribute__((target("avx2")))
+f4 soft_block_max_z_avx2(s4 bx, s4 by)
+{
+	__m256 m = _mm256_setzero_ps();
+	for (s4 y = by; y < by + SOFT_BLOCK_SIZE; y++)
+	{
+		m = _mm256_max_ps(m, _mm256_loadu_ps(soft.depth + y * soft.stride + bx));
+	}
+	__m128 h = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+	h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+	h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+	return _mm_cvtss_f32(h);
+}
+
+f4 soft_block_max_z(s4 bx, s4 by)
+{
+	if (soft.use_avx2) return soft_block_max_z_avx2(bx, by);
+	f4 m = 0.0f;
+	for (s4 y = by; y < by + SOFT_BLOCK_SIZE; y++)
+	{
+		for (s4 x = bx; x < bx + SOFT_BLOCK_SIZE; x++)
+		{
+			if (soft.depth[y * soft.stride + x] > m) m = soft.depth[y * soft.stride + x];
+		}
+	}
+	return m;
+}
+
+void soft_raster_tile(s4 tile)
+{
+	s4 tx0 = (tile % soft.tiles_x) * SOFT_TILE_SIZE;
+	s4 ty0 = (tile / soft.tiles_x) * SOFT_TILE_SIZE;
+	s4 tx1 = tx0 + SOFT_TILE_SIZE < soft.stride ? tx0 + SOFT_TILE_SIZE : soft.stride;
+	s4 ty1 = ty0 + SOFT_TILE_SIZE < soft.rows ? ty0 + SOFT_TILE_SIZE : soft.rows;
+	s4 blocks_x = soft.stride / SOFT_BLOCK_SIZE;
+
+	for (s4 y = ty0; y < ty1; y++)
+	{
+		for (s4 x = tx0; x < tx1; x++)
+		{
+			soft.color[y * soft.stride + x] = soft.clear_color;
+			soft.depth[y * soft.stride + x] = 1.0f;
+		}
+	}
+	for (s4 by = ty0; by < ty1; by += SOFT_BLOCK_SIZE)
+	{
+		for (s4 bx = tx0; bx < tx1; bx += SOFT_BLOCK_SIZE)
+		{
+			soft.block_max_z[(by / SOFT_BLOCK_SIZE) * blocks_x + bx / SOFT_BLOCK_SIZE] = 1.0f;
+		}
+	}
+
+	std::vector<u4> &bin = soft.bins[tile];
+	for (size_t i = 0; i < bin.size(); i++)
+	{
+		const SOFT_TRIANGLE &t = soft.triangles[bin[i]];
+		s4 x0 = (t.min_x > tx0 ? t.min_x : tx0) & ~(SOFT_BLOCK_SIZE - 1);
+		s4 y0 = (t.min_y > ty0 ? t.min_y : ty0) & ~(SOFT_BLOCK_SIZE - 1);
+		s4 x1 = t.max_x < tx1 - 1 ? t.max_x : tx1 - 1;
+		s4 y1 = t.max_y < ty1 - 1 ? t.max_y : ty1 - 1;
+
+		for (s4 by = y0; by <= y1; by += SOFT_BLOCK_SIZE)
+		{
+			for (s4 bx = x0; bx <= x1; bx += SOFT_BLOCK_SIZE)
+			{
+				f4 &block_z = soft.block_max_z[(by / SOFT_BLOCK_SIZE) * blocks_x + bx / SOFT_BLOCK_SIZE];
+				if (t.min_z >= block_z) continue;
+
+				// the block is outside if its best corner is outside any edge
+				b4 outside = false;
+				for (s4 e = 0; e < 3 && !outside; e++)
+				{
+					f4 cx = bx + (t.edge[e].a > 0.0f ? SOFT_BLOCK_SIZE - 0.5f : 0.5f);
+					f4 cy = by + (t.edge[e].b > 0.0f ? SOFT_BLOCK_SIZE - 0.5f : 0.5f);
+					if (t.edge[e].a * cx + t.edge[e].b * cy + t.edge[e].c < t.bias[e]) outside = true;
+				}
+				if (outside) continue;
+
+				if (soft.use_avx2) soft_raster_block_avx2(t, bx, by);
+				else soft_raster_block_scalar(t, bx, by);
+				block_z = soft_block_max_z(bx, by);
+			}
+		}
+	}
+}
+
+void soft_run_tiles()
+{
+	s4 tile_count = soft.tiles_x * soft.tiles_y;
+	s4 finished = 0;
+	for (;;)
+	{
+		s4 tile = soft.next_tile.fetch_add(1);
+		if (tile >= tile_count) break;
+		soft_raster_tile(tile);
+		finished++;
+	}
+	if (finished)
+	{
+		std::lock_guard<std::mutex> guard(soft.lock);
+		soft.tiles_left -= finished;
+		if (soft.tiles_left == 0) soft.done.notify_one();
+	}
+}
+
+void soft_worker()
+{
+	u4 seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(soft.lock);
+			soft.wake.wait(guard, [&seen]{ return soft.generation != seen || !soft.running; });
+			if (!soft.running) return;
+			seen = soft.generation;
+		}
+		soft_run_tiles();
+	}
+}
+
+void soft_resize(s4 width, s4 height)
+{
+	soft.width = width;
+	soft.height = height;
+	soft.stride = (width + SOFT_BLOCK_SIZE - 1) & ~(SOFT_BLOCK_SIZE - 1);
+	soft.rows = (height + SOFT_BLOCK_SIZE - 1) & ~(SOFT_BLOCK_SIZE - 1);
+	soft.tiles_x = (soft.stride + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	soft.tiles_y = (soft.rows + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+
+	free(soft.color);
+	free(soft.depth);
+	free(soft.block_max_z);
+	free(soft.present);
+	soft.color = (u4*)malloc(soft.stride * soft.rows * sizeof(u4));
+	soft.depth = (f4*)malloc(soft.stride * soft.rows * sizeof(f4));
+	soft.block_max_z = (f4*)malloc((soft.stride / SOFT_BLOCK_SIZE) * (soft.rows / SOFT_BLOCK_SIZE) * sizeof(f4));
+	soft.present = (u4*)malloc(width * height * sizeof(u4));
+	soft.bins.resize(soft.tiles_x * soft.tiles_y);
+
+	if (soft.present_surface) SDL_FreeSurface(soft.present_surface);
+	soft.present_surface = SDL_CreateRGBSurfaceFrom(soft.present, width, height, 32, width * 4,
+		0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+	if (soft.present_surface) SDL_SetSurfaceBlendMode(soft.present_surface, SDL_BLENDMODE_NONE);
+}
+
+b4 init_soft_raster()
+{
+	soft.use_avx2 = SDL_HasAVX2();
+	soft.texture_count = 0;
+	soft.generation = 0;
+	soft_resize(sgl.width, sgl.height);
+
+	// the calling thread rasterizes too
+	s4 threads = SDL_GetCPUCount() - 1;
+	soft.running = true;
+	for (s4 i = 0; i < threads; i++)
+	{
+		soft.workers.push_back(std::thread(soft_worker));
+	}
+	cout << "software rasterizer: " << (soft.use_avx2 ? "AVX2" : "scalar") << ", "
+		 << threads + 1 << " threads" << endl;
+	return true;
+}
+
+void soft_begin_frame(f4 r, f4 g, f4 b, f4 a)
+{
+	if (soft.width != sgl.width || soft.height != sgl.height)
+	{
+		soft_resize(sgl.width, sgl.height);
+	}
+	soft.clear_color = soft_pack_rgba(r, g, b, a);
+	soft.triangles.clear();
+	for (size_t i = 0; i < soft.bins.size(); i++)
+	{
+		soft.bins[i].clear();
+	}
+}
+
+struct SOFT_VERTEX
+{
+	glm::vec4 clip;
+	f4 attr[3];
+};
+
+/*
+	Set up one screen space triangle from clip space vertices and bin it.
+*/
+void soft_setup_triangle(const SOFT_VERTEX* v, SOFT_TEXTURE* texture)
+{
+	f4 x[3], y[3], z[3], inv_w[3];
+	for (s4 i = 0; i < 3; i++)
+	{
+		inv_w[i] = 1.0f / v[i].clip.w;
+		x[i] = (v[i].clip.x * inv_w[i] * 0.5f + 0.5f) * soft.width;
+		y[i] = (v[i].clip.y * inv_w[i] * 0.5f + 0.5f) * soft.height;
+		z[i] = v[i].clip.z * inv_w[i] * 0.5f + 0.5f;
+	}
+
+	f4 area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0.0f) return;
+	// no face culling, so put both windings in the same orientation
+	s4 i1 = 1, i2 = 2;
+	if (area < 0.0f)
+	{
+		i1 = 2; i2 = 1;
+		area = -area;
+	}
+	s4 idx[3] = { 0, i1, i2 };
+
+	SOFT_TRIANGLE t;
+	t.texture = texture;
+	f4 min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	t.min_z = FLT_MAX;
+	for (s4 e = 0; e < 3; e++)
+	{
+		// edge e is opposite vertex e
+		s4 j = idx[(e + 1) % 3], k = idx[(e + 2) % 3];
+		t.edge[e].a = -(y[k] - y[j]);
+		t.edge[e].b = x[k] - x[j];
+		t.edge[e].c = -(t.edge[e].a * x[j] + t.edge[e].b * y[j]);
+		b4 top_left = t.edge[e].a > 0.0f || (t.edge[e].a == 0.0f && t.edge[e].b < 0.0f);
+		t.bias[e] = top_left ? 0.0f : FLT_MIN;
+
+		s4 i = idx[e];
+		if (x[i] < min_x) min_x = x[i];
+		if (y[i] < min_y) min_y = y[i];
+		if (x[i] > max_x) max_x = x[i];
+		if (y[i] > max_y) max_y = y[i];
+		if (z[i] < t.min_z) t.min_z = z[i];
+	}
+
+	t.min_x = (s4)floorf(min_x); if (t.min_x < 0) t.min_x = 0;
+	t.min_y = (s4)floorf(min_y); if (t.min_y < 0) t.min_y = 0;
+	t.max_x = (s4)ceilf(max_x);  if (t.max_x > soft.width - 1) t.max_x = soft.width - 1;
+	t.max_y = (s4)ceilf(max_y);  if (t.max_y > soft.height - 1) t.max_y = soft.height - 1;
+	if (t.min_x > t.max_x || t.min_y > t.max_y) return;
+
+	// barycentric b_e = edge_e / area, so any per vertex value q interpolates
+	// as sum(q_e * edge_e) / area, which is itself a plane
+	f4 inv_area = 1.0f / area;
+	f4 values[6][3];
+	for (s4 e = 0; e < 3; e++)
+	{
+		s4 i = idx[e];
+		values[0][e] = z[i];
+		values[1][e] = inv_w[i];
+		for (s4 a = 0; a < 3; a++) values[2 + a][e] = v[i].attr[a] * inv_w[i];
+	}
+	SOFT_PLANE* planes[5] = { &t.z, &t.inv_w, &t.attr[0], &t.attr[1], &t.attr[2] };
+	for (s4 p = 0; p < 5; p++)
+	{
+		planes[p]->a = (values[p][0] * t.edge[0].a + values[p][1] * t.edge[1].a + values[p][2] * t.edge[2].a) * inv_area;
+		planes[p]->b = (values[p][0] * t.edge[0].b + values[p][1] * t.edge[1].b + values[p][2] * t.edge[2].b) * inv_area;
+		planes[p]->c = (values[p][0] * t.edge[0].c + values[p][1] * t.edge[1].c + values[p][2] * t.edge[2].c) * inv_area;
+	}
+
+	u4 index = (u4)soft.triangles.size();
+	soft.triangles.push_back(t);
+	for (s4 ty = t.min_y / SOFT_TILE_SIZE; ty <= t.max_y / SOFT_TILE_SIZE; ty++)
+	{
+		for (s4 tx = t.min_x / SOFT_TILE_SIZE; tx <= t.max_x / SOFT_TILE_SIZE; tx++)
+		{
+			soft.bins[ty * soft.tiles_x + tx].push_back(index);
+		}
+	}
+}
+
+/*
+	Clip against the near plane (z >= -w) and emit the remaining polygon as
+	a fan. Everything else is handled by the screen bounds and depth test.
+*/
+void soft_clip_triangle(const SOFT_VERTEX* in, SOFT_TEXTURE* texture)
+{
+	f4 d[3];
+	s4 inside = 0;
+	for (s4 i = 0; i < 3; i++)
+	{
+		d[i] = in[i].clip.z + in[i].clip.w;
+		if (d[i] >= 0.0f) inside++;
+	}
+	if (inside == 3) { soft_setup_triangle(in, texture); return; }
+	if (inside == 0) return;
+
+	SOFT_VERTEX poly[4];
+	s4 count = 0;
+	for (s4 i = 0; i < 3; i++)
+	{
+		s4 j = (i + 1) % 3;
+		if (d[i] >= 0.0f) poly[count++] = in[i];
+		if ((d[i] >= 0.0f) != (d[j] >= 0.0f))
+		{
+			f4 s = d[i] / (d[i] - d[j]);
+			SOFT_VERTEX &o = poly[count++];
+			o.clip = in[i].clip + (in[j].clip - in[i].clip) * s;
+			for (s4 a = 0; a < 3; a++) o.attr[a] = in[i].attr[a] + (in[j].attr[a] - in[i].attr[a]) * s;
+		}
+	}
+	for (s4 i = 1; i + 1 < count; i++)
+	{
+		SOFT_VERTEX tri[3] = { poly[0], poly[i], poly[i+1] };
+		soft_setup_triangle(tri, texture);
+	}
+}
+
+void soft_draw_object(RENDER_OBJECT &o, glm::mat4 &view, glm::mat4 &projection, vec3 scale)
+{
+	PRIMITIVE &mesh = *o.mesh;
+	SOFT_TEXTURE* texture = mesh.cpu_uvs ? soft_texture(o.image) : 0;
+	if (!texture && !mesh.cpu_colors) return;
+
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), o.position);
+	glm::mat4 mvp = projection * view * model;
+
+	for (s4 i = 0; i + 2 < mesh.index_count; i += 3)
+	{
+		SOFT_VERTEX tri[3];
+		for (s4 k = 0; k < 3; k++)
+		{
+			s4 vi = mesh.cpu_indices[i + k];
+			const f4* p = mesh.cpu_verts + vi * 3;
+			tri[k].clip = mvp * glm::vec4(p[0] * scale.x, p[1] * scale.y, p[2] * scale.z, 1.0f);
+			if (texture)
+			{
+				tri[k].attr[0] = mesh.cpu_uvs[vi*2+0];
+				tri[k].attr[1] = mesh.cpu_uvs[vi*2+1];
+				tri[k].attr[2] = 0.0f;
+			}
+			else
+			{
+				for (s4 a = 0; a < 3; a++) tri[k].attr[a] = mesh.cpu_colors[vi*3+a];
+			}
+		}
+		soft_clip_triangle(tri, texture);
+	}
+	stats.draws++;
+	stats.triangles += mesh.index_count / 3;
+}
+
+/*
+	Rasterize every binned triangle. Returns once the framebuffer is done.
+*/
+void soft_end_frame()
+{
+	{
+		std::lock_guard<std::mutex> guard(soft.lock);
+		soft.next_tile = 0;
+		soft.tiles_left = soft.tiles_x * soft.tiles_y;
+		soft.generation++;
+	}
+	soft.wake.notify_all();
+	soft_run_tiles();
+
+	std::unique_lock<std::mutex> guard(soft.lock);
+	soft.done.wait(guard, []{ return soft.tiles_left == 0; });
+}
+
+/*
+	Show the framebuffer in the window, if there is one.
+*/
+void soft_present()
+{
+	if (!sgl.window || !soft.present_surface) return;
+	for (s4 y = 0; y < soft.height; y++)
+	{
+		memcpy(soft.present + y * soft.width, soft.color + (soft.height - 1 - y) * soft.stride, soft.width * sizeof(u4));
+	}
+	SDL_Surface* window_surface = SDL_GetWindowSurface(sgl.window);
+	if (!window_surface) return;
+	SDL_BlitSurface(soft.present_surface, 0, window_surface, 0);
+	SDL_UpdateWindowSurface(sgl.window);
+}
+
+void destroy_soft_raster()
+{
+	{
+		std::lock_guard<std::mutex> guard(soft.lock);
+		soft.running = false;
+	}
+	soft.wake.notify_all();
+	for (size_t i = 0; i < soft.workers.size(); i++)
+	{
+		soft.workers[i].join();
+	}
+	soft.workers.clear();
+	for (s4 i = 0; i < soft.texture_count; i++)
+	{
+		free(soft.textures[i].texels);
+	}
+	if (soft.present_surface) SDL_FreeSurface(soft.present_surface);
+	free(soft.color);
+	free(soft.depth);
+	free(soft.block_max_z);
+	free(soft.present);
+}
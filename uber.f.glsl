@@ -0,0 +1,95 @@
+// every variant of the scene shaders, see shader_variants.cpp for the feature defines
+#ifdef SHADER_LIGHTS
+#extension GL_EXT_gpu_shader4 : require
+#endif
+varying vec3 f_color;
+
+#ifdef SHADER_TEXTURE
+varying vec2 UV;
+uniform sampler2D tex_source;
+#endif
+
+#ifdef SHADER_ALPHA
+uniform float in_alpha;
+#endif
+
+#ifdef SHADER_MATERIAL
+#ifdef SHADER_UBO
+// std140 MATERIAL_BLOCK in uniform_blocks.cpp
+layout(std140) uniform material_block {
+	vec4 material_color;
+};
+#else
+uniform vec4 material_color;
+#endif
+#endif
+
+#ifdef SHADER_POINT_SPRITE
+varying float f_alpha;
+#endif
+
+#ifdef SHADER_LIGHTS
+// texture buffers filled by update_light_clusters() in lighting.cpp
+uniform samplerBuffer light_data;
+uniform samplerBuffer light_grid;
+uniform samplerBuffer light_indices;
+varying vec3 v_view_position;
+
+vec3 shade_lights(vec3 p)
+{
+	vec3 n = normalize(cross(dFdx(p), dFdy(p)));
+	if (dot(n, p) > 0.0) n = -n; // two sided
+
+	vec4 ambient = texelFetchBuffer(light_data, 0);
+	vec4 mapping = texelFetchBuffer(light_data, 1);
+	vec4 size = texelFetchBuffer(light_data, 2);
+	vec4 origin = texelFetchBuffer(light_data, 3);
+	int x = int(clamp((gl_FragCoord.x - origin.x) * mapping.x, 0.0, size.x - 1.0));
+	int y = int(clamp((gl_FragCoord.y - origin.y) * mapping.y, 0.0, size.y - 1.0));
+	int z = int(clamp(log(-p.z) * mapping.z + mapping.w, 0.0, size.z - 1.0));
+	vec4 cluster = texelFetchBuffer(light_grid, (z * int(size.y) + y) * int(size.x) + x);
+
+	vec3 light = ambient.rgb;
+	int first = int(cluster.x);
+	int count = int(cluster.y);
+	for (int i = 0; i < count; i++)
+	{
+		int l = 4 + int(texelFetchBuffer(light_indices, first + i).r) * 3;
+		vec4 position = texelFetchBuffer(light_data, l);     // xyz, range
+		vec4 color = texelFetchBuffer(light_data, l + 1);    // rgb, cos_inner
+		vec4 direction = texelFetchBuffer(light_data, l + 2); // xyz, cos_outer
+		vec3 to_light = position.xyz - p;
+		float d2 = dot(to_light, to_light);
+		float window = clamp(1.0 - d2 / (position.w * position.w), 0.0, 1.0);
+		vec3 L = to_light * inversesqrt(max(d2, 0.0001));
+		float cone = 1.0;
+		if (direction.w > -1.0) cone = smoothstep(direction.w, color.w, dot(-L, direction.xyz));
+		light += color.rgb * (max(dot(n, L), 0.0) * window * window * cone);
+	}
+	return light;
+}
+#endif
+
+void main(void) {
+#ifdef SHADER_TEXTURE
+	vec4 color = texture2D(tex_source, UV);
+#else
+	vec4 color = vec4(f_color, 1.0);
+#endif
+
+#ifdef SHADER_ALPHA
+	color.a = in_alpha;
+#endif
+#ifdef SHADER_MATERIAL
+	color *= material_color;
+#endif
+#ifdef SHADER_LIGHTS
+	color.rgb *= shade_lights(v_view_position);
+#endif
+#ifdef SHADER_POINT_SPRITE
+	// round, fading towards the rim
+	vec2 d = gl_PointCoord * 2.0 - 1.0;
+	color.a = f_alpha * clamp(1.0 - dot(d, d), 0.0, 1.0);
+#endif
+	gl_FragColor = color;
+}
@@ -0,0 +1,87 @@
+// every variant of the scene shaders, see shader_variants.cpp for the feature defines
+attribute vec3 coord3d;
+uniform mat4 model;
+uniform vec3 scale;
+
+#ifdef SHADER_UBO
+// std140 CAMERA_BLOCK in uniform_blocks.cpp
+layout(std140) uniform camera_block {
+	mat4 view;
+	mat4 proj;
+	mat4 view_proj;
+	float time;
+};
+#else
+uniform mat4 view;
+uniform mat4 proj;
+#endif
+varying vec3 f_color;
+
+#ifdef SHADER_TEXTURE
+attribute vec2 tex_coord2d;
+varying vec2 UV;
+#endif
+
+#ifdef SHADER_VERTEX_COLOR
+attribute vec3 v_color;
+#endif
+
+#ifdef SHADER_UNIFORM_COLOR
+uniform vec3 in_color;
+#endif
+
+#ifdef SHADER_GRAY
+uniform float in_color;
+#endif
+
+#ifdef SHADER_INSTANCED
+attribute vec3 instance_position;
+#endif
+
+#ifdef SHADER_LIGHTS
+varying vec3 v_view_position;
+#endif
+
+#ifdef SHADER_POINT_SPRITE
+attribute float point_size; // world units
+attribute vec4 point_color;
+uniform float viewport_height;
+varying float f_alpha;
+#endif
+
+void main(void) {
+	vec3 scaled_vertex = coord3d * scale;
+	vec4 world = model * vec4(scaled_vertex, 1.0);
+#ifdef SHADER_INSTANCED
+	world.xyz += instance_position;
+#endif
+#ifdef SHADER_UBO
+	gl_Position = view_proj * world;
+#else
+	gl_Position = proj * view * world;
+#endif
+#ifdef SHADER_LIGHTS
+	v_view_position = (view * world).xyz;
+#endif
+
+#ifdef SHADER_TEXTURE
+	UV = tex_coord2d;
+#endif
+#ifdef SHADER_POINT_SPRITE
+	// the same size in pixels a quad of point_size would have at this depth
+	gl_PointSize = point_size * proj[1][1] * 0.5 * viewport_height / gl_Position.w;
+	f_alpha = point_color.a;
+#endif
+
+#if defined(SHADER_VERTEX_COLOR)
+	f_color = v_color;
+#elif defined(SHADER_UNIFORM_COLOR)
+	f_color = in_color;
+#elif defined(SHADER_POINT_SPRITE)
+	f_color = point_color.rgb;
+#elif defined(SHADER_GRAY)
+	f_color = vec3(in_color, in_color, in_color);
+#else
+	f_color = vec3(1.0, 1.0, 1.0);
+#endif
+}
@@ -0,0 +1,175 @@
+/*
+	Uniform blocks.
+
+	With GL 3.1 or ARB_uniform_buffer_object every scene shader variant is
+	built with SHADER_UBO. The camera (view, proj, view_proj, time) then
+	lives in one std140 block at CAMERA_BLOCK_BINDING. update_camera_block()
+	writes it once per frame and every program reads it from there, so
+	draws no longer upload matrices.
+
+	Materials are small std140 blocks sub-allocated from a single buffer,
+	one slot per material at the driver's offset alignment. A draw selects
+	its material with glBindBufferRange() at MATERIAL_BLOCK_BINDING, and
+	only when the material changes, which prepares for batching draws by
+	material.
+
+	Without uniform buffers (GL 2.1, GLES 2, or --no-ubo) shaders declare
+	plain uniforms instead. The camera is set whenever a program is
+	selected and the material color once per draw, like before.
+*/
+
+#define CAMERA_BLOCK_BINDING 0
+#define MATERIAL_BLOCK_BINDING 1
+#define MAX_MATERIALS 256
+
+// std140 layouts, must match uber.v.glsl / uber.f.glsl
+struct CAMERA_BLOCK
+{
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::mat4 view_proj;
+	f4 time;
+	f4 pad[3];
+};
+
+struct MATERIAL_BLOCK
+{
+	glm::vec4 color; // multiplies the shaded color, a is opacity
+};
+
+struct UNIFORM_BLOCKS
+{
+	b4 enabled;
+	gu camera_buffer;
+	gu material_buffer;
+	s4 material_stride; // sizeof(MATERIAL_BLOCK) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	MATERIAL_BLOCK materials[MAX_MATERIALS];
+	s4 material_count;
+	b4 materials_dirty;
+} uniform_blocks;
+
+/*
+	Decide between uniform blocks and plain uniforms. Call before any
+	shader variant is compiled.
+*/
+void init_uniform_blocks(b4 allow)
+{
+	uniform_blocks.enabled = false;
+	uniform_blocks.material_count = 0;
+
+	int profile;
+	SDL_GL_GetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, &profile);
+	if (allow && profile != SDL_GL_CONTEXT_PROFILE_ES && (GLEW_VERSION_3_1 || GLEW_ARB_uniform_buffer_object))
+	{
+		uniform_blocks.enabled = true;
+
+		GLint alignment = 16;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		if (alignment < (GLint)sizeof(MATERIAL_BLOCK)) alignment = sizeof(MATERIAL_BLOCK);
+		uniform_blocks.material_stride = (sizeof(MATERIAL_BLOCK) + alignment - 1) / alignment * alignment;
+
+		glGenBuffers(1, &uniform_blocks.camera_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, uniform_blocks.camera_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(CAMERA_BLOCK), 0, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, uniform_blocks.camera_buffer);
+
+		glGenBuffers(1, &uniform_blocks.material_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, uniform_blocks.material_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * uniform_blocks.material_stride, 0, GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	cout << "uniform blocks: " << (uniform_blocks.enabled ? "on" : "off, using plain uniforms") << endl;
+}
+
+void destroy_uniform_blocks()
+{
+	if (!uniform_blocks.enabled) return;
+	glDeleteBuffers(1, &uniform_blocks.camera_buffer);
+	glDeleteBuffers(1, &uniform_blocks.material_buffer);
+	uniform_blocks.camera_buffer = 0;
+	uniform_blocks.material_buffer = 0;
+}
+
+/*
+	Point a freshly linked program's blocks at the fixed binding points.
+*/
+void bind_program_uniform_blocks(GLuint program)
+{
+	if (!uniform_blocks.enabled) return;
+	GLuint camera = glGetUniformBlockIndex(program, "camera_block");
+	if (camera != GL_INVALID_INDEX) glUniformBlockBinding(program, camera, CAMERA_BLOCK_BINDING);
+	GLuint material = glGetUniformBlockIndex(program, "material_block");
+	if (material != GL_INVALID_INDEX) glUniformBlockBinding(program, material, MATERIAL_BLOCK_BINDING);
+}
+
+void update_camera_block(const glm::mat4 &view, const glm::mat4 &projection, f4 time)
+{
+	if (!uniform_blocks.enabled) return;
+	CAMERA_BLOCK block;
+	block.view = view;
+	block.proj = projection;
+	block.view_proj = projection * view;
+	block.time = time;
+	block.pad[0] = block.pad[1] = block.pad[2] = 0.0f;
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_blocks.camera_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+	Plain uniform fallback for the camera, no-op when the block is used.
+*/
+inline void set_camera_uniforms(gi uniform_view, gi uniform_proj, const glm::mat4 &view, const glm::mat4 &projection)
+{
+	if (uniform_blocks.enabled) return;
+	glUniformMatrix4fv(uniform_view, 1, GL_FALSE, glm::value_ptr(view));
+	glUniformMatrix4fv(uniform_proj, 1, GL_FALSE, glm::value_ptr(projection));
+}
+
+s4 create_material(glm::vec4 color)
+{
+	if (uniform_blocks.material_count >= MAX_MATERIALS)
+	{
+		cerr << "ERROR: out of materials" << endl;
+		return 0;
+	}
+	uniform_blocks.materials[uniform_blocks.material_count].color = color;
+	uniform_blocks.materials_dirty = true;
+	return uniform_blocks.material_count++;
+}
+
+/*
+	Copy every material into its slot of the shared buffer if any changed.
+*/
+void upload_materials()
+{
+	if (!uniform_blocks.enabled || !uniform_blocks.materials_dirty) return;
+	s4 stride = uniform_blocks.material_stride;
+	u1* staging = (u1*)calloc(uniform_blocks.material_count, stride);
+	for (s4 i = 0; i < uniform_blocks.material_count; i++)
+	{
+		memcpy(staging + i * stride, &uniform_blocks.materials[i], sizeof(MATERIAL_BLOCK));
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_blocks.material_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, uniform_blocks.material_count * stride, staging);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	free(staging);
+	uniform_blocks.materials_dirty = false;
+}
+
+/*
+	Select material for the next draws. uniform_material is the program's
+	material_color location, only used without uniform blocks.
+*/
+inline void bind_material(s4 material, gi uniform_material)
+{
+	if (uniform_blocks.enabled)
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, uniform_blocks.material_buffer,
+			material * uniform_blocks.material_stride, sizeof(MATERIAL_BLOCK));
+	}
+	else
+	{
+		glUniform4fv(uniform_material, 1, glm::value_ptr(uniform_blocks.materials[material].color));
+	}
+}